@@ -32,8 +32,10 @@
 #ifndef AFFORDANCES_H
 #define AFFORDANCES_H
 
+#include <boost/random/mersenne_twister.hpp>
 #include <fstream>
 #include <iostream>
+#include <map>
 #include <omp.h>
 #include <pcl/features/feature.h>
 #include <pcl/features/normal_3d.h>
@@ -46,6 +48,7 @@
 #include <string>
 #include "curvature_estimation_taubin.h"
 #include "curvature_estimation_taubin.hpp"
+#include "curvature_estimation_tsdf.h"
 #include "cylindrical_shell.h"
 
 #include "ros/ros.h"
@@ -64,6 +67,31 @@ struct WorkspaceLimits
 	double max_z;
 };
 
+// region of interest in which affordances are searched for: either an axis-aligned box or a 
+// Gaussian (points within <roi_sigma> Mahalanobis distance of the mean are inside the region)
+struct RegionOfInterest
+{
+	bool is_gaussian;
+	WorkspaceLimits box;
+	Eigen::Vector3d mean;
+	Eigen::Matrix3d covariance;
+};
+
+// result of searching a single point cloud file in a batch
+struct BatchResult
+{
+	std::string file;
+	bool success;
+	int num_points;
+	std::vector<CylindricalShell> shells;
+	std::vector< std::vector<CylindricalShell> > handles;
+	double load_time;
+	double search_time;
+	double handle_time;
+	// messages of this file, printed in file order once the batch is done
+	std::string log;
+};
+
 /** \brief Affordances localizes grasp affordances and handles in a point cloud. It also provides 
   * helper methods to filter out points from the point cloud that are outside of the robot's 
   * workspace.
@@ -79,6 +107,13 @@ class Affordances
 		void 
     initParams(ros::NodeHandle node);
     
+    /** \brief Read the parameters from a map of parameter names to values. Parameters that are 
+      * not in the map are set to their default values. This does not require a ROS master.
+      * \param params the parameter values, keyed by the names used in the ROS launch files
+      */ 
+    void 
+    initParams(const std::map<std::string, std::string> &params);
+    
     /** \brief Filter out all points from a given cloud that are outside of a sphere with a radius 
      * max_range and center at the origin of the point cloud, and return the filtered cloud.
      * \param cloud_in the point cloud to be filtered
@@ -100,7 +135,49 @@ class Affordances
     PointCloudRGB::Ptr 
     workspaceFilter(const PointCloudRGB::Ptr &cloud_in);
         
-    /** \brief Search grasp affordances (cylindrical shells) in a given point cloud.
+    /** \brief Filter out all points from a given cloud that are outside of the regions of interest 
+     * (enlarged by the neighborhood radius and the clearance around a handle, so that the 
+     * neighborhoods of samples near the border stay complete), and return the filtered cloud. If 
+     * no regions of interest are set, the workspace filtered cloud is returned.
+     * \param cloud_in the point cloud to be filtered
+     */
+    PointCloud::Ptr 
+    regionOfInterestFilter(const PointCloud::Ptr &cloud_in);
+    
+    /** \brief Return the margin by which regionOfInterestFilter enlarges the regions of interest: 
+     * the neighborhood radius plus the clearance around a handle. A Gaussian region is enlarged by 
+     * the margin along each of its principal axes.
+     */
+    double 
+    getRegionOfInterestMargin();
+    
+    /** \brief Set the regions of interest. If any are set, the samples of the affordance search 
+     * are only drawn from points inside these regions instead of the whole workspace.
+     * \param regions the regions of interest
+     */
+    void 
+    setRegionsOfInterest(const std::vector<RegionOfInterest> &regions);
+    
+    /** \brief Remove all regions of interest, i.e., search the whole workspace again.
+     */
+    void 
+    clearRegionsOfInterest() { this->regions_of_interest.resize(0); }
+    
+    /** \brief Set the TSDF volume that is searched for affordances if the TSDF curvature 
+     * estimator is used.
+     * \param volume the TSDF volume
+     */
+    void 
+    setTSDFVolume(const boost::shared_ptr<const TSDFVolume> &volume) { this->tsdf_volume = volume; }
+    
+    /** \brief Return whether any regions of interest are set.
+     */
+    bool 
+    hasRegionsOfInterest() { return this->regions_of_interest.size() > 0; }
+        
+    /** \brief Search grasp affordances (cylindrical shells) in a given point cloud. If regions of 
+     * interest are set and Taubin Quadric Fitting is used, the samples are drawn only from these 
+     * regions.
      * \param cloud the point cloud in which affordances are searched for
      */
     std::vector<CylindricalShell> 
@@ -117,22 +194,55 @@ class Affordances
      * This function uses Taubin Quadric Fitting.
      * \param cloud the point cloud in which affordances are searched for
      * \param samples a 3xn matrix of points sampled from the point cloud
+     * \param is_logging whether progress is printed
+     * \param rng the random generator of the curvature estimator (std::rand if NULL); only set it 
+     * if <num_threads> is 1
      */
     std::vector<CylindricalShell> 
     searchAffordancesTaubin(const PointCloud::Ptr &cloud, const Eigen::MatrixXd &samples, 
-      bool is_logging = true);
+      bool is_logging = true, boost::mt19937 *rng = NULL);
         
     /** \brief Search handles in a set of cylindrical shells. If occlusion filtering is turned on 
      * (using the corresponding parameter in the ROS launch file), the handles found are filtered 
      * on possible occlusions.
      * \param cloud the point cloud in which the handles lie (only required for occlusion filtering)
      * \param shells the set of cylindrical shells to be searched for handles
+     * \param is_logging whether progress is printed
      */
     std::vector< std::vector<CylindricalShell> > 
-    searchHandles(const PointCloud::Ptr &cloud, std::vector<CylindricalShell> shells);
+    searchHandles(const PointCloud::Ptr &cloud, std::vector<CylindricalShell> shells, 
+      bool is_logging = true);
+    
+    /** \brief Search grasp affordances and handles in a list of *.pcd files. The files are 
+     * distributed dynamically over a pool of threads, and each file is searched single-threaded, 
+     * so that large and small clouds balance out across the pool. The curvature estimator is chosen 
+     * as in searchAffordances; the TSDF estimator needs a volume and cannot search *.pcd files.
+     * Messages are collected per file and printed in file order after the search.
+     * \param files the *.pcd files to be searched
+     * \param num_file_threads the number of files that are searched concurrently
+     * \param seed the seed of the random generator of the first file; file i uses seed + i, so the 
+     * samples of a file do not depend on which thread searches it
+     */
+    std::vector<BatchResult> 
+    searchAffordancesBatch(const std::vector<std::string> &files, int num_file_threads, 
+      unsigned int seed);
     
+    /** \brief Draw a given number of random indices of finite points that lie inside the workspace.
+     * \param cloud the point cloud from which the indices are drawn
+     * \param size the number of indices
+     * \param rng the random generator (std::rand if NULL)
+     */
     std::vector<int> 
-    createRandomIndices(const PointCloud::Ptr &cloud, int size);
+    createRandomIndices(const PointCloud::Ptr &cloud, int size, boost::mt19937 *rng = NULL);
+    
+    /** \brief Draw a given number of random indices of finite points that lie inside the regions 
+     * of interest and the workspace. Returns an empty vector if there are no such points.
+     * \param cloud the point cloud from which the indices are drawn
+     * \param size the number of indices
+     * \param rng the random generator (std::rand if NULL)
+     */
+    std::vector<int> 
+    createRegionOfInterestIndices(const PointCloud::Ptr &cloud, int size, boost::mt19937 *rng = NULL);
     
     /** \brief Check whether a given point, using its x, y, and z coordinates, is within the 
      * workspace of the robot.
@@ -158,6 +268,11 @@ class Affordances
   
 	private:    
   
+    /** \brief Print the parameters.
+      */
+    void 
+    printParams();
+    
     /** \brief Estimate surface normals for each point in the point cloud.
      * \param cloud the point cloud for which surface normals are estimated
      * \param cloud_normals the resultant point cloud that contains the surface normals
@@ -193,9 +308,12 @@ class Affordances
     /** \brief Search grasp affordances (cylindrical shells) in a given point cloud using surface 
      * normals.
      * \param cloud the point cloud in which affordances are searched for
+     * \param is_logging whether progress is printed
+     * \param rng the random generator (std::rand if NULL)
      */
     std::vector<CylindricalShell> 
-    searchAffordancesNormalsOrPCA(const PointCloud::Ptr &cloud);
+    searchAffordancesNormalsOrPCA(const PointCloud::Ptr &cloud, bool is_logging = true, 
+      boost::mt19937 *rng = NULL);
 				
     /** \brief Search grasp affordances (cylindrical shells) in a given point cloud using Taubin 
      * Quadric Fitting.
@@ -204,6 +322,12 @@ class Affordances
     std::vector<CylindricalShell> 
     searchAffordancesTaubin(const PointCloud::Ptr &cloud);
     
+    /** \brief Search grasp affordances (cylindrical shells) at zero-crossings of the TSDF volume, 
+     * using the normals and curvatures of the distance field instead of neighborhood searches.
+     */
+    std::vector<CylindricalShell> 
+    searchAffordancesTSDF();
+    
     /** \brief Find the best (largest number of inliers) set of colinear cylindrical shells given a 
      * list of shells.
      * \param list the list of cylindrical shells
@@ -223,6 +347,19 @@ class Affordances
      * \param radius the radius of the sphere
      */
 		int numInFront(const PointCloud::Ptr &cloud, int center_index, double radius);
+    
+    /** \brief Draw a random index in [0, size) from a given random generator, or from std::rand 
+     * if there is none.
+     */
+    int randomIndex(int size, boost::mt19937 *rng);
+    
+    /** \brief Find the indices of all finite points in the workspace that lie inside any of the 
+     * regions of interest, each enlarged by a given margin.
+     * \param cloud the point cloud
+     * \param margin the margin by which the regions are enlarged
+     */
+    std::vector<int> 
+    findRegionOfInterestIndices(const PointCloud::Ptr &cloud, double margin);
 
     // parameters (read-in from ROS launch file)
 		double target_radius;
@@ -239,6 +376,7 @@ class Affordances
 		double alignment_orient_radius;
 		double alignment_radius_radius;
 		WorkspaceLimits workspace_limits;
+		double roi_sigma;
 		int num_threads;
     std::string file;
 		
@@ -261,6 +399,10 @@ class Affordances
 		static const double ALIGNMENT_RADIUS_RADIUS; // radius threshold
 		static const double WORKSPACE_MIN;
 		static const double WORKSPACE_MAX;
+		static const double ROI_SIGMA; // Mahalanobis distance that bounds a Gaussian region of interest
+    
+    std::vector<RegionOfInterest> regions_of_interest; // empty if the whole workspace is searched
+    boost::shared_ptr<const TSDFVolume> tsdf_volume; // only used by the TSDF curvature estimator
 };
 
 #endif
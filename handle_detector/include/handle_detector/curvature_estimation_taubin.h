@@ -32,6 +32,8 @@
 #ifndef PCL_FEATURES_CURVATURE_ESTIMATION_TAUBIN_H_
 #define PCL_FEATURES_CURVATURE_ESTIMATION_TAUBIN_H_
 
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_int.hpp>
 #include <pcl/features/feature.h>
 #include <pcl/filters/extract_indices.h>
 #include <pcl/point_types.h>
@@ -118,6 +120,7 @@ namespace pcl
 			CurvatureEstimationTaubin(unsigned int num_threads = 0)
 			{
 				num_threads_ = num_threads;
+				rng_ = NULL;
         feature_name_ = "CurvatureEstimationTaubin";
 			}
 			
@@ -331,7 +334,14 @@ namespace pcl
 					
 					for (int t = 0; t < sample_num; t++)
 					{
-						int r = rand() % indices.size();
+						int r;
+						if (rng_ == NULL)
+							r = rand() % indices.size();
+						else
+						{
+							boost::uniform_int<int> distribution(0, indices.size() - 1);
+							r = distribution(*rng_);
+						}
 						
 						if (isnan(this->input_->points[indices[r]].x))
 							continue;
@@ -425,6 +435,13 @@ namespace pcl
 			inline void 
       setNumThreads(int num_threads) { num_threads_ = num_threads; }
 			
+      /** \brief Set the random generator used to subsample the neighborhoods. The generator is not 
+        * locked, so only set it if a single thread is used.
+        * \param rng the random generator (rand() if NULL)
+        */
+			inline void 
+      setRandomGenerator(boost::mt19937 *rng) { rng_ = rng; }
+			
       /** \brief Get the indices of each point neighborhood.
         */
 			inline std::vector< std::vector<int> > const  
@@ -551,6 +568,7 @@ namespace pcl
 			
 			unsigned int num_samples_; // number of samples (neighborhoods)
 			unsigned int num_threads_; // number of threads for parallelization
+      boost::mt19937 *rng_; // random generator for subsampling neighborhoods (rand() if NULL)
       std::vector< std::vector<int> > neighborhoods_; // list of lists of point cloud indices for each neighborhood
       std::vector<int> neighborhood_centroids_; // list of point cloud indices corresponding to neighborhood centroids
       double time_taubin;
@@ -0,0 +1,147 @@
+/*
+ * Software License Agreement (BSD License)
+ *
+ *  Copyright (c) 2014, Andreas ten Pas
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef CURVATURE_ESTIMATION_TSDF_H
+#define CURVATURE_ESTIMATION_TSDF_H
+
+#include "Eigen/Dense"
+#include <boost/shared_ptr.hpp>
+#include <string>
+#include <vector>
+#include "handle_detector/cylindrical_shell.h"
+#include <pcl_utils/tsdf_converter.h>
+#include <pcl_utils/tsdf_snapshot.h>
+
+/** \brief TSDFVolume holds a truncated signed distance field as saved by kinfu, either in a 
+  * snapshot file or in memory-mapped distance and weight files. The voxels are read through a 
+  * view, with x fastest and z slowest. Distances are positive in front of the surface (free 
+  * space) and negative behind it.
+  */
+struct TSDFVolume
+{
+	tsdf_snapshot::Snapshot snapshot; // the snapshot, if the volume was read from one
+	tsdf_converter::MappedTsdfVolume files; // the distance and weight files, mapped read-only
+	tsdf_converter::TsdfVolumeView view; // the voxels
+	Eigen::Affine3d pose; // transform from the volume frame into the point cloud frame
+	float iso_value; // distance value of the surface
+	
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+/** \brief Map a TSDF volume from the raw distance and weight files written by kinfu.
+  * \param distance_file the file that contains the distances (floats)
+  * \param weight_file the file that contains the weights (shorts)
+  * \param resolution the number of voxels along each axis of the (cubic) volume
+  * \param size the edge length of the volume in meters
+  * \param volume the resultant volume (the pose is set to identity)
+  */
+bool 
+readTSDFVolume(const std::string &distance_file, const std::string &weight_file, int resolution, 
+              double size, TSDFVolume &volume);
+
+/** \brief Read a TSDF volume from a snapshot file written by kinfu.
+  * \param file the snapshot file
+  * \param volume the resultant volume (the pose is set to the transform saved with the snapshot)
+  */
+bool 
+readTSDFSnapshot(const std::string &file, TSDFVolume &volume);
+
+/** \brief CurvatureEstimationTSDF estimates the surface normal and the principal curvatures at 
+  * zero-crossing voxels of a TSDF volume from finite-difference gradients and Hessians of the 
+  * distance field. Unlike CurvatureEstimationTaubin, this requires no neighborhood search.
+  */
+class CurvatureEstimationTSDF
+{
+  public:
+  
+    /** \brief Constructor.
+      * \param volume the TSDF volume
+      */
+    CurvatureEstimationTSDF(const boost::shared_ptr<const TSDFVolume> &volume) : volume(volume) { }
+    
+    /** \brief Find the indices of all observed voxels where the distance field changes its sign 
+      * towards one of the next voxels along the x, y, or z axis.
+      */
+    std::vector<int> 
+    findZeroCrossings() const;
+    
+    /** \brief Return the center of a voxel, given by its index, in the point cloud frame.
+      * \param index the index of the voxel
+      */
+    Eigen::Vector3d 
+    voxelToPoint(int index) const;
+    
+    /** \brief Estimate the surface point, the outward surface normal, the curvature axis, and the 
+      * curvature at a given voxel. The curvature axis is the principal direction of minimum 
+      * curvature, and the curvature is the maximum principal curvature. Returns false if the 
+      * 3x3x3 neighborhood of the voxel is not fully observed or the surface is not convex.
+      * \param index the index of the voxel
+      * \param point the resultant surface point (point cloud frame)
+      * \param normal the resultant surface normal (point cloud frame)
+      * \param curvature_axis the resultant curvature axis (point cloud frame)
+      * \param curvature the resultant maximum principal curvature
+      */
+    bool 
+    computeCurvature(int index, Eigen::Vector3d &point, Eigen::Vector3d &normal, 
+                    Eigen::Vector3d &curvature_axis, double &curvature) const;
+    
+    /** \brief Check whether a given point (point cloud frame) lies in an observed voxel behind 
+      * the surface.
+      * \param point the point
+      */
+    bool 
+    isOccupied(const Eigen::Vector3d &point) const;
+    
+    /** \brief Analogous to CylindricalShell::fitRadius, increase the radius of the shell until 
+      * a ring of samples in the middle of the gap around the shell is free, using the TSDF instead 
+      * of the points in the neighborhood of the shell.
+      * \param shell the cylindrical shell
+      * \param maxHandAperture the maximum robot hand aperture
+      * \param handleGap the required size of the gap around the handle
+      */
+    bool 
+    fitRadius(CylindricalShell &shell, double maxHandAperture, double handleGap) const;
+  
+  
+  private:
+  
+    /** \brief Return the distance at a given voxel.
+      */
+    inline float 
+    distance(int x, int y, int z) const 
+    {
+      return this->volume->view.distances[this->volume->view.index(x, y, z)];
+    };
+    
+    boost::shared_ptr<const TSDFVolume> volume;
+};
+
+#endif
@@ -63,6 +63,19 @@ class CylindricalShell
     fitCylinder(const PointCloud::Ptr &cloud, const std::vector<int> &indices, 
                     const Eigen::Vector3d &normal, const Eigen::Vector3d &curvature_axis);
     
+    /** \brief Set the inner cylinder of the cylindrical shell from a point on its surface, the 
+      * outward surface normal at that point, the curvature axis, and the radius of curvature, 
+      * e.g., as given by the TSDF estimator (see curvature_estimation_tsdf.h). The shell has no 
+      * neighborhood in a point cloud (its neighborhood centroid index is -1).
+      * \param surface_point the point on the surface of the cylinder
+      * \param normal the outward surface normal at the point
+      * \param curvature_axis the curvature axis
+      * \param radius the radius of the cylinder
+    */ 
+    void 
+    setCylinder(const Eigen::Vector3d &surface_point, const Eigen::Vector3d &normal, 
+                const Eigen::Vector3d &curvature_axis, double radius);
+    
     /** \brief Check whether the gap between the inner and outer cylinder of the shell is free 
       * of obstacles and wide enough to be able to contain the robot fingers.
       * \param cloud the point cloud
@@ -102,6 +115,11 @@ class CylindricalShell
     inline double 
     getRadius() const { return this->radius; };
     
+    /** \brief Set the radius of the cylindrical shell.
+    */
+    inline void 
+    setRadius(double radius) { this->radius = radius; };
+    
     /** \brief Get the index of the centroid of the neighborhood associated with the cylindrical 
       * shell.
       */
@@ -115,6 +133,13 @@ class CylindricalShell
     inline void 
     setNeighborhoodCentroidIndex(int index) { this->neighborhood_centroid_index = index; };
     
+    /** \brief Get the number of points (or voxels) the cylinder was fitted to. The support of a 
+      * point fit is the size of its neighborhood, and that of a TSDF fit the 27 voxels of its 
+      * finite differences, so supports are only comparable between shells of the same estimator.
+    */
+    inline int 
+    getSupport() const { return this->support; };
+    
     /** \brief Get the centroid of the cylindrical shell.
       */
     inline Eigen::Vector3d 
@@ -139,6 +164,7 @@ class CylindricalShell
     double radius;
     Eigen::Vector3d normal;
     int neighborhood_centroid_index;
+    int support;
 };
 
 #endif
@@ -35,6 +35,7 @@
 #include "handle_detector/affordances.h"
 #include "handle_detector/cylindrical_shell.h"
 #include "handle_detector/sampling_visualizer.h"
+#include "handle_detector/shell_store.h"
 #include <pcl/point_cloud.h>
 #include <pcl/point_types.h>
 #include <pcl/visualization/pcl_visualizer.h>
@@ -72,7 +73,8 @@ class Sampling
         double target_radius);
 
     /**
-     * Search affordances using importance sampling.
+     * Search affordances using importance sampling. Near-duplicate affordances found in different 
+     * iterations are merged (see ShellStore).
      * \param cloud the point cloud
      * \param cloudrgb the colored point cloud
      * \param target_radius the target radius
@@ -89,6 +91,8 @@ class Sampling
     double prob_rand_samples;
     bool is_visualized;
     int method;
+    int store_capacity;
+    double store_axis_resolution;
 
     // standard parameters
     static const int NUM_ITERATIONS;
@@ -97,6 +101,8 @@ class Sampling
     static const double PROB_RAND_SAMPLES;
     static const bool VISUALIZE_STEPS;
     static const int METHOD;
+    static const int STORE_CAPACITY;
+    static const double STORE_AXIS_RESOLUTION;
 };
 
 #endif /* SAMPLING_H_ */
@@ -0,0 +1,123 @@
+/*
+ * Software License Agreement (BSD License)
+ *
+ *  Copyright (c) 2014, Andreas ten Pas
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SHELL_STORE_H_
+#define SHELL_STORE_H_
+
+#include "handle_detector/cylindrical_shell.h"
+#include <boost/cstdint.hpp>
+#include <boost/unordered_map.hpp>
+#include <set>
+#include <utility>
+#include <vector>
+
+/** \brief ShellStore collects the cylindrical shells found over several iterations of importance 
+  * sampling. Shells are keyed by a spatial hash of their centroid and their quantized curvature 
+  * axis, so that near-duplicates are merged into one entry that keeps the best-supported fit and 
+  * counts how often it was found. The number of entries is bounded by a capacity. The support of 
+  * a shell is only comparable within one estimator, so a store only takes either shells fitted to 
+  * points or shells fitted to a TSDF volume (without a neighborhood in a point cloud); keep a 
+  * store per estimator.
+  */
+class ShellStore
+{
+  public:
+  
+    /** \brief Constructor.
+      * \param cell_size the edge length of the cells in which shell centroids are hashed
+      * \param axis_resolution the angular resolution (in radians) at which axes are quantized
+      * \param capacity the maximum number of entries, which must be positive (std::invalid_argument otherwise)
+      */
+    ShellStore(double cell_size, double axis_resolution, int capacity);
+    
+    /** \brief Add a set of shells. A shell that falls into the same cell and axis bin as an 
+      * existing entry is merged with it. If the store is full, a new shell replaces the entry that 
+      * has been found the least number of times. Throws std::invalid_argument if point and TSDF 
+      * shells would be mixed in the store.
+      * \param shells the shells to be added
+      */
+    void 
+    insert(const std::vector<CylindricalShell> &shells);
+    
+    /** \brief Draw the index of an entry with probability proportional to its count; -1 if the 
+      * store is empty.
+      * \param uniform a random number in [0, 1)
+      */
+    int 
+    sample(double uniform) const;
+    
+    /** \brief Return the shells, one per entry.
+      */
+    std::vector<CylindricalShell> 
+    getShells() const;
+    
+    /** \brief Return the shell of the entry with a given index.
+      */
+    const CylindricalShell& 
+    getShell(int index) const { return this->entries[index].shell; };
+    
+    /** \brief Return the number of entries.
+      */
+    int 
+    size() const { return this->entries.size(); };
+    
+    /** \brief Return the total number of shells that were merged into the entries.
+      */
+    int 
+    getTotalCount() const { return this->total_count; };
+    
+    
+  private:
+  
+    struct Entry
+    {
+      CylindricalShell shell;
+      int count;
+      boost::uint64_t key;
+    };
+    
+    /** \brief Calculate the hash key of a shell from its centroid cell and its axis bin.
+      */
+    boost::uint64_t 
+    calculateKey(const CylindricalShell &shell) const;
+    
+    double cell_size;
+    double axis_resolution;
+    int capacity;
+    int total_count;
+    bool has_voxel_support; // whether the shells were fitted to a TSDF volume; set by the first shell
+    std::vector<Entry> entries;
+    std::vector<int> cumulative_counts; // for sampling proportional to the counts
+    boost::unordered_map<boost::uint64_t, int> index; // key -> position in entries
+    std::set<std::pair<int, int> > by_count; // (count, position) of every entry, least found first
+};
+
+#endif /* SHELL_STORE_H_ */
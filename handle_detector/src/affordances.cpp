@@ -1,12 +1,18 @@
 #include <handle_detector/affordances.h>
+#include <algorithm>
+#include <boost/lexical_cast.hpp>
+#include <boost/random/uniform_int.hpp>
+#include <pcl/io/pcd_io.h>
+#include <sstream>
 
 typedef pcl::PointCloud<pcl::PointXYZ> PointCloud;
 
 const int TAUBIN = 0;
 const int PCA = 1;
 const int NORMALS = 2;
+const int TSDF = 3;
 
-const std::string CURVATURE_ESTIMATORS[] = {"Taubin", "PCA", "Normals"};
+const std::string CURVATURE_ESTIMATORS[] = {"Taubin", "PCA", "Normals", "TSDF"};
 
 const int Affordances::CURVATURE_ESTIMATOR = 0;
 const int Affordances::NUM_SAMPLES = 5000;
@@ -26,6 +32,7 @@ const double Affordances::ALIGNMENT_ORIENT_RADIUS = 0.1;
 const double Affordances::ALIGNMENT_RADIUS_RADIUS = 0.003;
 const double Affordances::WORKSPACE_MIN = -1.0;
 const double Affordances::WORKSPACE_MAX = 1.0;
+const double Affordances::ROI_SIGMA = 2.0;
 
 //Affordances& Affordances::operator=(const Affordances& affordances)
 //{
@@ -78,8 +85,62 @@ Affordances::initParams(ros::NodeHandle node)
 	node.param("workspace_max_y", this->workspace_limits.max_y, this->WORKSPACE_MAX);
 	node.param("workspace_min_z", this->workspace_limits.min_z, this->WORKSPACE_MIN);
 	node.param("workspace_max_z", this->workspace_limits.max_z, this->WORKSPACE_MAX);
+	node.param("roi_sigma", this->roi_sigma, this->ROI_SIGMA);
 	node.param("num_threads", this->num_threads, 1);
 
+	this->printParams();
+}
+
+// read a single parameter from a map of parameter names to values (see initParams)
+template <typename T>
+static void 
+readParam(const std::map<std::string, std::string> &params, const std::string &name, T &value,
+		const T &default_value)
+{
+	std::map<std::string, std::string>::const_iterator it = params.find(name);
+	value = (it == params.end()) ? default_value : boost::lexical_cast<T>(it->second);
+}
+
+static void 
+readParam(const std::map<std::string, std::string> &params, const std::string &name, bool &value,
+		const bool &default_value)
+{
+	std::map<std::string, std::string>::const_iterator it = params.find(name);
+	value = (it == params.end()) ? default_value : (it->second == "true" || it->second == "1");
+}
+
+void 
+Affordances::initParams(const std::map<std::string, std::string> &params)
+{
+	readParam(params, "file", this->file, std::string(""));
+	readParam(params, "target_radius", this->target_radius, this->TARGET_RADIUS);
+	readParam(params, "target_radius_error", this->radius_error, this->RADIUS_ERROR);
+	readParam(params, "affordance_gap", this->handle_gap, this->HANDLE_GAP);
+	readParam(params, "sample_size", this->num_samples, this->NUM_SAMPLES);
+	readParam(params, "max_range", this->max_range, this->MAX_RANGE);
+	readParam(params, "use_clearance_filter", this->use_clearance_filter, this->USE_CLEARANCE_FILTER);
+	readParam(params, "use_occlusion_filter", this->use_occlusion_filter, this->USE_OCCLUSION_FILTER);
+	readParam(params, "curvature_estimator", this->curvature_estimator, this->CURVATURE_ESTIMATOR);
+	readParam(params, "ransac_runs", this->alignment_runs, this->ALIGNMENT_RUNS);
+	readParam(params, "ransac_min_inliers", this->alignment_min_inliers, this->ALIGNMENT_MIN_INLIERS);
+	readParam(params, "ransac_dist_radius", this->alignment_dist_radius, this->ALIGNMENT_DIST_RADIUS);
+	readParam(params, "ransac_orient_radius", this->alignment_orient_radius, this->ALIGNMENT_ORIENT_RADIUS);
+	readParam(params, "ransac_radius_radius", this->alignment_radius_radius, this->ALIGNMENT_RADIUS_RADIUS);
+	readParam(params, "workspace_min_x", this->workspace_limits.min_x, this->WORKSPACE_MIN);
+	readParam(params, "workspace_max_x", this->workspace_limits.max_x, this->WORKSPACE_MAX);
+	readParam(params, "workspace_min_y", this->workspace_limits.min_y, this->WORKSPACE_MIN);
+	readParam(params, "workspace_max_y", this->workspace_limits.max_y, this->WORKSPACE_MAX);
+	readParam(params, "workspace_min_z", this->workspace_limits.min_z, this->WORKSPACE_MIN);
+	readParam(params, "workspace_max_z", this->workspace_limits.max_z, this->WORKSPACE_MAX);
+	readParam(params, "roi_sigma", this->roi_sigma, this->ROI_SIGMA);
+	readParam(params, "num_threads", this->num_threads, 1);
+
+	this->printParams();
+}
+
+void 
+Affordances::printParams()
+{
 	// print parameters
 	printf("PARAMETERS\n");
 	printf(" file: %s\n", this->file.c_str());
@@ -102,6 +163,7 @@ Affordances::initParams(ros::NodeHandle node)
 	printf(" workspace_max_y: %.3f\n", this->workspace_limits.max_y);
 	printf(" workspace_min_z: %.3f\n", this->workspace_limits.min_z);
 	printf(" workspace_max_z: %.3f\n", this->workspace_limits.max_z);
+	printf(" roi_sigma: %.3f\n", this->roi_sigma);
 	printf(" num_threads: %i\n", this->num_threads);
 }
 
@@ -162,6 +224,110 @@ Affordances::workspaceFilter(const PointCloudRGB::Ptr &cloud_in)
 	return cloud_out;
 }
 
+void 
+Affordances::setRegionsOfInterest(const std::vector<RegionOfInterest> &regions)
+{
+	this->regions_of_interest = regions;
+	printf("Searching %i regions of interest\n", (int) regions.size());
+}
+
+std::vector<int> 
+Affordances::findRegionOfInterestIndices(const PointCloud::Ptr &cloud, double margin)
+{
+	// a Gaussian is enlarged by the margin along each of its principal axes: the semi-axis 
+	// <roi_sigma> * sqrt(lambda) becomes <roi_sigma> * sqrt(lambda) + <margin>, so the eigenvalue 
+	// becomes (<roi_sigma> * sqrt(lambda) + <margin>)^2 / <roi_sigma>^2; only invert each once
+	std::vector<Eigen::Matrix3d> precisions(this->regions_of_interest.size());
+	for (int j = 0; j < this->regions_of_interest.size(); j++)
+	{
+		if (this->regions_of_interest[j].is_gaussian)
+		{
+			Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver(this->regions_of_interest[j].covariance);
+			Eigen::Vector3d inverse_eigenvalues;
+			for (int k = 0; k < 3; k++)
+			{
+				double semi_axis = this->roi_sigma * sqrt(std::max(solver.eigenvalues()(k), 0.0)) + margin;
+				double eigenvalue = semi_axis * semi_axis / (this->roi_sigma * this->roi_sigma);
+				inverse_eigenvalues(k) = 1.0 / std::max(eigenvalue, 1e-12);
+			}
+			precisions[j] = solver.eigenvectors() * inverse_eigenvalues.asDiagonal() 
+				* solver.eigenvectors().transpose();
+		}
+	}
+
+	// points on the border of an enlarged region are inside, up to the rounding of their single 
+	// precision coordinates
+	double max_dist2 = this->roi_sigma * this->roi_sigma * (1.0 + 1e-5);
+	std::vector<int> indices;
+
+	for (int i = 0; i < cloud->points.size(); i++)
+	{
+		const pcl::PointXYZ &p = cloud->points[i];
+		if (!pcl::isFinite(p) || !this->isPointInWorkspace(p.x, p.y, p.z))
+			continue;
+
+		for (int j = 0; j < this->regions_of_interest.size(); j++)
+		{
+			const RegionOfInterest &roi = this->regions_of_interest[j];
+
+			if (roi.is_gaussian)
+			{
+				Eigen::Vector3d diff = p.getVector3fMap().cast<double>() - roi.mean;
+				if (diff.dot(precisions[j] * diff) <= max_dist2)
+				{
+					indices.push_back(i);
+					break;
+				}
+			}
+			else if (p.x >= roi.box.min_x - margin && p.x <= roi.box.max_x + margin 
+				&& p.y >= roi.box.min_y - margin && p.y <= roi.box.max_y + margin
+				&& p.z >= roi.box.min_z - margin && p.z <= roi.box.max_z + margin)
+			{
+				indices.push_back(i);
+				break;
+			}
+		}
+	}
+
+	return indices;
+}
+
+double 
+Affordances::getRegionOfInterestMargin()
+{
+	// keep the neighborhoods and the clearance regions of samples close to the border
+	return this->NEIGHBOR_RADIUS + 1.5 * (this->target_radius + this->radius_error + this->handle_gap);
+}
+
+PointCloud::Ptr 
+Affordances::regionOfInterestFilter(const PointCloud::Ptr &cloud_in)
+{
+	if (!this->hasRegionsOfInterest())
+		return this->workspaceFilter(cloud_in);
+
+	std::vector<int> indices = this->findRegionOfInterestIndices(cloud_in, this->getRegionOfInterestMargin());
+
+	PointCloud::Ptr cloud_out(new PointCloud);
+	cloud_out->points.resize(indices.size());
+	for (int i = 0; i < indices.size(); i++)
+		cloud_out->points[i] = cloud_in->points[indices[i]];
+	cloud_out->width = cloud_out->points.size();
+	cloud_out->height = 1;
+	cloud_out->header = cloud_in->header;
+
+	return cloud_out;
+}
+
+int 
+Affordances::randomIndex(int size, boost::mt19937 *rng)
+{
+	if (rng == NULL)
+		return std::rand() % size;
+
+	boost::uniform_int<int> distribution(0, size - 1);
+	return distribution(*rng);
+}
+
 int 
 Affordances::numInFront(const PointCloud::Ptr &cloud, int center_index, double radius)
 {
@@ -258,18 +424,31 @@ std::vector<CylindricalShell> Affordances::searchAffordances(const PointCloud::P
 	std::vector<CylindricalShell> shells;
 	shells.resize(0);
 
-	if (this->curvature_estimator == TAUBIN)
+	if (this->curvature_estimator == TAUBIN && this->hasRegionsOfInterest())
+	{
+		std::vector<int> indices = this->createRegionOfInterestIndices(cloud, this->num_samples);
+		if (indices.size() == 0)
+		{
+			printf("No points in regions of interest!\n");
+			return shells;
+		}
+		shells = this->searchAffordances(cloud, indices);
+	}
+	else if (this->curvature_estimator == TAUBIN)
 		shells = this->searchAffordancesTaubin(cloud);
 	else if (this->curvature_estimator == NORMALS)
 		shells = this->searchAffordancesNormalsOrPCA(cloud);
 	else if (this->curvature_estimator == PCA)
 		shells = this->searchAffordancesNormalsOrPCA(cloud);
+	else if (this->curvature_estimator == TSDF)
+		shells = this->searchAffordancesTSDF();
 
 	return shells;
 }
 
 std::vector<CylindricalShell> 
-Affordances::searchAffordancesNormalsOrPCA(const PointCloud::Ptr &cloud)
+Affordances::searchAffordancesNormalsOrPCA(const PointCloud::Ptr &cloud, bool is_logging, 
+	boost::mt19937 *rng)
 {
 	pcl::PointCloud<pcl::Normal>::Ptr cloud_normals(new pcl::PointCloud<pcl::Normal>);
 
@@ -277,14 +456,17 @@ Affordances::searchAffordancesNormalsOrPCA(const PointCloud::Ptr &cloud)
 	if (this->curvature_estimator == NORMALS)
 	{
 		double begin_time_normals_estimation = omp_get_wtime();
-		printf("Estimating surface normals ...\n");
+		if (is_logging)
+			printf("Estimating surface normals ...\n");
 		this->estimateNormals(cloud, cloud_normals);
-		printf(" elapsed time: %.3f sec\n", omp_get_wtime() - begin_time_normals_estimation);
+		if (is_logging)
+			printf(" elapsed time: %.3f sec\n", omp_get_wtime() - begin_time_normals_estimation);
 	}
 
 	// search cloud for a set of point neighborhoods
 	double begin_time_axis = omp_get_wtime();
-	printf("Estimating cylinder surface normal and curvature axis ...\n");
+	if (is_logging)
+		printf("Estimating cylinder surface normal and curvature axis ...\n");
 	pcl::PointXYZ searchPoint;
 	std::vector<int> nn_indices;
 	std::vector< std::vector<int> > neighborhoods(this->num_samples);
@@ -299,16 +481,15 @@ Affordances::searchAffordancesNormalsOrPCA(const PointCloud::Ptr &cloud)
 		pcl::search::OrganizedNeighbor<pcl::PointXYZ>::Ptr organized_neighbor
 		(new pcl::search::OrganizedNeighbor<pcl::PointXYZ>());
 		organized_neighbor->setInputCloud(cloud);
-		std::srand(std::time(0)); // use current time as seed for random generator
 
 		for (int i = 0; i < this->num_samples; i++)
 		{
 			// sample random point from the point cloud
-			int r = std::rand() % cloud->points.size();
+			int r = this->randomIndex(cloud->points.size(), rng);
 
 			while (!pcl::isFinite((*cloud)[r])
 			|| !this->isPointInWorkspace((*cloud)[r].x, (*cloud)[r].y, (*cloud)[r].z))
-				r = std::rand() % cloud->points.size();
+				r = this->randomIndex(cloud->points.size(), rng);
 
 			// estimate cylinder curvature axis and normal
 			if (organized_neighbor->radiusSearch((*cloud)[r], this->NEIGHBOR_RADIUS, nn_indices, nn_dists) > 0 )
@@ -329,16 +510,15 @@ Affordances::searchAffordancesNormalsOrPCA(const PointCloud::Ptr &cloud)
 		std::vector<float> nn_dists;
 		pcl::KdTreeFLANN<pcl::PointXYZ> tree;
 		tree.setInputCloud(cloud);
-		std::srand(std::time(0)); // use current time as seed for random generator
 
 		for (int i = 0; i < this->num_samples; i++)
 		{
 			// sample random point from the point cloud
-			int r = std::rand() % cloud->points.size();
+			int r = this->randomIndex(cloud->points.size(), rng);
 
 			while (!pcl::isFinite((*cloud)[r])
 			|| !this->isPointInWorkspace((*cloud)[r].x, (*cloud)[r].y, (*cloud)[r].z))
-				r = std::rand() % cloud->points.size();
+				r = this->randomIndex(cloud->points.size(), rng);
 
 			// estimate cylinder curvature axis and normal
 			if (tree.radiusSearch((*cloud)[r], this->NEIGHBOR_RADIUS, nn_indices, nn_dists) > 0 )
@@ -355,15 +535,16 @@ Affordances::searchAffordancesNormalsOrPCA(const PointCloud::Ptr &cloud)
 		}
 	}
 
-	printf(" elapsed time: %.3f sec\n", omp_get_wtime() - begin_time_axis);
+	if (is_logging)
+		printf(" elapsed time: %.3f sec\n", omp_get_wtime() - begin_time_axis);
 
 	// define lower and upper bounds on radius of cylinder
 	double min_radius_cylinder = this->target_radius - this->radius_error;
 	double max_radius_cylinder = this->target_radius + this->radius_error;
 
-	if (this->use_clearance_filter)
+	if (is_logging && this->use_clearance_filter)
 		printf("Filtering on curvature, fitting cylinders, and filtering on low clearance ...\n");
-	else
+	else if (is_logging)
 		printf("Filtering on curvature and fitting cylinders ...\n");
 
 	double begin_time = omp_get_wtime();
@@ -399,8 +580,9 @@ Affordances::searchAffordancesNormalsOrPCA(const PointCloud::Ptr &cloud)
 		}
 	}
 
-	printf(" elapsed time: %.3f sec\n", omp_get_wtime() - begin_time);
-	if (this->use_clearance_filter)
+	if (is_logging)
+		printf(" elapsed time: %.3f sec\n", omp_get_wtime() - begin_time);
+	if (is_logging && this->use_clearance_filter)
 		printf(" cylinders left after clearance filtering: %i\n", (int) shells.size());
 
 	return shells;
@@ -426,7 +608,6 @@ Affordances::searchAffordancesTaubin(const PointCloud::Ptr &cloud)
 
 	// provide a set of neighborhood centroids
 	std::vector<int> indices(this->num_samples);
-	std::srand(std::time(0)); // use current time as seed for random generator
 	int k;
 	for (int i = 0; i < this->num_samples; i++)
 	{
@@ -565,15 +746,104 @@ Affordances::searchAffordancesTaubin(const PointCloud::Ptr &cloud)
 	return shells;
 }
 
+std::vector<CylindricalShell> 
+Affordances::searchAffordancesTSDF()
+{
+	std::vector<CylindricalShell> shells;
+	if (!this->tsdf_volume)
+	{
+		printf("No TSDF volume set!\n");
+		return shells;
+	}
+
+	printf("Finding zero-crossings in TSDF volume ...\n");
+	double begin_time = omp_get_wtime();
+	CurvatureEstimationTSDF estimator(this->tsdf_volume);
+	std::vector<int> zero_crossings = estimator.findZeroCrossings();
+
+	// only sample zero-crossings inside the workspace
+	std::vector<int> candidates;
+	for (int i = 0; i < zero_crossings.size(); i++)
+	{
+		Eigen::Vector3d p = estimator.voxelToPoint(zero_crossings[i]);
+		if (this->isPointInWorkspace(p(0), p(1), p(2)))
+			candidates.push_back(zero_crossings[i]);
+	}
+	printf(" elapsed time: %.3f sec, zero-crossings in workspace: %i\n", omp_get_wtime() - begin_time, 
+		(int) candidates.size());
+
+	if (candidates.size() == 0)
+		return shells;
+
+	std::vector<int> samples(this->num_samples);
+	for (int i = 0; i < this->num_samples; i++)
+		samples[i] = candidates[std::rand() % candidates.size()];
+
+	if (this->use_clearance_filter)
+		printf("Estimating curvature, fitting cylinders, and filtering on low clearance ...\n");
+	else
+		printf("Estimating curvature and fitting cylinders ...\n");
+
+	begin_time = omp_get_wtime();
+
+	// define lower and upper bounds on radius of cylinder
+	double min_radius_cylinder = this->target_radius - this->radius_error;
+	double max_radius_cylinder = this->target_radius + this->radius_error;
+	double maxHandAperture = this->target_radius + this->radius_error;
+
+	std::vector<CylindricalShell> sample_shells(this->num_samples);
+	std::vector<char> is_valid(this->num_samples, 0);
+
+	#ifdef _OPENMP
+	#pragma omp parallel for num_threads(this->num_threads)
+	#endif
+	for (int i = 0; i < this->num_samples; i++)
+	{
+		Eigen::Vector3d point, normal, curvature_axis;
+		double curvature;
+		if (!estimator.computeCurvature(samples[i], point, normal, curvature_axis, curvature))
+			continue;
+
+		double radius = 1.0 / curvature;
+		if (radius <= min_radius_cylinder || radius >= max_radius_cylinder)
+			continue;
+
+		CylindricalShell &shell = sample_shells[i];
+		shell.setCylinder(point, normal, curvature_axis, radius);
+
+		// set height of shell to 2 * <target_radius>
+		shell.setExtent(2.0 * this->target_radius);
+
+		// filter on low clearance
+		if (this->use_clearance_filter && !estimator.fitRadius(shell, maxHandAperture, this->handle_gap))
+			continue;
+
+		is_valid[i] = 1;
+	}
+
+	for (int i = 0; i < this->num_samples; i++)
+	{
+		if (is_valid[i])
+			shells.push_back(sample_shells[i]);
+	}
+
+	printf(" elapsed time: %.3f sec\n", omp_get_wtime() - begin_time);
+	printf(" cylinders left: %i\n", (int) shells.size());
+
+	return shells;
+}
+
 std::vector< std::vector<CylindricalShell> > 
-Affordances::searchHandles(const PointCloud::Ptr &cloud, std::vector<CylindricalShell> shells)
+Affordances::searchHandles(const PointCloud::Ptr &cloud, std::vector<CylindricalShell> shells,
+	bool is_logging)
 {  
 	std::vector< std::vector<CylindricalShell> > handles;
 
 	// find colinear sets of cylinders
 	if (this->alignment_runs > 0)
 	{    
-		std::cout<<"alignment search for colinear sets of cylinders (handles) ... "<<std::endl;
+		if (is_logging)
+			std::cout<<"alignment search for colinear sets of cylinders (handles) ... "<<std::endl;
 		double beginTime = omp_get_wtime();
 		std::vector<int> inliersMaxSet, outliersMaxSet;
 
@@ -581,7 +851,8 @@ Affordances::searchHandles(const PointCloud::Ptr &cloud, std::vector<Cylindrical
 		for (int i=0; i < this->alignment_runs && shells.size() > 0 ; i++) // && cylinderList.size() > 0
 		{
 			this->findBestColinearSet(shells, inliersMaxSet, outliersMaxSet);
-			printf(" number of inliers in run %i: %i", i, (int) inliersMaxSet.size());
+			if (is_logging)
+				printf(" number of inliers in run %i: %i", i, (int) inliersMaxSet.size());
 
 			if (inliersMaxSet.size() >= this->alignment_min_inliers)
 			{
@@ -602,6 +873,10 @@ Affordances::searchHandles(const PointCloud::Ptr &cloud, std::vector<Cylindrical
 
 					for (int j = 0; j < handle.size(); j++)
 					{
+						// shells found in a TSDF volume have no neighborhood in the cloud
+						if (handle[j].getNeighborhoodCentroidIndex() < 0)
+							continue;
+
 						if (this->numInFront(cloud, handle[j].getNeighborhoodCentroidIndex(), 1.5 * this->target_radius + this->radius_error) > this->MAX_NUM_IN_FRONT)
 						{
 							num_occluded++;
@@ -613,7 +888,8 @@ Affordances::searchHandles(const PointCloud::Ptr &cloud, std::vector<Cylindrical
 						}
 					}
 
-					printf("  number of occluded affordances: %i; occluded: %s\n", num_occluded, is_occluded ? "true" : "false");
+					if (is_logging)
+						printf("  number of occluded affordances: %i; occluded: %s\n", num_occluded, is_occluded ? "true" : "false");
 
 					if (!is_occluded)
 						handles.push_back(handle);
@@ -628,7 +904,8 @@ Affordances::searchHandles(const PointCloud::Ptr &cloud, std::vector<Cylindrical
 				for (int j=0; j < outliersMaxSet.size(); j++)
 					remainder[j] = shells[outliersMaxSet[j]];
 				shells = remainder;
-				printf(", remaining cylinders: %i\n", (int) shells.size());
+				if (is_logging)
+					printf(", remaining cylinders: %i\n", (int) shells.size());
 			}
 			// do not check for occlusions
 			else
@@ -637,7 +914,8 @@ Affordances::searchHandles(const PointCloud::Ptr &cloud, std::vector<Cylindrical
 			}
 		}
 
-		printf(" elapsed time: %.3f\n", omp_get_wtime() - beginTime);
+		if (is_logging)
+			printf(" elapsed time: %.3f\n", omp_get_wtime() - beginTime);
 	}
 
 	return handles;
@@ -655,7 +933,7 @@ Affordances::searchAffordances(const PointCloud::Ptr &cloud, const std::vector<i
 
 std::vector<CylindricalShell> 
 Affordances::searchAffordancesTaubin(const PointCloud::Ptr &cloud, 
-		const Eigen::MatrixXd &samples, bool is_logging)
+		const Eigen::MatrixXd &samples, bool is_logging, boost::mt19937 *rng)
 {
 	if (is_logging)
 		printf("Estimating curvature ...\n");
@@ -669,6 +947,7 @@ Affordances::searchAffordancesTaubin(const PointCloud::Ptr &cloud,
 	estimator.setRadiusSearch(this->NEIGHBOR_RADIUS);
 	//~ estimator.setRadiusSearch(1.5*target_radius + radius_error);
 	estimator.setNumThreads(this->num_threads);	
+	estimator.setRandomGenerator(rng);
 
 	// compute median curvature, normal axis, curvature axis, and curvature centroid
 	estimator.computeFeature(samples, *cloud_curvature);
@@ -762,23 +1041,138 @@ Affordances::searchAffordancesTaubin(const PointCloud::Ptr &cloud,
 	return shells;
 }
 
+std::vector<BatchResult> 
+Affordances::searchAffordancesBatch(const std::vector<std::string> &files, int num_file_threads, 
+	unsigned int seed)
+{
+	std::vector<BatchResult> results(files.size());
+
+	// dynamic scheduling hands out one file at a time, so idle threads pick up the remaining files
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(dynamic, 1) num_threads(num_file_threads)
+	#endif
+	for (int i = 0; i < (int) files.size(); i++)
+	{
+		// each file is searched single-threaded on its own copy of the parameters
+		Affordances worker = *this;
+		worker.num_threads = 1;
+
+		// std::rand serializes the threads on a global lock; a generator per file does not, and its 
+		// samples do not depend on the order in which the threads draw them
+		boost::mt19937 rng(seed + i);
+
+		BatchResult &result = results[i];
+		result.file = files[i];
+		result.success = false;
+		result.num_points = 0;
+		result.load_time = result.search_time = result.handle_time = 0.0;
+
+		// the workers do not print, so that the output of concurrent files does not interleave
+		std::ostringstream log;
+
+		if (worker.curvature_estimator == TSDF)
+		{
+			log << "The TSDF curvature estimator needs a TSDF volume, not pcd file " << files[i] << "\n";
+			result.log = log.str();
+			continue;
+		}
+
+		double t0 = omp_get_wtime();
+		PointCloud::Ptr cloud(new PointCloud);
+		if (pcl::io::loadPCDFile<pcl::PointXYZ>(files[i], *cloud) == -1)
+		{
+			log << "Couldn't read pcd file " << files[i] << "\n";
+			result.log = log.str();
+			continue;
+		}
+		result.num_points = cloud->points.size();
+		result.load_time = omp_get_wtime() - t0;
+
+		// sampling a point does not terminate without a finite point in the workspace
+		if (worker.workspaceFilter(cloud)->points.size() == 0)
+		{
+			log << "No points in workspace for pcd file " << files[i] << "\n";
+			result.log = log.str();
+			continue;
+		}
+
+		// same curvature estimator dispatch as searchAffordances
+		t0 = omp_get_wtime();
+		if (worker.curvature_estimator == TAUBIN)
+		{
+			std::vector<int> indices;
+			if (worker.hasRegionsOfInterest())
+				indices = worker.createRegionOfInterestIndices(cloud, worker.num_samples, &rng);
+			else
+				indices = worker.createRandomIndices(cloud, worker.num_samples, &rng);
+
+			if (indices.size() == 0)
+			{
+				log << "No points in regions of interest for pcd file " << files[i] << "\n";
+				result.log = log.str();
+				continue;
+			}
+
+			Eigen::MatrixXd samples(3, indices.size());
+			for (int j = 0; j < indices.size(); j++)
+				samples.col(j) = cloud->points[indices[j]].getVector3fMap().cast<double>();
+			result.shells = worker.searchAffordancesTaubin(cloud, samples, false, &rng);
+		}
+		else
+			result.shells = worker.searchAffordancesNormalsOrPCA(cloud, false, &rng);
+		result.search_time = omp_get_wtime() - t0;
+
+		t0 = omp_get_wtime();
+		result.handles = worker.searchHandles(cloud, result.shells, false);
+		result.handle_time = omp_get_wtime() - t0;
+		result.success = true;
+
+		log << files[i] << ": " << CURVATURE_ESTIMATORS[worker.curvature_estimator] << " search: "
+			<< result.shells.size() << " cylinders in " << result.search_time << " sec, handle search: "
+			<< result.handles.size() << " handles in " << result.handle_time << " sec\n";
+		result.log = log.str();
+	}
+
+	for (std::size_t i = 0; i < results.size(); i++)
+		printf("%s", results[i].log.c_str());
+
+	return results;
+}
+
 std::vector<int> 
-Affordances::createRandomIndices(const PointCloud::Ptr &cloud, int size)
+Affordances::createRandomIndices(const PointCloud::Ptr &cloud, int size, boost::mt19937 *rng)
 {
 	std::vector<int> indices(size);
 
 	for (int i = 0; i < size; i++)
 	{
-		int r = std::rand() % cloud->points.size();
+		int r = this->randomIndex(cloud->points.size(), rng);
 		while (!pcl::isFinite((*cloud)[r])
 		|| !this->isPointInWorkspace(cloud->points[r].x, cloud->points[r].y, cloud->points[r].z))
-			r = std::rand() % cloud->points.size();
+			r = this->randomIndex(cloud->points.size(), rng);
 		indices[i] = r;
 	}
 
 	return indices;
 }
 
+std::vector<int> 
+Affordances::createRegionOfInterestIndices(const PointCloud::Ptr &cloud, int size, 
+	boost::mt19937 *rng)
+{
+	std::vector<int> roi_indices = this->findRegionOfInterestIndices(cloud, 0.0);
+	std::vector<int> indices;
+
+	if (roi_indices.size() == 0)
+		return indices;
+
+	indices.resize(size);
+	for (int i = 0; i < size; i++)
+		indices[i] = roi_indices[this->randomIndex(roi_indices.size(), rng)];
+
+	return indices;
+}
+
 void 
 Affordances::findBestColinearSet(const std::vector<CylindricalShell> &list, 
 		std::vector<int> &inliersMaxSet,
@@ -0,0 +1,104 @@
+#include "handle_detector/affordances.h"
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <time.h>
+#include <vector>
+#define EIGEN_DONT_PARALLELIZE
+
+// Searches a list of PCD files for handles without a ROS master.
+// usage: handle_detector_batch [--<param>=<value> ...] [--list=<file>] [--output=<csv>]
+//   [--file_threads=<n>] [--seed=<n>] file1.pcd file2.pcd ...
+// Parameters use the same names as in the ROS launch files (e.g. --target_radius=0.02).
+
+int main(int argc, char** argv)
+{
+	std::map<std::string, std::string> params;
+	std::vector<std::string> files;
+	std::string output_file = "";
+	int num_file_threads = omp_get_num_procs();
+	unsigned int seed = time(NULL);
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg.compare(0, 2, "--") != 0)
+		{
+			files.push_back(arg);
+			continue;
+		}
+
+		std::size_t pos = arg.find('=');
+		if (pos == std::string::npos)
+		{
+			printf("Argument %s has no value! Exiting ...\n", arg.c_str());
+			return EXIT_FAILURE;
+		}
+		std::string key = arg.substr(2, pos - 2);
+		std::string value = arg.substr(pos + 1);
+
+		if (key == "list")
+		{
+			// read one file name per line
+			std::ifstream list(value.c_str());
+			std::string line;
+			while (std::getline(list, line))
+				if (!line.empty())
+					files.push_back(line);
+		}
+		else if (key == "output")
+			output_file = value;
+		else if (key == "file_threads")
+			num_file_threads = atoi(value.c_str());
+		else if (key == "seed")
+			seed = strtoul(value.c_str(), NULL, 10);
+		else
+			params[key] = value;
+	}
+
+	if (files.size() == 0)
+	{
+		printf("No PCD files given! Exiting ...\n");
+		return EXIT_FAILURE;
+	}
+
+	Affordances affordances;
+	affordances.initParams(params);
+
+	printf("Searching %i files using %i threads, seed %u ...\n", (int) files.size(), num_file_threads, seed);
+	double begin_time = omp_get_wtime();
+	std::vector<BatchResult> results = affordances.searchAffordancesBatch(files, num_file_threads, seed);
+	printf("elapsed time (batch): %.3f sec\n", omp_get_wtime() - begin_time);
+
+	std::ofstream output;
+	if (output_file != "")
+	{
+		output.open(output_file.c_str());
+		output << "file,success,num_points,num_shells,num_handles,load_time,search_time,handle_time\n";
+	}
+
+	int num_failed = 0;
+	for (std::size_t i = 0; i < results.size(); i++)
+	{
+		const BatchResult &result = results[i];
+		if (!result.success)
+			num_failed++;
+
+		printf("%s: %s, points: %i, shells: %i, handles: %i, time: %.3f / %.3f / %.3f sec\n",
+			result.file.c_str(), result.success ? "ok" : "FAILED", result.num_points,
+			(int) result.shells.size(), (int) result.handles.size(), result.load_time, result.search_time,
+			result.handle_time);
+
+		if (output.is_open())
+			output << result.file << "," << result.success << "," << result.num_points << ","
+				<< result.shells.size() << "," << result.handles.size() << "," << result.load_time << ","
+				<< result.search_time << "," << result.handle_time << "\n";
+	}
+
+	printf("%i of %i files processed successfully\n", (int) results.size() - num_failed, (int) results.size());
+
+	return (num_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
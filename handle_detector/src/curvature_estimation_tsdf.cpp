@@ -0,0 +1,221 @@
+#include <handle_detector/curvature_estimation_tsdf.h>
+#include <math.h>
+#include <stdio.h>
+
+bool 
+readTSDFVolume(const std::string &distance_file, const std::string &weight_file, int resolution, 
+              double size, TSDFVolume &volume)
+{
+	tsdf_converter::VolumeGeometry geometry(Eigen::Vector3i::Constant(resolution), 
+		Eigen::Vector3f::Constant(size));
+	if (!volume.files.open(distance_file, weight_file, geometry))
+	{
+		printf("Couldn't map TSDF files %s and %s with %i^3 voxels\n", distance_file.c_str(), 
+			weight_file.c_str(), resolution);
+		return false;
+	}
+
+	volume.view = volume.files.view();
+	volume.pose = Eigen::Affine3d::Identity();
+	return true;
+}
+
+bool 
+readTSDFSnapshot(const std::string &file, TSDFVolume &volume)
+{
+	if (!volume.snapshot.read(file))
+	{
+		printf("Couldn't read TSDF snapshot %s\n", file.c_str());
+		return false;
+	}
+
+	volume.view = volume.snapshot.view();
+	volume.pose = Eigen::Affine3d(volume.snapshot.transformation_matrix());
+	return true;
+}
+
+std::vector<int> 
+CurvatureEstimationTSDF::findZeroCrossings() const
+{
+	const tsdf_converter::TsdfVolumeView &v = this->volume->view;
+	float iso_value = this->volume->iso_value;
+	int step_y = v.resolution(0);
+	int step_z = v.resolution(0) * v.resolution(1);
+	std::vector<int> indices;
+
+	for (int z = 1; z < v.resolution(2) - 1; z++)
+	{
+		for (int y = 1; y < v.resolution(1) - 1; y++)
+		{
+			for (int x = 1; x < v.resolution(0) - 1; x++)
+			{
+				int idx = x + y * step_y + z * step_z;
+				if (v.weights[idx] <= 0)
+					continue;
+
+				bool is_front = v.distances[idx] > iso_value;
+				if ((v.weights[idx + 1] > 0 && (v.distances[idx + 1] > iso_value) != is_front)
+					|| (v.weights[idx + step_y] > 0 && (v.distances[idx + step_y] > iso_value) != is_front)
+					|| (v.weights[idx + step_z] > 0 && (v.distances[idx + step_z] > iso_value) != is_front))
+				{
+					indices.push_back(idx);
+				}
+			}
+		}
+	}
+
+	return indices;
+}
+
+Eigen::Vector3d 
+CurvatureEstimationTSDF::voxelToPoint(int index) const
+{
+	const tsdf_converter::TsdfVolumeView &v = this->volume->view;
+	int x = index % v.resolution(0);
+	int y = (index / v.resolution(0)) % v.resolution(1);
+	int z = index / (v.resolution(0) * v.resolution(1));
+	return this->volume->pose * Eigen::Vector3d(x, y, z).cwiseProduct(v.voxel_size().cast<double>());
+}
+
+bool 
+CurvatureEstimationTSDF::computeCurvature(int index, Eigen::Vector3d &point, Eigen::Vector3d &normal, 
+                                          Eigen::Vector3d &curvature_axis, double &curvature) const
+{
+	const tsdf_converter::TsdfVolumeView &v = this->volume->view;
+	int x = index % v.resolution(0);
+	int y = (index / v.resolution(0)) % v.resolution(1);
+	int z = index / (v.resolution(0) * v.resolution(1));
+
+	if (x < 1 || y < 1 || z < 1 || x >= v.resolution(0) - 1 || y >= v.resolution(1) - 1 
+		|| z >= v.resolution(2) - 1)
+		return false;
+
+	// the finite differences need a fully observed 3x3x3 neighborhood
+	float d[3][3][3];
+	for (int i = -1; i <= 1; i++)
+	{
+		for (int j = -1; j <= 1; j++)
+		{
+			for (int k = -1; k <= 1; k++)
+			{
+				int idx = (x + i) + (y + j) * v.resolution(0) + (z + k) * v.resolution(0) * v.resolution(1);
+				if (v.weights[idx] <= 0)
+					return false;
+				d[i + 1][j + 1][k + 1] = v.distances[idx];
+			}
+		}
+	}
+
+	// central differences for the gradient and the Hessian (in meters)
+	Eigen::Vector3d h = v.voxel_size().cast<double>();
+	Eigen::Vector3d gradient;
+	gradient << d[2][1][1] - d[0][1][1], d[1][2][1] - d[1][0][1], d[1][1][2] - d[1][1][0];
+	gradient = gradient.cwiseQuotient(2.0 * h);
+
+	Eigen::Matrix3d hessian;
+	hessian(0,0) = d[2][1][1] - 2.0 * d[1][1][1] + d[0][1][1];
+	hessian(1,1) = d[1][2][1] - 2.0 * d[1][1][1] + d[1][0][1];
+	hessian(2,2) = d[1][1][2] - 2.0 * d[1][1][1] + d[1][1][0];
+	hessian(0,1) = hessian(1,0) = 0.25 * (d[2][2][1] - d[2][0][1] - d[0][2][1] + d[0][0][1]);
+	hessian(0,2) = hessian(2,0) = 0.25 * (d[2][1][2] - d[2][1][0] - d[0][1][2] + d[0][1][0]);
+	hessian(1,2) = hessian(2,1) = 0.25 * (d[1][2][2] - d[1][2][0] - d[1][0][2] + d[1][0][0]);
+	hessian = hessian.cwiseQuotient(h * h.transpose());
+
+	double gradient_norm = gradient.norm();
+	if (gradient_norm < 1e-6)
+		return false;
+
+	// the shape operator of the level set is the Hessian projected onto the tangent plane and 
+	// scaled by the gradient magnitude; its eigenvalues are the principal curvatures
+	Eigen::Vector3d n = gradient / gradient_norm;
+	Eigen::Matrix3d P = Eigen::Matrix3d::Identity() - n * n.transpose();
+	Eigen::Matrix3d shape = P * hessian * P / gradient_norm;
+	Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver(shape);
+
+	// discard the eigenvector along the normal
+	int normal_idx;
+	(solver.eigenvectors().transpose() * n).cwiseAbs().maxCoeff(&normal_idx);
+	int a = (normal_idx + 1) % 3;
+	int b = (normal_idx + 2) % 3;
+	int max_idx = (fabs(solver.eigenvalues()(a)) > fabs(solver.eigenvalues()(b))) ? a : b;
+	int min_idx = (max_idx == a) ? b : a;
+
+	// a handle is convex, i.e., the surface bends away from the outward normal
+	curvature = solver.eigenvalues()(max_idx);
+	if (curvature <= 0)
+		return false;
+
+	// move the voxel center onto the surface along the normal, and correct the radius of the 
+	// level set through the voxel center by the same offset
+	double offset = (d[1][1][1] - this->volume->iso_value) / gradient_norm;
+	if (1.0 / curvature - offset <= 0)
+		return false;
+	curvature = 1.0 / (1.0 / curvature - offset);
+	Eigen::Vector3d surface_point = Eigen::Vector3d(x, y, z).cwiseProduct(h) - offset * n;
+
+	const Eigen::Affine3d &pose = this->volume->pose;
+	point = pose * surface_point;
+	normal = pose.linear() * n;
+	curvature_axis = pose.linear() * solver.eigenvectors().col(min_idx);
+	return true;
+}
+
+bool 
+CurvatureEstimationTSDF::isOccupied(const Eigen::Vector3d &point) const
+{
+	const tsdf_converter::TsdfVolumeView &v = this->volume->view;
+	Eigen::Vector3d voxel = (this->volume->pose.inverse() * point).cwiseQuotient(v.voxel_size().cast<double>());
+	int x = (int) floor(voxel(0) + 0.5);
+	int y = (int) floor(voxel(1) + 0.5);
+	int z = (int) floor(voxel(2) + 0.5);
+
+	if (x < 0 || y < 0 || z < 0 || x >= v.resolution(0) || y >= v.resolution(1) || z >= v.resolution(2))
+		return false;
+
+	int idx = x + y * v.resolution(0) + z * v.resolution(0) * v.resolution(1);
+	return v.weights[idx] > 0 && v.distances[idx] < this->volume->iso_value;
+}
+
+bool 
+CurvatureEstimationTSDF::fitRadius(CylindricalShell &shell, double maxHandAperture, 
+                                   double handleGap) const
+{
+	const int NUM_ANGLES = 16;
+	const int NUM_HEIGHTS = 3;
+
+	Eigen::Vector3d axis = shell.getCurvatureAxis();
+	Eigen::Vector3d u = shell.getNormal();
+	Eigen::Vector3d w = axis.cross(u);
+	Eigen::Vector3d centroid = shell.getCentroid();
+
+	double step = this->volume->view.voxel_size().minCoeff();
+	for (double r = shell.getRadius(); r <= maxHandAperture; r += step)
+	{
+		double ring_radius = r + 0.5 * handleGap;
+		bool is_free = true;
+
+		for (int i = 0; i < NUM_HEIGHTS && is_free; i++)
+		{
+			double height = (i - (NUM_HEIGHTS - 1) / 2.0) * shell.getExtent() / NUM_HEIGHTS;
+			for (int j = 0; j < NUM_ANGLES; j++)
+			{
+				double angle = 2.0 * M_PI * j / NUM_ANGLES;
+				Eigen::Vector3d sample = centroid + height * axis 
+					+ ring_radius * (cos(angle) * u + sin(angle) * w);
+				if (this->isOccupied(sample))
+				{
+					is_free = false;
+					break;
+				}
+			}
+		}
+
+		if (is_free)
+		{
+			shell.setRadius(r);
+			return true;
+		}
+	}
+
+	return false;
+}
@@ -45,6 +45,19 @@ CylindricalShell::fitCylinder(const PointCloud::Ptr &cloud, const std::vector<in
 	this->extent = y.maxCoeff() - y.minCoeff();
   this->curvature_axis = curvature_axis;
   this->normal = normal;
+  this->support = n;
+}
+
+void 
+CylindricalShell::setCylinder(const Eigen::Vector3d &surface_point, const Eigen::Vector3d &normal, 
+                              const Eigen::Vector3d &curvature_axis, double radius)
+{
+	this->centroid = surface_point - radius * normal;
+	this->radius = radius;
+	this->curvature_axis = curvature_axis;
+	this->normal = normal;
+	this->neighborhood_centroid_index = -1;
+	this->support = 27; // voxels used by the finite differences
 }
 
 //bool
@@ -8,6 +8,7 @@
 #include "Eigen/Core"
 #include <iostream>
 #include "handle_detector/messages.h"
+#include <pcl_utils/OccludedRegionArray.h>
 
 
 #include <pcl_conversions/pcl_conversions.h>
@@ -21,6 +22,9 @@
 #include <ros/ros.h>
 #include <sensor_msgs/PointCloud2.h>
 #include <tf/transform_listener.h>
+#include <tf/message_filter.h>
+#include <message_filters/subscriber.h>
+#include <pcl_utils/transform_cache.h>
 #include <tf/transform_datatypes.h>
 #include <tf_conversions/tf_eigen.h>
 
@@ -52,21 +56,28 @@ std::vector< std::vector<CylindricalShell> > g_handles;
 // synchronization
 double g_prev_time;
 double g_update_interval;
+ros::Duration g_tf_timeout; // how long a lookup waits for the transform at a message stamp
 bool g_has_read = false;
+int g_num_dropped = 0;
 
 void chatterCallback(const sensor_msgs::PointCloud2ConstPtr& input) {
 	if (omp_get_wtime() - g_prev_time < g_update_interval) { return; }
 
+	// the message filter only passes clouds whose transforms are available at their stamp
+	printf("cloud latency: %.3f sec\n", (ros::Time::now() - input->header.stamp).toSec());
+
 	tf::StampedTransform camera_transform;
-	listener->waitForTransform("base_link", "camera_rgb_optical_frame", ros::Time(0), ros::Duration(5));
-	listener->lookupTransform("base_link", "camera_rgb_optical_frame", ros::Time(0), camera_transform);
-	Eigen::Affine3d camera_affine;
-	tf::transformTFToEigen(camera_transform, camera_affine);
-	tf::Pose camera_pose;
-	tf::poseEigenToTF(camera_affine, camera_pose);
-	g_camera_pose.header.frame_id = "base_link";
-	g_camera_pose.header.stamp = ros::Time::now();
-	tf::poseTFToMsg(camera_pose, g_camera_pose.pose);
+	if (transform_cache::lookup_transform("base_link", "camera_rgb_optical_frame", input->header.stamp, &camera_transform, 
+		g_tf_timeout))
+	{
+		Eigen::Affine3d camera_affine;
+		tf::transformTFToEigen(camera_transform, camera_affine);
+		tf::Pose camera_pose;
+		tf::poseEigenToTF(camera_affine, camera_pose);
+		g_camera_pose.header.frame_id = "base_link";
+		g_camera_pose.header.stamp = input->header.stamp;
+		tf::poseTFToMsg(camera_pose, g_camera_pose.pose);
+	}
 
 	// convert ROS sensor message to PCL point cloud
 	PointCloud::Ptr cloud(new PointCloud);
@@ -79,10 +90,9 @@ void chatterCallback(const sensor_msgs::PointCloud2ConstPtr& input) {
 		std::cout << "Transforming from " << input_frame << " to " << OUTPUT_FRAME << "\n";
 		PointCloud::Ptr transformed_cloud(new PointCloud);
 		tf::StampedTransform tf_transform;
-		listener->waitForTransform(OUTPUT_FRAME, input_frame,
-				ros::Time(0), ros::Duration(5));
-		listener->lookupTransform(OUTPUT_FRAME, input_frame,
-				ros::Time(0), tf_transform);
+		if (!transform_cache::lookup_transform(OUTPUT_FRAME, input_frame, input->header.stamp, &tf_transform, 
+			g_tf_timeout))
+			return;
 
 		Eigen::Affine3d transform;
 		tf::transformTFToEigen(tf_transform, transform);
@@ -93,6 +103,13 @@ void chatterCallback(const sensor_msgs::PointCloud2ConstPtr& input) {
 		std::cout << "Input and output frame are: " << input_frame << "\n";
 	}
 
+	// only keep the points around the occluded regions
+	if (g_affordances.hasRegionsOfInterest())
+	{
+		cloud = g_affordances.regionOfInterestFilter(cloud);
+		std::cout << "Points around regions of interest: " << cloud->points.size() << "\n";
+	}
+
 	g_cloud = cloud;
 
 	// search grasp affordances
@@ -113,6 +130,46 @@ void chatterCallback(const sensor_msgs::PointCloud2ConstPtr& input) {
 	g_has_read = true;
 }
 
+void dropCallback(const sensor_msgs::PointCloud2ConstPtr& input, tf::FilterFailureReason reason) {
+	g_num_dropped++;
+	printf("Dropped cloud without transform (%i so far)\n", g_num_dropped);
+	transform_cache::print_statistics();
+}
+
+void regionsCallback(const pcl_utils::OccludedRegionArrayConstPtr& regions_msg) {
+	// transform the Gaussians of the occluded regions into the output frame, as it was when they were found
+	tf::StampedTransform tf_transform;
+	if (!transform_cache::lookup_transform(OUTPUT_FRAME, regions_msg->header.frame_id, regions_msg->header.stamp, 
+		&tf_transform, g_tf_timeout))
+	{
+		ROS_WARN("Ignoring occluded regions: no transform from %s to %s", regions_msg->header.frame_id.c_str(), 
+			OUTPUT_FRAME.c_str());
+		return;
+	}
+
+	Eigen::Affine3d transform;
+	tf::transformTFToEigen(tf_transform, transform);
+
+	std::vector<RegionOfInterest> regions;
+	for (int i = 0; i < regions_msg->regions.size(); i++)
+	{
+		const pcl_utils::Gaussian &gaussian = regions_msg->regions[i].gaussian;
+		if (gaussian.covariance.size() != 9)
+			continue;
+
+		RegionOfInterest roi;
+		roi.is_gaussian = true;
+		roi.mean = transform * Eigen::Vector3d(gaussian.mean.x, gaussian.mean.y, gaussian.mean.z);
+		Eigen::Matrix3d covariance;
+		for (int j = 0; j < 9; j++)
+			covariance(j / 3, j % 3) = gaussian.covariance[j];
+		roi.covariance = transform.linear() * covariance * transform.linear().transpose();
+		regions.push_back(roi);
+	}
+
+	g_affordances.setRegionsOfInterest(regions);
+}
+
 int main(int argc, char** argv) {
 	// initialize random seed
 	srand (time(NULL));
@@ -121,16 +178,20 @@ int main(int argc, char** argv) {
 	ros::init(argc, argv, "handle_detector");
 	ros::NodeHandle node("~");
 
-	listener.reset(new tf::TransformListener(ros::Duration(20.0)));
+	listener = transform_cache::get_listener();
 
 	// set point cloud update interval from launch file
 	node.param("update_interval", g_update_interval, 10.0);
 
+	// wait this long for a transform at the stamp of a message
+	double tf_timeout;
+	node.param("tf_timeout", tf_timeout, 0.5);
+	g_tf_timeout = ros::Duration(tf_timeout);
+
 	// read parameters
 	g_affordances.initParams(node);
 
 	std::string output_frame;
-	ros::Subscriber sub;
 
 	node.param("output_frame", OUTPUT_FRAME, std::string("/base_link"));
 	node.param("camera_topic", RANGE_SENSOR_TOPIC, std::string("/camera/depth_registered/points"));
@@ -138,7 +199,28 @@ int main(int argc, char** argv) {
 	// point cloud read from sensor
 	printf("Reading point cloud data from sensor topic: %s\n", RANGE_SENSOR_TOPIC.c_str());
 	output_frame = OUTPUT_FRAME;
-	sub = node.subscribe(RANGE_SENSOR_TOPIC, 10, chatterCallback);
+
+	// queue clouds until their transforms into the output frame and base_link are available
+	message_filters::Subscriber<sensor_msgs::PointCloud2> sub(node, RANGE_SENSOR_TOPIC, 10);
+	tf::MessageFilter<sensor_msgs::PointCloud2> cloud_filter(sub, *listener, OUTPUT_FRAME, 10);
+	std::vector<std::string> target_frames;
+	target_frames.push_back(OUTPUT_FRAME);
+	target_frames.push_back("base_link");
+	cloud_filter.setTargetFrames(target_frames);
+	cloud_filter.registerCallback(boost::bind(&chatterCallback, _1));
+	cloud_filter.registerFailureCallback(boost::bind(&dropCallback, _1, _2));
+
+	// restrict the search to the occluded regions found in the TSDF volume
+	bool use_occluded_regions;
+	std::string regions_topic;
+	ros::Subscriber regions_sub;
+	node.param("use_occluded_regions", use_occluded_regions, false);
+	node.param("regions_topic", regions_topic, std::string("/occluded_regions"));
+	if (use_occluded_regions)
+	{
+		printf("Reading regions of interest from topic: %s\n", regions_topic.c_str());
+		regions_sub = node.subscribe(regions_topic, 1, regionsCallback);
+	}
 
 	// visualization of point cloud, grasp affordances, and handles
 	Visualizer visualizer(1.0/g_update_interval);
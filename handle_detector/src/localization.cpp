@@ -101,6 +101,7 @@ int main(int argc, char** argv)
     // constants
 	const int PCD_FILE = 0;
 	const int SENSOR = 1;
+	const int TSDF_FILES = 2;
   	
 	// initialize random seed
   srand (time(NULL));
@@ -156,6 +157,62 @@ int main(int argc, char** argv)
 		double elapsed_time = end_time - start_time;
 		printf("Affordance and handle search done in %.3f sec.\n", elapsed_time);
 	}
+	// TSDF volume read from the snapshot, or the distance and weight files, saved by kinfu
+	else if (point_cloud_source == TSDF_FILES)
+	{
+		range_sensor_frame = "/map";
+		std::string snapshot_file, distance_file, weight_file, transform_file;
+		int resolution;
+		double size, iso_value;
+		node.param("tsdf_snapshot_file", snapshot_file, std::string("kinfu_tsdf0.tsdf"));
+		node.param("tsdf_distance_file", distance_file, std::string("kinfu_dist.dat"));
+		node.param("tsdf_weight_file", weight_file, std::string("kinfu_weights.dat"));
+		node.param("tsdf_transform_file", transform_file, std::string(""));
+		node.param("tsdf_resolution", resolution, 512);
+		node.param("tsdf_size", size, 2.0);
+		node.param("tsdf_iso_value", iso_value, 0.0);
+
+		boost::shared_ptr<TSDFVolume> volume(new TSDFVolume);
+		if (snapshot_file != "")
+		{
+			// the snapshot holds the geometry of the volume and its transform
+			if (!readTSDFSnapshot(snapshot_file, *volume))
+				return (-1);
+			printf("Loaded TSDF snapshot: %s\n", snapshot_file.c_str());
+		}
+		else
+		{
+			if (!readTSDFVolume(distance_file, weight_file, resolution, size, *volume))
+				return (-1);
+			printf("Loaded TSDF volume: %s, %s\n", distance_file.c_str(), weight_file.c_str());
+		}
+		volume->iso_value = iso_value;
+
+		// transform from the kinfu volume into the camera frame (16 values, row by row)
+		if (transform_file != "")
+		{
+			std::ifstream transform_stream(transform_file.c_str());
+			for (int i = 0; i < 16; i++)
+				transform_stream >> volume->pose.matrix()(i / 4, i % 4);
+		}
+
+		g_affordances.setTSDFVolume(volume);
+
+		// the zero-crossings serve as the point cloud for visualization
+		CurvatureEstimationTSDF estimator(volume);
+		std::vector<int> zero_crossings = estimator.findZeroCrossings();
+		for (int i = 0; i < zero_crossings.size(); i++)
+		{
+			Eigen::Vector3d p = estimator.voxelToPoint(zero_crossings[i]);
+			g_cloud->points.push_back(pcl::PointXYZ(p(0), p(1), p(2)));
+		}
+
+		double start_time = omp_get_wtime();
+		g_cylindrical_shells = g_affordances.searchAffordances(g_cloud);
+		g_handles = g_affordances.searchHandles(g_cloud, g_cylindrical_shells);
+		g_has_read = true;
+		printf("Affordance and handle search done in %.3f sec.\n", omp_get_wtime() - start_time);
+	}
 	// point cloud read from sensor
 	else if (point_cloud_source == SENSOR)
 	{		
@@ -10,6 +10,8 @@ const int Sampling::NUM_INIT_SAMPLES = 100;
 const double Sampling::PROB_RAND_SAMPLES = 0.2;
 const bool Sampling::VISUALIZE_STEPS = false;
 const int Sampling::METHOD = SUM;
+const int Sampling::STORE_CAPACITY = 2000;
+const double Sampling::STORE_AXIS_RESOLUTION = 0.2;
 
 void
 Sampling::illustrate(const PointCloud::Ptr &cloud, const PointCloudRGB::Ptr &cloudrgb,
@@ -108,7 +110,8 @@ Sampling::searchAffordances(const PointCloud::Ptr &cloud, const PointCloudRGB::P
 
   // find initial affordances
   std::vector<int> indices = this->affordances.createRandomIndices(cloud, num_init_samples);
-  std::vector<CylindricalShell> all_shells = this->affordances.searchAffordances(cloud, indices);
+  ShellStore store(target_radius, this->store_axis_resolution, this->store_capacity);
+  store.insert(this->affordances.searchAffordances(cloud, indices));
 
 //  // visualize
 //  if (this->is_visualized)
@@ -147,7 +150,9 @@ Sampling::searchAffordances(const PointCloud::Ptr &cloud, const PointCloudRGB::P
   boost::mt19937 *rng = new boost::mt19937();
   rng->seed(time(NULL));
   boost::normal_distribution<> distribution(0.0, 1.0);
-  boost::variate_generator< boost::mt19937, boost::normal_distribution<> > generator(*rng, distribution);
+  // both draw from the same engine, so the Gaussian offsets and the choice of shells are independent streams
+  boost::variate_generator< boost::mt19937&, boost::normal_distribution<> > generator(*rng, distribution);
+  boost::uniform_01<boost::mt19937&> uniform(*rng);
   Eigen::MatrixXd samples(3, num_samples);
 
   // find affordances using importance sampling
@@ -155,39 +160,44 @@ Sampling::searchAffordances(const PointCloud::Ptr &cloud, const PointCloudRGB::P
   {
     double iteration_start_time = omp_get_wtime();
 
-    // draw samples close to affordances (importance sampling)
+    // without any affordances, all samples are drawn at random
+    int num_gauss_samples_iteration = (store.size() > 0) ? num_gauss_samples : 0;
+
+    // draw samples close to affordances (importance sampling); each stored shell is weighted by 
+    // the number of times it was found
     if (this->method == SUM) // sum of Gaussians
     {
-      for (int j=0; j < num_gauss_samples; j++)
+      for (int j=0; j < num_gauss_samples_iteration; j++)
       {
-        int idx = rand() % all_shells.size();
-        samples(0,j) = all_shells[idx].getCentroid()(0) + generator() * sigma;
-        samples(1,j) = all_shells[idx].getCentroid()(1) + generator() * sigma;
-        samples(2,j) = all_shells[idx].getCentroid()(2) + generator() * sigma;
+        int idx = store.sample(uniform());
+        samples(0,j) = store.getShell(idx).getCentroid()(0) + generator() * sigma;
+        samples(1,j) = store.getShell(idx).getCentroid()(1) + generator() * sigma;
+        samples(2,j) = store.getShell(idx).getCentroid()(2) + generator() * sigma;
       }
     }
     else // max of Gaussians
     {
       int j = 0;
-      while (j < num_gauss_samples) // draw samples using rejection sampling
+      while (j < num_gauss_samples_iteration) // draw samples using rejection sampling
       {
         // draw from sum of Gaussians
-        int idx = rand() % all_shells.size();
+        int idx = store.sample(uniform());
+        Eigen::Vector3d centroid = store.getShell(idx).getCentroid();
         Eigen::Vector3d x;
-        x(0) = all_shells[idx].getCentroid()(0) + generator() * sigma;
-        x(1) = all_shells[idx].getCentroid()(1) + generator() * sigma;
-        x(2) = all_shells[idx].getCentroid()(2) + generator() * sigma;
+        x(0) = centroid(0) + generator() * sigma;
+        x(1) = centroid(1) + generator() * sigma;
+        x(2) = centroid(2) + generator() * sigma;
 
         double maxp = 0;
-        for (int k=0; k < all_shells.size(); k++)
+        for (int k=0; k < store.size(); k++)
         {
-          double p = (x - all_shells[k].getCentroid()).transpose() * (x - all_shells[k].getCentroid());
+          double p = (x - store.getShell(k).getCentroid()).transpose() * (x - store.getShell(k).getCentroid());
           p = term * exp((-1.0/(2.0*sigma)) * p);
           if (p > maxp)
             maxp = p;
         }
 
-        double p = (x - all_shells[idx].getCentroid()).transpose() * (x - all_shells[idx].getCentroid());
+        double p = (x - centroid).transpose() * (x - centroid);
         p = term * exp((-1.0/(2.0*sigma)) * p);
         if (p >= maxp)
         {
@@ -198,7 +208,7 @@ Sampling::searchAffordances(const PointCloud::Ptr &cloud, const PointCloudRGB::P
     }
 
     // draw random samples
-    for (int j = num_samples - num_rand_samples; j < num_samples; j++)
+    for (int j = num_gauss_samples_iteration; j < num_samples; j++)
     {
       int r = std::rand() % cloud->points.size();
       while (!pcl::isFinite((*cloud)[r])
@@ -228,14 +238,13 @@ Sampling::searchAffordances(const PointCloud::Ptr &cloud, const PointCloudRGB::P
 //    }
 
     // find affordances
-    std::vector<CylindricalShell> shells = this->affordances.searchAffordancesTaubin(cloud, samples);
-    all_shells.insert(all_shells.end(), shells.begin(), shells.end());
+    store.insert(this->affordances.searchAffordancesTaubin(cloud, samples));
     printf("ELAPSED TIME (ITERATION %i): %.3f\n", i, omp_get_wtime() - iteration_start_time);
   }
 
-  printf("elapsed time (affordance search): %.3f sec, total # of affordances found: %i\n",
-    omp_get_wtime() - start_time, (int) all_shells.size());
-  return all_shells;
+  printf("elapsed time (affordance search): %.3f sec, total # of affordances found: %i, stored: %i\n",
+    omp_get_wtime() - start_time, store.getTotalCount(), store.size());
+  return store.getShells();
 }
 
 void Sampling::initParams(const ros::NodeHandle& node)
@@ -246,4 +255,6 @@ void Sampling::initParams(const ros::NodeHandle& node)
   node.param("prob_rand_samples", this->prob_rand_samples, this->PROB_RAND_SAMPLES);
   node.param("visualize_steps", this->is_visualized, this->VISUALIZE_STEPS);
   node.param("sampling_method", this->method, this->METHOD);
+  node.param("store_capacity", this->store_capacity, this->STORE_CAPACITY);
+  node.param("store_axis_resolution", this->store_axis_resolution, this->STORE_AXIS_RESOLUTION);
 }
@@ -0,0 +1,117 @@
+#include "handle_detector/shell_store.h"
+#include <algorithm>
+#include <stdexcept>
+#include <math.h>
+
+ShellStore::ShellStore(double cell_size, double axis_resolution, int capacity) 
+  : cell_size(cell_size), axis_resolution(axis_resolution), capacity(capacity), total_count(0), 
+    has_voxel_support(false)
+{
+  if (capacity <= 0)
+    throw std::invalid_argument("ShellStore: the capacity must be positive");
+  this->entries.reserve(capacity);
+}
+
+boost::uint64_t 
+ShellStore::calculateKey(const CylindricalShell &shell) const
+{
+  // 16 bits per centroid cell coordinate, offset so that negative coordinates stay positive
+  Eigen::Vector3d centroid = shell.getCentroid() / this->cell_size;
+  boost::uint64_t key = 0;
+  for (int i = 0; i < 3; i++)
+    key = (key << 16) | (boost::uint64_t) (((long) floor(centroid(i)) + 32768) & 0xFFFF);
+  
+  // an axis and its negation are the same axis: flip it so that its largest component is positive
+  Eigen::Vector3d axis = shell.getCurvatureAxis().normalized();
+  int max_idx;
+  axis.cwiseAbs().maxCoeff(&max_idx);
+  if (axis(max_idx) < 0)
+    axis = -axis;
+  
+  // 8 bits each for the inclination and the azimuth of the axis
+  double theta = acos(std::max(-1.0, std::min(1.0, axis(2))));
+  double phi = atan2(axis(1), axis(0)) + M_PI;
+  key = (key << 8) | (boost::uint64_t) ((int) (theta / this->axis_resolution) & 0xFF);
+  key = (key << 8) | (boost::uint64_t) ((int) (phi / this->axis_resolution) & 0xFF);
+  
+  return key;
+}
+
+void 
+ShellStore::insert(const std::vector<CylindricalShell> &shells)
+{
+  for (int i = 0; i < shells.size(); i++)
+  {
+    // shells fitted to a TSDF volume have no neighborhood in a point cloud
+    bool has_voxel_support = shells[i].getNeighborhoodCentroidIndex() < 0;
+    if (this->total_count == 0)
+      this->has_voxel_support = has_voxel_support;
+    else if (has_voxel_support != this->has_voxel_support)
+      throw std::invalid_argument("ShellStore: point and TSDF shells have incomparable support, use a store per estimator");
+    
+    boost::uint64_t key = this->calculateKey(shells[i]);
+    this->total_count++;
+    
+    // merge with an existing entry and keep the better supported fit
+    boost::unordered_map<boost::uint64_t, int>::iterator it = this->index.find(key);
+    if (it != this->index.end())
+    {
+      Entry &entry = this->entries[it->second];
+      this->by_count.erase(std::make_pair(entry.count, it->second));
+      entry.count++;
+      this->by_count.insert(std::make_pair(entry.count, it->second));
+      if (shells[i].getSupport() > entry.shell.getSupport())
+        entry.shell = shells[i];
+      continue;
+    }
+    
+    Entry entry;
+    entry.shell = shells[i];
+    entry.count = 1;
+    entry.key = key;
+    
+    if (this->entries.size() < this->capacity)
+    {
+      this->index[key] = this->entries.size();
+      this->by_count.insert(std::make_pair(entry.count, (int) this->entries.size()));
+      this->entries.push_back(entry);
+      continue;
+    }
+    
+    // replace the entry that has been found the least number of times (the first one of those)
+    int min_idx = this->by_count.begin()->second;
+    this->by_count.erase(this->by_count.begin());
+    this->index.erase(this->entries[min_idx].key);
+    this->index[key] = min_idx;
+    this->entries[min_idx] = entry;
+    this->by_count.insert(std::make_pair(entry.count, min_idx));
+  }
+  
+  this->cumulative_counts.resize(this->entries.size());
+  int sum = 0;
+  for (int i = 0; i < this->entries.size(); i++)
+  {
+    sum += this->entries[i].count;
+    this->cumulative_counts[i] = sum;
+  }
+}
+
+int 
+ShellStore::sample(double uniform) const
+{
+  if (this->cumulative_counts.empty())
+    return -1;
+  
+  int target = (int) (uniform * this->cumulative_counts.back());
+  return std::upper_bound(this->cumulative_counts.begin(), this->cumulative_counts.end(), target) 
+    - this->cumulative_counts.begin();
+}
+
+std::vector<CylindricalShell> 
+ShellStore::getShells() const
+{
+  std::vector<CylindricalShell> shells(this->entries.size());
+  for (int i = 0; i < this->entries.size(); i++)
+    shells[i] = this->entries[i].shell;
+  return shells;
+}
@@ -0,0 +1,73 @@
+#include <map>
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "handle_detector/affordances.h"
+
+namespace {
+
+class RegionOfInterestTests : public ::testing::Test {
+protected:
+  virtual void SetUp() {
+    std::map<std::string, std::string> params;
+    params["target_radius"] = "0.02";
+    params["target_radius_error"] = "0.01";
+    params["affordance_gap"] = "0.01";
+    params["roi_sigma"] = "2.0";
+    affordances.initParams(params);
+    margin = affordances.getRegionOfInterestMargin();
+
+    // a rotated Gaussian whose semi-axes are close to the margin, where adding the margin to the 
+    // covariance falls furthest short of it
+    rotation = Eigen::AngleAxisd(0.7, Eigen::Vector3d(1, 2, 3).normalized()).toRotationMatrix();
+    eigenvalues << 0.0016, 0.0004, 0.0001;
+
+    RegionOfInterest roi;
+    roi.is_gaussian = true;
+    roi.mean << 0.1, -0.2, 0.3;
+    roi.covariance = rotation * eigenvalues.asDiagonal() * rotation.transpose();
+    affordances.setRegionsOfInterest(std::vector<RegionOfInterest>(1, roi));
+    mean = roi.mean;
+  }
+
+  // the number of points kept of a single point at <scale> times the enlarged semi-axis <axis>
+  int numKept(int axis, double scale) {
+    double semi_axis = 2.0 * sqrt(eigenvalues(axis)) + margin;
+    Eigen::Vector3d p = mean + scale * semi_axis * rotation.col(axis);
+
+    PointCloud::Ptr cloud(new PointCloud);
+    cloud->points.push_back(pcl::PointXYZ(p(0), p(1), p(2)));
+    cloud->width = 1;
+    cloud->height = 1;
+    return affordances.regionOfInterestFilter(cloud)->points.size();
+  }
+
+  Affordances affordances;
+  double margin;
+  Eigen::Matrix3d rotation;
+  Eigen::Vector3d eigenvalues;
+  Eigen::Vector3d mean;
+};
+
+TEST_F(RegionOfInterestTests, majorAxisBorder) {
+  EXPECT_EQ(1, numKept(0, 1.0));
+  EXPECT_EQ(0, numKept(0, 1.001));
+}
+
+TEST_F(RegionOfInterestTests, minorAxisBorder) {
+  EXPECT_EQ(1, numKept(2, 1.0));
+  EXPECT_EQ(0, numKept(2, 1.001));
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  try {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+  } catch (std::exception &e) {
+    std::cerr << "Unhandled Exception: " << e.what() << std::endl;
+  }
+  return 1;
+}
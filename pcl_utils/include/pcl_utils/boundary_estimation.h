@@ -0,0 +1,44 @@
+#ifndef BOUNDARY_ESTIMATION_H_INCLUDED
+#define BOUNDARY_ESTIMATION_H_INCLUDED
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include <cmath>
+#include <string>
+#include <vector>
+
+namespace boundary_estimation {
+
+    struct Parameters
+    {
+        // the radius boundary_detection always used
+        Parameters() : normal_radius(0.03), boundary_radius(0.03), angle_threshold(M_PI / 2) {}
+
+        double normal_radius;
+        double boundary_radius;
+        // largest gap between neighbours, around the normal, of a point that is not on a boundary
+        float angle_threshold;
+    };
+
+    /** Normals with pcl::NormalEstimationOMP. Organized clouds are searched with pcl::search::OrganizedNeighbor,
+        others with a kd-tree. */
+    void compute_normals(pcl::PointCloud<pcl::PointXYZ>::ConstPtr cloud, const Parameters& parameters, pcl::PointCloud<pcl::Normal>* normals);
+
+    /** The test of pcl::BoundaryEstimation, run for all points in parallel with the same neighbourhoods as
+        compute_normals. Points without a valid normal are not boundary points. */
+    void compute_boundaries(pcl::PointCloud<pcl::PointXYZ>::ConstPtr cloud, const pcl::PointCloud<pcl::Normal>& normals, const Parameters& parameters,
+                            pcl::PointCloud<pcl::Boundary>* boundaries);
+
+    /** the points of cloud flagged in boundaries, which must be the same size */
+    void extract_boundary_points(const pcl::PointCloud<pcl::PointXYZ>& cloud, const pcl::PointCloud<pcl::Boundary>& boundaries,
+                                 pcl::PointCloud<pcl::PointXYZ>* boundary_points);
+
+    /** For the command line tools: a single input file goes to the output file; a directory has all of its .pcd
+        files, sorted, go to files of the same name in the output directory, which is created if needed. Returns
+        false with a message if the paths do not fit either case. */
+    bool list_files(const std::string& input, const std::string& output, std::vector<std::string>* inputs, std::vector<std::string>* outputs);
+
+}
+
+#endif // BOUNDARY_ESTIMATION_H_INCLUDED
@@ -0,0 +1,59 @@
+#ifndef BOUNDING_BOX_H_INCLUDED
+#define BOUNDING_BOX_H_INCLUDED
+
+#include <Eigen/Eigen>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+namespace bounding_box {
+
+    /** The oriented bounding box and principal axes of a cloud, as pcl::MomentOfInertiaEstimation returns them from
+        getOBB, getEigenValues, getEigenVectors and getMassCenter. */
+    struct OrientedBoundingBox
+    {
+        // corners relative to position, in the frame of rotational_matrix
+        pcl::PointXYZ min_point;
+        pcl::PointXYZ max_point;
+        pcl::PointXYZ position;
+        // columns are the major, middle and minor axes
+        Eigen::Matrix3f rotational_matrix;
+        // eigenvalues of the sample covariance, major_value >= middle_value >= minor_value
+        float major_value, middle_value, minor_value;
+        Eigen::Vector3f major_vector, middle_vector, minor_vector;
+        Eigen::Vector3f mass_center;
+
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    };
+
+    /** Mean and scatter of a stream of points, updated a point at a time (Welford), so the moments of a cloud can be
+        taken without storing it. Accumulators of disjoint parts of a cloud can be merged. */
+    struct Moments
+    {
+        Moments();
+
+        void add(const Eigen::Vector3d& point);
+        void merge(const Moments& other);
+
+        /** normalized by n, as pcl::computeCovarianceMatrixNormalized */
+        Eigen::Matrix3d covariance() const;
+        /** normalized by n - 1, as pcl::MomentOfInertiaEstimation */
+        Eigen::Matrix3d sample_covariance() const;
+
+        size_t count;
+        Eigen::Vector3d mean;
+        // sum of the outer products of the deviations from the mean
+        Eigen::Matrix3d scatter;
+    };
+
+    /** the axes, eigenvalues and mass center of compute_obb from the moments alone, leaving the extents; returns
+        false if no point was added */
+    bool compute_axes(const Moments& moments, OrientedBoundingBox* box);
+
+    /** PCA bounding box in two passes over the cloud and a closed-form 3x3 eigensolve, without the moment of inertia
+        and eccentricity curves pcl::MomentOfInertiaEstimation computes on the side. Returns false for an empty cloud. */
+    bool compute_obb(const pcl::PointCloud<pcl::PointXYZ>& cloud, OrientedBoundingBox* box);
+
+}
+
+#endif // BOUNDING_BOX_H_INCLUDED
@@ -0,0 +1,50 @@
+#ifndef CLOUD_CROP_H_INCLUDED
+#define CLOUD_CROP_H_INCLUDED
+
+#include <Eigen/Eigen>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include <vector>
+
+namespace cloud_crop {
+
+    enum PlaneTest
+    {
+        NO_PLANE,
+        // a * x + b * y + c * z + d >= plane_distance
+        ABOVE_PLANE,
+        // |a * x + b * y + c * z + d| <= plane_distance
+        NEAR_PLANE
+    };
+
+    /** What to keep of a cloud and where to move it. The box and the plane are tested against the input points,
+        before the transform; the transform is applied to the points that are kept. */
+    struct Crop
+    {
+        // identity transform, no box and no plane
+        Crop();
+
+        void set_box(const Eigen::Vector3f& min, const Eigen::Vector3f& max);
+        void set_plane(PlaneTest test, const Eigen::Vector4f& coefficients, float distance);
+
+        Eigen::Affine3f transform;
+        bool use_box;
+        Eigen::Vector3f box_min, box_max;
+        PlaneTest plane_test;
+        Eigen::Vector4f plane;
+        float plane_distance;
+
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    };
+
+    /** indices of the points the crop keeps, in order; the transform is not used */
+    void crop_indices(const pcl::PointCloud<pcl::PointXYZ>& cloud, const Crop& crop, std::vector<int>* indices);
+
+    /** the points the crop keeps, transformed and packed in order into an unorganized cloud */
+    void crop_points(const pcl::PointCloud<pcl::PointXYZ>& cloud, const Crop& crop, pcl::PointCloud<pcl::PointXYZ>* points);
+
+}
+
+#endif // CLOUD_CROP_H_INCLUDED
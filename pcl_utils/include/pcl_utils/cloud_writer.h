@@ -0,0 +1,85 @@
+#ifndef CLOUD_WRITER_H_INCLUDED
+#define CLOUD_WRITER_H_INCLUDED
+
+#include <pcl/PCLPointCloud2.h>
+#include <pcl/conversions.h>
+#include <pcl/point_cloud.h>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <deque>
+#include <string>
+
+namespace cloud_writer {
+
+    enum Format { ASCII, BINARY, BINARY_COMPRESSED };
+
+    /** "ascii", "binary" or "binary_compressed"; anything else is BINARY */
+    Format parse_format(const std::string& name);
+
+    /** writes a PCD file in the calling thread; prints the error and returns false if it could not be written */
+    bool save(const std::string& file, const pcl::PCLPointCloud2& cloud, Format format = BINARY);
+
+    template <typename PointT>
+    bool save(const std::string& file, const pcl::PointCloud<PointT>& cloud, Format format = BINARY)
+    {
+        pcl::PCLPointCloud2 blob;
+        pcl::toPCLPointCloud2(cloud, blob);
+        return save(file, blob, format);
+    }
+
+    /** Writes PCD files on a background thread, so saving debugging output never blocks the caller for longer than
+        it takes to copy the cloud. The queue is bounded: when it is full, new clouds are dropped rather than
+        waited for. Whatever is queued is written before the destructor returns. */
+    class AsyncWriter
+    {
+    public:
+        AsyncWriter(size_t max_queued = 16);
+        ~AsyncWriter();
+
+        /** copies the cloud and queues it; false if the queue was full and the cloud was dropped */
+        template <typename PointT>
+        bool write(const std::string& file, const pcl::PointCloud<PointT>& cloud, Format format = BINARY)
+        {
+            pcl::PCLPointCloud2::Ptr blob(new pcl::PCLPointCloud2);
+            pcl::toPCLPointCloud2(cloud, *blob);
+            return write(file, blob, format);
+        }
+
+        /** queues the cloud without copying it; it must not be changed afterwards */
+        bool write(const std::string& file, pcl::PCLPointCloud2::ConstPtr cloud, Format format = BINARY);
+
+        /** blocks until every queued cloud has been written */
+        void flush();
+
+        /** number of clouds dropped because the queue was full */
+        int num_dropped() const;
+
+    private:
+        struct Job
+        {
+            std::string file;
+            pcl::PCLPointCloud2::ConstPtr cloud;
+            Format format;
+        };
+
+        void run();
+
+        size_t max_queued;
+        std::deque<Job> queue;
+        bool writing;
+        bool stopping;
+        int dropped;
+        mutable boost::mutex mutex;
+        boost::condition_variable changed;
+        boost::thread thread;
+    };
+
+    /** the process-wide writer, started on first use */
+    AsyncWriter& shared_writer();
+
+}
+
+#endif // CLOUD_WRITER_H_INCLUDED
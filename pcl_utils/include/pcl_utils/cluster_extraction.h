@@ -13,11 +13,20 @@
 #include <pcl/sample_consensus/model_types.h>
 #include <pcl/segmentation/sac_segmentation.h>
 #include <pcl/segmentation/extract_clusters.h>
+#include <pcl_utils/scene_segmentation.h>
 
 
 namespace cluster_extraction {
 
-    int extract_clusters(pcl::PointCloud<pcl::PointXYZ>::Ptr cloud, std::vector<pcl::PointCloud<pcl::PointXYZ> >* clusters, ros::Publisher plane_points_pub);
+    /** Connected components of the grid cells of size cell_size that hold points, joining each cell with its 26
+        neighbors. Points closer than cell_size always end up in the same cluster, as with
+        pcl::EuclideanClusterExtraction, but points up to 2 * sqrt(3) * cell_size apart may be joined too.
+        Linear in the number of points apart from sorting them, and run in parallel over slabs along x.
+        Clusters hold between min_cluster_size and max_cluster_size points, largest first. */
+    void grid_connected_components(const pcl::PointCloud<pcl::PointXYZ>& cloud, float cell_size, int min_cluster_size, int max_cluster_size, std::vector<pcl::PointIndices>* clusters);
+
+    /** clusters the scene without its table, taking out further planes first; returns the number of planar clusters */
+    int extract_clusters(const scene_segmentation::Scene& scene, std::vector<pcl::PointCloud<pcl::PointXYZ> >* clusters, ros::Publisher plane_points_pub);
 
 }
 
@@ -5,13 +5,63 @@
 #include <visualization_msgs/Marker.h>
 #include <visualization_msgs/MarkerArray.h>
 
+#include <Eigen/Eigen>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl/ModelCoefficients.h>
+
+#include <pcl_utils/bounding_box.h>
+
+#include <ostream>
+
 namespace cluster_projection {
 
-pcl::PointCloud<pcl::PointXYZ> calculate_occluded(pcl::PointCloud<pcl::PointXYZ> cluster, pcl::PointCloud<pcl::PointXYZ>::Ptr inverse, pcl::PointCloud<pcl::PointXYZ>::Ptr plane_cloud,
-                                                  Eigen::Matrix4d transformation_matrix, pcl::PointCloud<pcl::PointXYZ>::Ptr transformed_inverse,
-                                                  pcl::PointCloud<pcl::PointXYZ>::Ptr projected_inverse, pcl::ModelCoefficients::Ptr plane_coeff,
-                                                  int face_direction, int forward_back, pcl::PointXYZ min_point_OBB, pcl::PointXYZ max_point_OBB, Eigen::Vector3f position, Eigen::Matrix3f rotational_matrix_OBB,
-                                                  visualization_msgs::MarkerArrayPtr markers, std::vector<Eigen::Vector3f> corners, ros::Publisher plane_pub);
+/** The inverse (unknown space) cloud binned into cubic blocks, so occlusion queries only visit blocks whose bounds
+ *  intersect the query. Built once per TSDF, as it does not vary between clusters. */
+class OccludedSpaceIndex
+{
+public:
+    struct Block
+    {
+        // bounds of the points in the camera frame and in the frame of the inverse cloud
+        Eigen::Vector3f min, max;
+        Eigen::Vector3f original_min, original_max;
+        // range of the block's points in indices and transformed
+        int begin, end;
+    };
+
+    OccludedSpaceIndex(pcl::PointCloud<pcl::PointXYZ>::Ptr inverse, Eigen::Matrix4d transformation_matrix, float block_size);
+
+    pcl::PointCloud<pcl::PointXYZ>::Ptr inverse;
+    // indices into inverse, grouped by block
+    std::vector<int> indices;
+    // inverse points transformed into the camera frame, in the same order as indices
+    pcl::PointCloud<pcl::PointXYZ> transformed;
+    std::vector<Block> blocks;
+};
+
+/** The space calculate_occluded searches behind a cluster: a frustum through the corners of the front face,
+ *  above the table and beyond the cluster. */
+struct OcclusionQuery
+{
+    std::vector<Eigen::Vector3f> normal_vectors, corners;
+    Eigen::Vector3f plane_normal;
+    float plane_offset;
+    float min_squared_range;
+
+    /** whether points in a box of the inverse cloud's frame could be part of the result */
+    bool may_intersect(const Eigen::Vector3f& min, const Eigen::Vector3f& max, const Eigen::Matrix4d& transformation_matrix) const;
+};
+
+/** Finds the points of the inverse cloud occluded by the cluster. Their moments in the camera frame are accumulated
+ *  while they are classified; the points themselves, in the frame of the inverse cloud, are only gathered into
+ *  occluded_region if it is not NULL. Timings go to log, which is not shared between threads, if it is not NULL. */
+void calculate_occluded(pcl::PointCloud<pcl::PointXYZ> cluster, const OccludedSpaceIndex& inverse_index, pcl::PointCloud<pcl::PointXYZ>::Ptr plane_cloud,
+                        Eigen::Matrix4d transformation_matrix, pcl::ModelCoefficients::Ptr plane_coeff,
+                        int face_direction, int forward_back, pcl::PointXYZ min_point_OBB, pcl::PointXYZ max_point_OBB, Eigen::Vector3f position, Eigen::Matrix3f rotational_matrix_OBB,
+                        visualization_msgs::MarkerArrayPtr markers, std::vector<Eigen::Vector3f> corners, ros::Publisher plane_pub,
+                        bounding_box::Moments* moments, pcl::PointCloud<pcl::PointXYZ>* occluded_region, OcclusionQuery* query = NULL,
+                        std::ostream* log = NULL);
 
 }
 
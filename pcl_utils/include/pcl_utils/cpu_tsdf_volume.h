@@ -0,0 +1,124 @@
+#ifndef CPU_TSDF_VOLUME_H_INCLUDED
+#define CPU_TSDF_VOLUME_H_INCLUDED
+
+#include <Eigen/Eigen>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include <vector>
+
+/** CPU stand-in for the parts of pcl::gpu::kinfuLS used by the kinfu node, so the occlusion pipeline
+    also runs on machines without CUDA. The camera poses are given (no ICP), as in the kinfu node. */
+namespace cpu_tsdf {
+
+    /** host depth image in millimeters, shaped like pcl::gpu::DeviceArray2D<unsigned short> */
+    class DepthMap
+    {
+    public:
+        DepthMap(int rows, int cols) : rows_(rows), cols_(cols), data_(rows * cols, 0) {}
+
+        void upload(const std::vector<unsigned short>& data, int cols)
+        {
+            data_ = data;
+            cols_ = cols;
+            rows_ = data.size() / cols;
+        }
+
+        int rows() const { return rows_; }
+        int cols() const { return cols_; }
+        const unsigned short* ptr() const { return &data_[0]; }
+
+    private:
+        int rows_, cols_;
+        std::vector<unsigned short> data_;
+    };
+
+    /** truncated signed distance volume with the memory layout of kinfu's download: x fastest, z slowest,
+        distances normalized to [-1, 1] and positive in front of the surface */
+    class TsdfVolume
+    {
+    public:
+        static const int DEFAULT_RESOLUTION = 512;
+        static const short MAX_WEIGHT = 128;
+
+        TsdfVolume(const Eigen::Vector3i& resolution, const Eigen::Vector3f& size);
+
+        void reset();
+
+        void setTsdfTruncDist(float distance) { trunc_dist_ = distance; }
+
+        /** skip voxel blocks that cannot be seen or lie behind all measurements (on by default) */
+        void setSkipOutsideFrustum(bool skip) { skip_outside_frustum_ = skip; }
+
+        /** fuse a depth image taken from camera_pose (camera to volume frame) */
+        void integrate(const DepthMap& depth, const Eigen::Affine3f& camera_pose, float fx, float fy, float cx, float cy);
+
+        void downloadTsdfAndWeights(std::vector<float>& tsdf, std::vector<short>& weights) const;
+
+        /** zero crossings of the volume, in the volume frame */
+        void fetchCloudHost(pcl::PointCloud<pcl::PointXYZ>& cloud) const;
+
+        const Eigen::Vector3i& getResolution() const { return resolution_; }
+        const Eigen::Vector3f& getSize() const { return size_; }
+
+        /** number of blocks visited by the last integrate call */
+        int getNumBlocksIntegrated() const { return num_blocks_integrated_; }
+
+        /** a flag for each block of BLOCK_SIZE voxels (x fastest, z slowest) that is set if one of its voxels was
+            updated or the volume was reset since the last call */
+        void takeChangedBlocks(std::vector<char>& changed);
+
+        static const int BLOCK_SIZE = 16;
+
+    private:
+
+        inline size_t index(int x, int y, int z) const
+        {
+            return ((size_t) z * resolution_(1) + y) * resolution_(0) + x;
+        }
+
+        Eigen::Vector3i resolution_;
+        Eigen::Vector3f size_;
+        Eigen::Vector3f cell_size_;
+        float trunc_dist_;
+        bool skip_outside_frustum_;
+        int num_blocks_integrated_;
+
+        std::vector<float> tsdf_;
+        std::vector<short> weights_;
+        std::vector<char> changed_blocks_;
+    };
+
+    /** replaces pcl::gpu::kinfuLS::KinfuTracker in the kinfu node; every frame is integrated at the given pose */
+    class KinfuTracker
+    {
+    public:
+        KinfuTracker(const Eigen::Vector3f& volume_size, float shifting_distance, int rows, int cols,
+                     const Eigen::Vector3i& resolution = Eigen::Vector3i::Constant(TsdfVolume::DEFAULT_RESOLUTION));
+
+        void setDepthIntrinsics(float fx, float fy, float cx, float cy);
+        void setInitialCameraPose(const Eigen::Affine3f& pose);
+        void reset();
+
+        bool operator()(const DepthMap& depth, const Eigen::Affine3f& pose);
+
+        TsdfVolume& volume() { return volume_; }
+        const TsdfVolume& volume() const { return volume_; }
+
+        Eigen::Affine3f getCameraPose() const { return camera_pose_; }
+
+    private:
+        TsdfVolume volume_;
+        int rows_, cols_;
+        float fx_, fy_, cx_, cy_;
+        Eigen::Affine3f init_camera_pose_;
+        Eigen::Affine3f camera_pose_;
+
+    public:
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    };
+
+}
+
+#endif
@@ -4,9 +4,10 @@
 #include <pcl_utils/tsdf_converter.h>
 #include <pcl_utils/cluster_extraction.h>
 #include <pcl_utils/cluster_projection.h>
+#include <pcl_utils/bounding_box.h>
+#include <pcl_utils/timer.h>
 
 // for visualization
-#include <pcl/features/moment_of_inertia_estimation.h>
 #include <pcl/visualization/cloud_viewer.h>
 #include <boost/thread/thread.hpp>
 
@@ -24,8 +25,97 @@
 
 namespace occluded_region_finder {
 
-void find_occluded_regions(std::vector<float> tsdf_distances, std::vector<short> tsdf_weights, pcl::PointCloud<pcl::PointXYZ>::Ptr current_cloud_ptr, Eigen::Matrix4d transformation_matrix, bool saving, std::string outfile, ros::Publisher markers_pub,
-                           ros::Publisher points_pub, ros::Publisher regions_pub, ros::Publisher plane_pub, ros::Publisher object_points_pub, ros::Publisher plane_points_pub); //,
+/** Everything find_occluded_regions needs from a single cluster, assembled in cluster order. */
+struct ClusterResult
+{
+	std::string log;
+	visualization_msgs::MarkerArray markers;
+	// the occluded points, only gathered when they are saved or published
+	pcl::PointCloud<pcl::PointXYZ>::Ptr occluded_region;
+	bool has_region;
+	pcl_utils::OccludedRegion region;
+	sensor_msgs::PointCloud2 occluded_cloud_msg;
+	// the space searched for the occluded region, if the search was done
+	bool has_query;
+	cluster_projection::OcclusionQuery query;
+};
+
+/** State kept between find_occluded_regions calls on a volume that keeps being integrated. Only the blocks of the
+ *  volume that changed are converted again, and a cluster is only processed again if its points changed or its
+ *  occlusion frustum reaches a changed block; the camera pose and the table must not have moved. */
+class OcclusionCache
+{
+public:
+	struct CachedCluster
+	{
+		uint64_t key;
+		int j;
+		ClusterResult result;
+	};
+
+	OcclusionCache() : valid(false) {}
+
+	/** forget everything, e.g. after the volume was reset */
+	void clear();
+
+	tsdf_converter::IncrementalConverter converter;
+	bool valid;
+	Eigen::Matrix4d transformation_matrix;
+	std::vector<float> plane_coefficients;
+	float table_cutoff;
+	bool face_use_eigenvalues;
+	bool keep_region_clouds;
+	std::vector<pcl::PointCloud<pcl::PointXYZ> > clusters;
+	int num_plane_clusters;
+	std::vector<CachedCluster> results;
+
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+/** Wall time and allocations of the stages of a find_occluded_regions call, added up over the calls it is passed to.
+ *  Allocations are only counted if the program sets count_allocations to a counter of its own. */
+struct StageStatistics
+{
+	enum Stage
+	{
+		CONVERT, // tsdf to clouds
+		PLANE, // scene segmentation, table and graspable points
+		CLUSTERS, // cluster extraction
+		OCCLUSION, // occluded regions of the clusters
+		MARKERS, // assembling and publishing the markers and regions
+		SAVE, // queueing or writing the debugging clouds
+		NUM_STAGES
+	};
+
+	static const char* stage_name(int stage);
+
+	StageStatistics();
+
+	void clear();
+	void begin(Stage stage);
+	void end(Stage stage);
+
+	double seconds[NUM_STAGES];
+	uint64_t allocations[NUM_STAGES];
+	uint64_t allocated_bytes[NUM_STAGES];
+	int num_clusters;
+	int num_clusters_processed;
+
+	/** the number of allocations and the bytes allocated since the start of the process */
+	void (*count_allocations)(uint64_t* allocations, uint64_t* bytes);
+
+private:
+	Timer timers[NUM_STAGES];
+	uint64_t start_allocations[NUM_STAGES];
+	uint64_t start_bytes[NUM_STAGES];
+};
+
+/** cache may be NULL to process the whole volume, and stages NULL if they are not timed. changed_blocks, if the
+ *  volume knows them, are the blocks that changed since the last call, as IncrementalConverter::convert takes them. */
+void find_occluded_regions(const tsdf_converter::TsdfVolumeView& tsdf, pcl::PointCloud<pcl::PointXYZ>::Ptr current_cloud_ptr, Eigen::Matrix4d transformation_matrix, bool saving, std::string outfile, ros::Publisher markers_pub,
+                           ros::Publisher points_pub, ros::Publisher regions_pub, ros::Publisher plane_pub, ros::Publisher object_points_pub, ros::Publisher plane_points_pub,
+                           OcclusionCache* cache = NULL, StageStatistics* stages = NULL, const std::vector<char>* changed_blocks = NULL); //,
                            //pcl::PointCloud<pcl::PointXYZ>::Ptr zero_crossing_cloud, pcl::PointCloud<pcl::PointXYZ>::Ptr foreground_cloud, PointCloudVoxelGrid::CloudType::Ptr inverse_cloud);
 
 }
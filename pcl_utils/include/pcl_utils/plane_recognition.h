@@ -13,9 +13,11 @@
 #include <pcl/kdtree/kdtree.h>
 #include "ros/ros.h"
 #include <visualization_msgs/MarkerArray.h>
+#include <pcl_utils/scene_segmentation.h>
 
 namespace plane_recognition {
-    void calculate_plane(pcl::PointCloud<pcl::PointXYZ>::Ptr cloud, pcl::PointIndices::Ptr inliers, pcl::ModelCoefficients::Ptr coefficients, ros::Publisher plane_pub, visualization_msgs::MarkerArrayPtr markers, ros::Publisher plane_points_pub);
+    /** publishes the table found by scene_segmentation::segment_scene: its points and its bounding box in /base_link */
+    void calculate_plane(const scene_segmentation::Scene& scene, ros::Publisher plane_pub, visualization_msgs::MarkerArrayPtr markers, ros::Publisher plane_points_pub);
 }
 
 
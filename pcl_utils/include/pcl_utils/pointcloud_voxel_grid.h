@@ -7,8 +7,13 @@
 #include <pcl/point_types.h>
 
 #include <math.h>
+#include <stdint.h>
+#include <vector>
 
 
+/** Occupancy grid over the bounding box of a cloud, stored as one bit per voxel. The grid is split
+ *  into blocks of BLOCK_X x BLOCK_Y x BLOCK_Z voxels that are only allocated once a voxel in them is
+ *  visited. Each 64 bit word holds a run of voxels along z, so empty voxels can be found a word at a time. */
 class PointCloudVoxelGrid
 {
 public:
@@ -25,7 +30,11 @@ public:
     inline int get(int x, int y, int z) const
     {
         assert((x >= 0) && (x < x_size) && (y >= 0) && (y < y_size) && (z >= 0) && (z < z_size));
-        return array(z + y*(z_size) + x*(y_size*z_size));
+        int offset = block_offsets[block_index(x, y, z)];
+        if (offset < 0) {
+            return NOT_VISITED;
+        }
+        return (words[offset + word_index(x, y)] >> (z % BLOCK_Z)) & 1;
     }
 
     inline int get(voxel v) {
@@ -36,17 +45,20 @@ public:
         return get(point_to_voxel(point));
     }
 
-    inline void set_all(int val)
-    {
-        for(int i=0; i < x_size*y_size*z_size; ++i)
-        {
-            array(i) = val;
-        }
-    }
+    void set_all(int val);
 
     inline void set(int x, int y, int z, int val) {
         assert((x >= 0) && (x < x_size) && (y >= 0) && (y < y_size) && (z >= 0) && (z < z_size));
-        array(z + y*(z_size) + x*(y_size*z_size)) = val;
+        int block = block_index(x, y, z);
+        if (block_offsets[block] < 0) {
+            if (val == NOT_VISITED) {
+                return;
+            }
+            allocate_block(block);
+        }
+        uint64_t bit = uint64_t(1) << (z % BLOCK_Z);
+        uint64_t& word = words[block_offsets[block] + word_index(x, y)];
+        word = val ? (word | bit) : (word & ~bit);
     }
 
     inline void set(voxel v, int val) {
@@ -74,9 +86,33 @@ public:
 
 
 
+    /** Number of visited voxels. */
+    size_t count_visited() const;
+
+    /** Bytes used by the allocated blocks. */
+    size_t memory_usage() const;
+
 private:
+    static const int BLOCK_X = 8;
+    static const int BLOCK_Y = 8;
+    static const int BLOCK_Z = 64;
+    static const int WORDS_PER_BLOCK = BLOCK_X * BLOCK_Y;
+
+    inline int block_index(int x, int y, int z) const {
+        return (x / BLOCK_X * y_blocks + y / BLOCK_Y) * z_blocks + z / BLOCK_Z;
+    }
+
+    inline int word_index(int x, int y) const {
+        return (x % BLOCK_X) * BLOCK_Y + y % BLOCK_Y;
+    }
+
+    void allocate_block(int block);
+
     int x_size, y_size, z_size;
-    Eigen::VectorXi array;
+    int x_blocks, y_blocks, z_blocks;
+    // offset of each block into words, -1 if no voxel in the block has been visited
+    std::vector<int> block_offsets;
+    std::vector<uint64_t> words;
     // these will be in the original space - i.e. meters
     Eigen::Vector3d minimum;
     Eigen::Vector3d maximum;
@@ -0,0 +1,36 @@
+#ifndef SCENE_SEGMENTATION_H_INCLUDED
+#define SCENE_SEGMENTATION_H_INCLUDED
+
+#include <pcl/ModelCoefficients.h>
+#include <pcl/PointIndices.h>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include <vector>
+
+namespace scene_segmentation {
+
+    /** The zero-crossing cloud downsampled once, with the table plane fitted once. plane_recognition publishes the
+        table from it and cluster_extraction clusters what is left. */
+    struct Scene
+    {
+        pcl::PointCloud<pcl::PointXYZ>::Ptr downsampled;
+        // the voxel grid leaf size used, never finer than the spacing of the input points
+        float leaf_size;
+        // empty if no plane was found
+        pcl::ModelCoefficients::Ptr table_coefficients;
+        // indices into downsampled within plane_recognition_distance_threshold of the table
+        pcl::PointIndices::Ptr table_inliers;
+        // points of downsampled within plane_cluster_distance_threshold of the table, removed before clustering
+        std::vector<bool> table_mask;
+        int num_table_points;
+        // downsampled without the masked points, in the same order
+        pcl::PointCloud<pcl::PointXYZ>::Ptr remaining;
+    };
+
+    /** point_spacing is the distance between neighbouring input points, the TSDF voxel size for a zero-crossing cloud */
+    void segment_scene(pcl::PointCloud<pcl::PointXYZ>::Ptr cloud, float point_spacing, Scene* scene);
+
+}
+
+#endif // SCENE_SEGMENTATION_H_INCLUDED
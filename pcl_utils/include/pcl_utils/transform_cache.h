@@ -0,0 +1,39 @@
+#ifndef TRANSFORM_CACHE_H_INCLUDED
+#define TRANSFORM_CACHE_H_INCLUDED
+
+#include "ros/ros.h"
+#include <tf/transform_listener.h>
+#include <boost/shared_ptr.hpp>
+#include <string>
+
+namespace transform_cache {
+
+    /** statistics over all lookups since the start of the process */
+    struct LookupStatistics
+    {
+        int num_lookups;
+        int num_failures;
+        double total_lookup_time; // wall time spent in lookups (s)
+        double max_lookup_time;
+        double total_age; // time between the stamp of the returned transform and now (s)
+        double max_age;
+    };
+
+    /** the process-wide listener; created on first use unless set_listener was called before */
+    boost::shared_ptr<tf::TransformListener> get_listener();
+
+    /** share a listener that the node already owns, so its buffer is reused */
+    void set_listener(boost::shared_ptr<tf::TransformListener> listener);
+
+    /** look up the transform at the given stamp (ros::Time(0) for the latest one) without waiting
+        longer than timeout, which is zero by default; returns false if it is not available */
+    bool lookup_transform(const std::string& target_frame, const std::string& source_frame, const ros::Time& stamp,
+                          tf::StampedTransform* transform, ros::Duration timeout = ros::Duration(0));
+
+    LookupStatistics get_statistics();
+
+    void print_statistics();
+
+}
+
+#endif
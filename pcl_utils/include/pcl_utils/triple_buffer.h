@@ -0,0 +1,90 @@
+#ifndef TRIPLE_BUFFER_H_INCLUDED
+#define TRIPLE_BUFFER_H_INCLUDED
+
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include <algorithm>
+
+namespace triple_buffer {
+
+    /** Hands the latest of a stream of frames from one producer thread to one consumer thread. The producer fills
+        write_slot() and calls publish(); the consumer gets each published frame at most once from take() or
+        try_take(), and frames published in between are dropped. The three frames are allocated up front and
+        reused, and the lock only covers swapping their indices, so neither side waits for the other's copy. */
+    template<typename T>
+    class TripleBuffer
+    {
+    public:
+        /** all three frames start as copies of initial, so they can be sized before the threads start */
+        explicit TripleBuffer(const T& initial = T()) : write_(0), ready_(1), read_(2), fresh_(false), closed_(false)
+        {
+            std::fill(frames_, frames_ + 3, initial);
+        }
+
+        /** producer: the frame to fill next */
+        T& write_slot() { return frames_[write_]; }
+
+        /** producer: hand over write_slot(), replacing a frame the consumer has not taken yet */
+        void publish()
+        {
+            {
+                boost::mutex::scoped_lock lock(mutex_);
+                std::swap(write_, ready_);
+                fresh_ = true;
+            }
+            condition_.notify_one();
+        }
+
+        /** consumer: wait up to timeout for a frame that was not taken before; NULL on timeout or after close().
+            The frame stays valid until the next take. */
+        T* take(const boost::posix_time::time_duration& timeout)
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            boost::system_time deadline = boost::get_system_time() + timeout;
+            while (!fresh_ && !closed_)
+            {
+                if (!condition_.timed_wait(lock, deadline))
+                    break;
+            }
+            return swap_fresh();
+        }
+
+        /** consumer: the new frame if there is one, without waiting */
+        T* try_take()
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            return swap_fresh();
+        }
+
+        /** wakes the consumer for good, e.g. on shutdown */
+        void close()
+        {
+            {
+                boost::mutex::scoped_lock lock(mutex_);
+                closed_ = true;
+            }
+            condition_.notify_all();
+        }
+
+    private:
+        T* swap_fresh()
+        {
+            if (!fresh_ || closed_)
+                return NULL;
+            std::swap(read_, ready_);
+            fresh_ = false;
+            return &frames_[read_];
+        }
+
+        T frames_[3];
+        int write_, ready_, read_;
+        bool fresh_, closed_;
+        boost::mutex mutex_;
+        boost::condition_variable condition_;
+    };
+
+}
+
+#endif
@@ -20,13 +20,149 @@
 
 #include <pcl_utils/pointcloud_voxel_grid.h>
 
+#include <boost/noncopyable.hpp>
+
 namespace tsdf_converter {
 
+/** Number of voxels and extent of a TSDF volume along each axis */
+struct VolumeGeometry {
+    Eigen::Vector3i resolution;
+    Eigen::Vector3f size; // m
+
+    /** the volume kinfu uses by default: 512 voxels over 2 m along each axis */
+    VolumeGeometry() : resolution(Eigen::Vector3i::Constant(512)), size(Eigen::Vector3f::Constant(2)) {}
+    VolumeGeometry(const Eigen::Vector3i& resolution, const Eigen::Vector3f& size) : resolution(resolution), size(size) {}
+
+    Eigen::Vector3f voxel_size() const { return size.cwiseQuotient(resolution.cast<float>()); }
+    size_t num_voxels() const { return (size_t) resolution(0) * resolution(1) * resolution(2); }
+
+    bool operator==(const VolumeGeometry& other) const { return resolution == other.resolution && size == other.size; }
+    bool operator!=(const VolumeGeometry& other) const { return !(*this == other); }
+};
+
+/** The volume_resolution_{x,y,z} and volume_size_{x,y,z} /occlusion_parameters */
+VolumeGeometry get_volume_geometry();
+
+/** Reads the geometry from six command line arguments starting at argv[first] (resolution then size, x, y and z),
+    keeping the default if there are none; false if they are incomplete or invalid */
+bool parse_volume_geometry(int argc, char** argv, int first, VolumeGeometry* geometry);
+
+/** Non-owning view of a TSDF volume, voxels stored with x fastest and z slowest */
+struct TsdfVolumeView {
+    const float* distances;
+    const short* weights;
+    Eigen::Vector3i resolution;
+    Eigen::Vector3f size;
+
+    TsdfVolumeView() : distances(NULL), weights(NULL), resolution(Eigen::Vector3i::Zero()), size(Eigen::Vector3f::Zero()) {}
+    TsdfVolumeView(const float* distances, const short* weights, const VolumeGeometry& geometry = VolumeGeometry())
+        : distances(distances), weights(weights), resolution(geometry.resolution), size(geometry.size) {}
+
+    VolumeGeometry geometry() const { return VolumeGeometry(resolution, size); }
+    Eigen::Vector3f voxel_size() const { return size.cwiseQuotient(resolution.cast<float>()); }
+    size_t num_voxels() const { return (size_t) resolution(0) * resolution(1) * resolution(2); }
+    size_t index(int x, int y, int z) const { return ((size_t) z * resolution(1) + y) * resolution(0) + x; }
+};
+
+/** Read-only memory mapping of the distance and weight .dat dumps written by kinfu */
+class MappedTsdfVolume : private boost::noncopyable {
+public:
+    MappedTsdfVolume();
+    ~MappedTsdfVolume();
+
+    bool open(std::string distance_file, std::string weight_file, const VolumeGeometry& geometry = VolumeGeometry());
+    void close();
+
+    bool is_open() const { return distance_map != NULL && weight_map != NULL; }
+    TsdfVolumeView view() const;
+
+private:
+    void* distance_map;
+    void* weight_map;
+    size_t distance_bytes;
+    size_t weight_bytes;
+    VolumeGeometry geometry;
+};
+
+/** The /occlusion_parameters convert_tsdf reads */
+struct ConversionParameters {
+    int jump, prob;
+    float voxel_size, min_x, max_x, min_y, max_y, min_z, max_z, tsdf_min_distance, tsdf_max_distance;
+
+    bool operator==(const ConversionParameters& other) const;
+};
+
+ConversionParameters get_conversion_parameters();
+
+/** Converts a volume that changes between calls, like convert_tsdf, but keeps the points extracted from each block
+    and only extracts them again from blocks whose distances or weights changed since the last call. The unknown space
+    grid is kept as well, and only its cells that overlap those blocks are updated. The points are in block order
+    rather than in z/y/x order. */
+class IncrementalConverter {
+public:
+    static const int BLOCK_SIZE = 16;
+
+    /** bounds of a part of the volume, in the frame of the clouds (m) */
+    struct Region {
+        Eigen::Vector3f min, max;
+    };
+
+    IncrementalConverter();
+
+    /** changed_blocks holds a flag for each block of BLOCK_SIZE voxels (x fastest, z slowest) that is set if the
+        block changed since the last call, as cpu_tsdf::TsdfVolume::takeChangedBlocks reports them, so the other
+        blocks are not even read. Without it, each block is compared with the last call by a checksum of its voxels. */
+    void convert(const TsdfVolumeView& tsdf, pcl::PointCloud<pcl::PointXYZ>::Ptr zero_crossing_cloud, pcl::PointCloud<pcl::PointXYZ>::Ptr foreground_cloud, pcl::PointCloud<pcl::PointXYZ>::Ptr inverse_cloud,
+                 const std::vector<char>* changed_blocks = NULL);
+
+    /** forget everything, e.g. after the volume was reset */
+    void clear();
+
+    /** true if the last call could not reuse anything: first call, different volume or parameters, or the unknown
+        space grid moved */
+    bool all_changed() const { return all_changed_; }
+
+    /** where the clouds of the last call may differ from the call before, including the unknown space grid cells
+        that overlap the changed blocks */
+    const std::vector<Region>& changed_regions() const { return changed_regions_; }
+
+private:
+    struct Block {
+        bool valid;
+        uint64_t checksum;
+        pcl::PointCloud<pcl::PointXYZ>::VectorType zero_crossing, foreground, inverse;
+        // bounds of the foreground points
+        Eigen::Vector3f foreground_min, foreground_max;
+        // the free cells of the unknown space grid whose corner lies in the block
+        pcl::PointCloud<pcl::PointXYZ>::VectorType unknown;
+
+        Block() : valid(false), checksum(0) {}
+    };
+
+    Eigen::Vector3i grid_cell(const pcl::PointXYZ& point) const;
+    pcl::PointXYZ grid_point(const Eigen::Vector3i& cell) const;
+    int owner_block(const pcl::PointXYZ& point) const;
+    void count_foreground(const pcl::PointCloud<pcl::PointXYZ>::VectorType& points, int change, std::vector<char>* unknown_changed);
+    void find_unknown(int b);
+
+    std::vector<Block> blocks;
+    Eigen::Vector3i num_blocks;
+    VolumeGeometry geometry;
+    ConversionParameters parameters;
+    // bounds of the foreground cloud, which place the unknown space grid
+    Eigen::Vector3d grid_min, grid_max;
+    // cells of the unknown space grid along each axis, and the number of foreground points in each cell
+    Eigen::Vector3i grid_size;
+    std::vector<int> grid_counts;
+    bool all_changed_;
+    std::vector<Region> changed_regions_;
+};
+
 void read_files(std::string distance_file, std::string weight_file, std::vector<float>* tsdf_distances, std::vector<short>* tsdf_weights);
 
-void convert_tsdf(std::vector<float> tsdf_distances, std::vector<short> tsdf_weights, pcl::PointCloud<pcl::PointXYZ>::Ptr zero_crossing_cloud, pcl::PointCloud<pcl::PointXYZ>::Ptr foreground_cloud, pcl::PointCloud<pcl::PointXYZ>::Ptr inverse_cloud);
+void convert_tsdf(const TsdfVolumeView& tsdf, pcl::PointCloud<pcl::PointXYZ>::Ptr zero_crossing_cloud, pcl::PointCloud<pcl::PointXYZ>::Ptr foreground_cloud, pcl::PointCloud<pcl::PointXYZ>::Ptr inverse_cloud);
 
-void get_weight_cloud(std::vector<float> tsdf_distances, std::vector<short> tsdf_weights, pcl::PointCloud<pcl::PointXYZRGB>::Ptr weights_cloud, int jump);
+void get_weight_cloud(const TsdfVolumeView& tsdf, pcl::PointCloud<pcl::PointXYZRGB>::Ptr weights_cloud, int jump);
 
 }
 
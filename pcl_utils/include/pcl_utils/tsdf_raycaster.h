@@ -0,0 +1,80 @@
+#ifndef TSDF_RAYCASTER_H_INCLUDED
+#define TSDF_RAYCASTER_H_INCLUDED
+
+#include <Eigen/Eigen>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include <pcl_utils/tsdf_converter.h>
+
+#include <vector>
+
+namespace tsdf_raycaster {
+
+    /** pinhole camera; the defaults are those of pr2_sim::Camera */
+    struct CameraIntrinsics
+    {
+        int width, height;
+        double fx, fy, cx, cy;
+        double min_range, max_range; // along the ray (m)
+
+        CameraIntrinsics() : width(640), height(480), fx(525), fy(525), cx(319.5), cy(239.5), min_range(0.3), max_range(4) {}
+    };
+
+    /** rendering of a TSDF volume from one camera pose */
+    struct RaycastImage
+    {
+        int width, height;
+        std::vector<float> depth; // z in the camera frame (m), NaN where the ray hits no surface
+        pcl::PointCloud<pcl::PointXYZ> points; // organized, in the volume frame
+        pcl::PointCloud<pcl::Normal> normals; // organized, in the volume frame, pointing towards free space
+
+        /** the surface points that were hit, without the NaNs */
+        void get_surface_cloud(pcl::PointCloud<pcl::PointXYZ>::Ptr cloud) const;
+    };
+
+    /** Casts rays through a TSDF volume (voxel centers at (i + 0.5) * voxel size, as in kinfu). Blocks of the volume
+        without a surface are skipped using a pyramid of minimum distances, so rays only march where a zero crossing
+        is possible. The view must stay valid while the raycaster is used. */
+    class Raycaster
+    {
+    public:
+        Raycaster(const tsdf_converter::TsdfVolumeView& tsdf, float trunc_dist = 0.03f);
+
+        /** cam_pose is the pose of the camera (z forward) in the volume frame, as returned by pr2_sim::Camera::get_pose
+            when the volume frame is the world frame */
+        void raycast(const Eigen::Matrix4d& cam_pose, const CameraIntrinsics& camera, RaycastImage* image) const;
+
+        /** number of levels in the min-distance pyramid */
+        int num_levels() const { return levels.size(); }
+
+    private:
+        static const int BASE_BLOCK_SIZE = 8;
+        static const int MAX_LEVELS = 4;
+
+        struct Level
+        {
+            int block_size; // in voxels
+            Eigen::Vector3i dims;
+            std::vector<float> min_distance;
+
+            float get(int x, int y, int z) const { return min_distance[((size_t) z * dims(1) + y) * dims(0) + x]; }
+        };
+
+        void build_pyramid();
+
+        /** trilinear interpolation at a position in voxel coordinates; false if a voxel involved was never observed */
+        bool interpolate(const Eigen::Vector3f& g, float* value) const;
+
+        Eigen::Vector3f gradient(const Eigen::Vector3f& g) const;
+
+        tsdf_converter::TsdfVolumeView tsdf;
+        Eigen::Vector3f voxel_size;
+        float trunc_dist;
+        std::vector<Level> levels;
+    };
+
+}
+
+#endif
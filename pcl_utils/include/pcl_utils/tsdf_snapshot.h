@@ -0,0 +1,52 @@
+#ifndef TSDF_SNAPSHOT_H_INCLUDED
+#define TSDF_SNAPSHOT_H_INCLUDED
+
+#include <Eigen/Eigen>
+
+#include <pcl_utils/tsdf_converter.h>
+
+#include <string>
+#include <vector>
+
+namespace tsdf_snapshot {
+
+    /** Block-sparse file format for a kinfu volume and the transformation matrix it was saved with, in place of the
+        dense distance and weight .dat files and the matrix .txt file. In native byte order:
+
+          header       "TSDFSNAP", version, resolution and size along x, y and z, block size, bytes per weight (1 or 2),
+                       transformation matrix (16 doubles, row-major), number of stored blocks
+          occupancy    one bit per block (blocks with x fastest and z slowest, bit i % 8 of byte i / 8)
+          blocks       for each stored block in order, its distances quantized to shorts (d * 32767), then its
+                       weights, voxels with x fastest and z slowest, clipped to the volume
+
+        Blocks where every voxel has weight 0 and distance 0, the values of a reset volume, are not stored. */
+    static const int BLOCK_SIZE = 8;
+
+    /** returns false if the file could not be written */
+    bool write_snapshot(const std::string& file, const tsdf_converter::TsdfVolumeView& tsdf, const Eigen::Matrix4d& transformation_matrix);
+
+    /** A snapshot read back into dense arrays, so it can be used wherever a MappedTsdfVolume can */
+    class Snapshot {
+    public:
+        Snapshot();
+
+        bool read(const std::string& file);
+
+        tsdf_converter::TsdfVolumeView view() const;
+
+        const Eigen::Matrix4d& transformation_matrix() const { return transformation_matrix_; }
+        size_t num_blocks() const { return num_blocks_; }
+        size_t num_stored_blocks() const { return num_stored_blocks_; }
+
+    private:
+        std::vector<float> distances;
+        std::vector<short> weights;
+        tsdf_converter::VolumeGeometry geometry;
+        Eigen::Matrix4d transformation_matrix_;
+        size_t num_blocks_;
+        size_t num_stored_blocks_;
+    };
+
+}
+
+#endif // TSDF_SNAPSHOT_H_INCLUDED
@@ -0,0 +1,70 @@
+#ifndef TSDF_STATISTICS_H_INCLUDED
+#define TSDF_STATISTICS_H_INCLUDED
+
+#include <pcl_utils/tsdf_converter.h>
+
+#include <stdint.h>
+#include <vector>
+
+namespace tsdf_statistics {
+
+    /** How much of a volume has been observed, and how often */
+    struct WeightStatistics
+    {
+        static const int NUM_WEIGHT_BINS = 16;
+        static const int NUM_DISTANCE_BINS = 20;
+
+        WeightStatistics() { clear(); }
+
+        void clear();
+        void add(const WeightStatistics& other);
+
+        uint64_t num_unobserved() const { return num_voxels - num_observed; }
+        double mean_weight() const { return num_observed > 0 ? (double) weight_sum / num_observed : 0; }
+
+        uint64_t num_voxels;
+        // voxels with a positive weight
+        uint64_t num_observed;
+        uint64_t weight_sum;
+        // bin 0 holds weights up to 0, bin i > 0 the weights in [2^(i-1), 2^i)
+        uint64_t weight_histogram[NUM_WEIGHT_BINS];
+        // distances of the observed voxels, NUM_DISTANCE_BINS equal bins over [-1, 1]
+        uint64_t distance_histogram[NUM_DISTANCE_BINS];
+    };
+
+    /** statistics of the whole volume, computed in parallel */
+    WeightStatistics compute_statistics(const tsdf_converter::TsdfVolumeView& tsdf);
+
+    /** Statistics of a volume that changes between calls. They are kept for each block of the volume, and only the
+        blocks that changed are counted again if the caller knows which ones did. */
+    class IncrementalStatistics
+    {
+    public:
+        static const int BLOCK_SIZE = 16;
+
+        IncrementalStatistics();
+
+        /** changed_blocks holds a flag for each block of BLOCK_SIZE voxels (x fastest, z slowest) that is set if the
+            block changed since the last call, as cpu_tsdf::TsdfVolume::takeChangedBlocks reports them. Without it,
+            or after the geometry changed, every block is counted again. */
+        const WeightStatistics& update(const tsdf_converter::TsdfVolumeView& tsdf, const std::vector<char>* changed_blocks = NULL);
+
+        /** forget everything, e.g. after the volume was reset */
+        void clear();
+
+        const WeightStatistics& statistics() const { return total; }
+
+        /** number of blocks counted by the last update */
+        int num_blocks_updated() const { return num_blocks_updated_; }
+
+    private:
+        std::vector<WeightStatistics> blocks;
+        Eigen::Vector3i num_blocks;
+        tsdf_converter::VolumeGeometry geometry;
+        WeightStatistics total;
+        int num_blocks_updated_;
+    };
+
+}
+
+#endif // TSDF_STATISTICS_H_INCLUDED
@@ -1,50 +1,67 @@
 #include <pcl/point_cloud.h>
 #include <pcl/point_types.h>
 
+#include <pcl/common/io.h>
 #include <pcl/io/pcd_io.h>
-#include <pcl/features/normal_3d.h>
+#include <pcl_utils/boundary_estimation.h>
+#include <pcl_utils/cloud_writer.h>
 
 using namespace std;
 
+// writes the points of a cloud with their normals and boundary flags, for a single file or every cloud in a directory
 int main(int argc, char** argv) {
-  string infile = argv[1];
-  string outfile = argv[2];
-  if (argc > 3) {
-    string outplyfile = argv[3];
-  }
-  
-  pcl::PointCloud<pcl::PointXYZ>::Ptr input_xyz_cloud (new pcl::PointCloud<pcl::PointXYZ>);
-  pcl::PointCloud<pcl::Normal>::Ptr computed_normal_cloud (new pcl::PointCloud<pcl::Normal>);
-  pcl::PointCloud<pcl::PointNormal> combined_cloud;
-  
-  if (pcl::io::loadPCDFile<pcl::PointXYZ>(infile, *input_xyz_cloud) == -1) {
-    cout << "Could not find input file." << endl;
-    exit(1);
+  if (argc < 3) {
+    cerr << "usage: boundary_detection input_file_or_directory output_file_or_directory" << endl;
+    return 1;
   }
 
-  cout << "loaded file" << endl;
-  
-  pcl::NormalEstimation<pcl::PointXYZ, pcl::Normal> estimator;
-  estimator.setInputCloud(input_xyz_cloud);
-  
-  // setup the search tree for normal estimation
-  pcl::search::KdTree<pcl::PointXYZ>::Ptr tree (new pcl::search::KdTree<pcl::PointXYZ> ());
-  estimator.setSearchMethod(tree);
-  // specify the search radius
-  estimator.setRadiusSearch(0.03);
-  // calculate normals
+  vector<string> infiles, outfiles;
+  if (!boundary_estimation::list_files(argv[1], argv[2], &infiles, &outfiles)) {
+    return 1;
+  }
 
-  cout << "about to compute normals" << endl;
-  estimator.compute(*computed_normal_cloud);
-  cout << "normals computed, about to merge clouds" << endl;
+  boundary_estimation::Parameters parameters;
+  int num_files = infiles.size();
+  int failed = 0;
 
-  // merge the pointclouds
-  pcl::concatenateFields(*input_xyz_cloud, *computed_normal_cloud, combined_cloud);
+  // a file at a time uses all threads for its normals and boundaries; several files are processed side by side
+  #ifdef _OPENMP
+  #pragma omp parallel for schedule(dynamic, 1) if (num_files > 1)
+  #endif
+  for (int i = 0; i < num_files; i++) {
+    pcl::PointCloud<pcl::PointXYZ>::Ptr input_xyz_cloud (new pcl::PointCloud<pcl::PointXYZ>);
+    if (pcl::io::loadPCDFile<pcl::PointXYZ>(infiles[i], *input_xyz_cloud) == -1) {
+      cout << "Could not read " << infiles[i] << endl;
+      #ifdef _OPENMP
+      #pragma omp atomic
+      #endif
+      failed++;
+      continue;
+    }
 
-  cout << "clouds merged, saving" << endl;
+    pcl::PointCloud<pcl::Normal> normals;
+    pcl::PointCloud<pcl::Boundary> boundaries;
+    boundary_estimation::compute_normals(input_xyz_cloud, parameters, &normals);
+    boundary_estimation::compute_boundaries(input_xyz_cloud, normals, parameters, &boundaries);
 
-  pcl::io::savePCDFileASCII(outfile, combined_cloud);
+    // merge the pointclouds
+    pcl::PointCloud<pcl::PointNormal> combined_cloud;
+    pcl::concatenateFields(*input_xyz_cloud, normals, combined_cloud);
+    pcl::PCLPointCloud2 combined_blob, boundary_blob, output_blob;
+    pcl::toPCLPointCloud2(combined_cloud, combined_blob);
+    pcl::toPCLPointCloud2(boundaries, boundary_blob);
+    pcl::concatenateFields(combined_blob, boundary_blob, output_blob);
 
-  // TODO: write ply file?
+    if (!cloud_writer::save(outfiles[i], output_blob)) {
+      #ifdef _OPENMP
+      #pragma omp atomic
+      #endif
+      failed++;
+      continue;
+    }
+    cout << infiles[i] << " -> " << outfiles[i] << endl;
+  }
 
+  cout << "done, " << failed << " of " << num_files << " files failed" << endl;
+  return failed > 0 ? 1 : 0;
 }
@@ -0,0 +1,132 @@
+#include <pcl_utils/boundary_estimation.h>
+
+#include <pcl/features/boundary.h>
+#include <pcl/features/normal_3d_omp.h>
+#include <pcl/search/kdtree.h>
+#include <pcl/search/organized.h>
+
+#include <boost/filesystem.hpp>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include <algorithm>
+#include <iostream>
+
+namespace boundary_estimation {
+
+namespace {
+    pcl::search::Search<pcl::PointXYZ>::Ptr make_search(pcl::PointCloud<pcl::PointXYZ>::ConstPtr cloud) {
+        pcl::search::Search<pcl::PointXYZ>::Ptr search;
+        if (cloud->isOrganized()) {
+            search.reset(new pcl::search::OrganizedNeighbor<pcl::PointXYZ>());
+        } else {
+            search.reset(new pcl::search::KdTree<pcl::PointXYZ>());
+        }
+        return search;
+    }
+
+    int num_threads() {
+        #ifdef _OPENMP
+        return omp_get_max_threads();
+        #else
+        return 1;
+        #endif
+    }
+}
+
+void compute_normals(pcl::PointCloud<pcl::PointXYZ>::ConstPtr cloud, const Parameters& parameters, pcl::PointCloud<pcl::Normal>* normals) {
+    pcl::NormalEstimationOMP<pcl::PointXYZ, pcl::Normal> estimator(num_threads());
+    estimator.setInputCloud(cloud);
+    estimator.setSearchMethod(make_search(cloud));
+    estimator.setRadiusSearch(parameters.normal_radius);
+    estimator.compute(*normals);
+}
+
+void compute_boundaries(pcl::PointCloud<pcl::PointXYZ>::ConstPtr cloud, const pcl::PointCloud<pcl::Normal>& normals, const Parameters& parameters,
+                        pcl::PointCloud<pcl::Boundary>* boundaries) {
+    pcl::search::Search<pcl::PointXYZ>::Ptr search = make_search(cloud);
+    search->setInputCloud(cloud);
+
+    int num_points = cloud->points.size();
+    boundaries->points.resize(num_points);
+    boundaries->header = cloud->header;
+    boundaries->width = cloud->width;
+    boundaries->height = cloud->height;
+    boundaries->is_dense = true;
+
+    #ifdef _OPENMP
+    #pragma omp parallel
+    #endif
+    {
+        // the estimator only provides the test, so each thread has its own
+        pcl::BoundaryEstimation<pcl::PointXYZ, pcl::Normal, pcl::Boundary> estimator;
+        std::vector<int> neighbours;
+        std::vector<float> distances;
+        Eigen::Vector4f u = Eigen::Vector4f::Zero(), v = Eigen::Vector4f::Zero();
+
+        #ifdef _OPENMP
+        #pragma omp for schedule(dynamic, 256)
+        #endif
+        for (int i = 0; i < num_points; i++) {
+            const pcl::PointXYZ& point = cloud->points[i];
+            const pcl::Normal& normal = normals.points[i];
+            boundaries->points[i].boundary_point = 0;
+            if (!pcl::isFinite(point) || !pcl_isfinite(normal.normal_x) || !pcl_isfinite(normal.normal_y) || !pcl_isfinite(normal.normal_z)) {
+                continue;
+            }
+            if (search->radiusSearch(point, parameters.boundary_radius, neighbours, distances) == 0) {
+                continue;
+            }
+            estimator.getCoordinateSystemOnPlane(normal, u, v);
+            boundaries->points[i].boundary_point = estimator.isBoundaryPoint(*cloud, point, neighbours, u, v, parameters.angle_threshold);
+        }
+    }
+}
+
+void extract_boundary_points(const pcl::PointCloud<pcl::PointXYZ>& cloud, const pcl::PointCloud<pcl::Boundary>& boundaries,
+                             pcl::PointCloud<pcl::PointXYZ>* boundary_points) {
+    boundary_points->clear();
+    for (size_t i = 0; i < cloud.points.size() && i < boundaries.points.size(); i++) {
+        if (boundaries.points[i].boundary_point) {
+            boundary_points->push_back(cloud.points[i]);
+        }
+    }
+}
+
+bool list_files(const std::string& input, const std::string& output, std::vector<std::string>* inputs, std::vector<std::string>* outputs) {
+    namespace fs = boost::filesystem;
+    inputs->clear();
+    outputs->clear();
+
+    if (!fs::is_directory(input)) {
+        if (fs::is_directory(output)) {
+            std::cerr << output << " is a directory, but " << input << " is not" << std::endl;
+            return false;
+        }
+        inputs->push_back(input);
+        outputs->push_back(output);
+        return true;
+    }
+
+    for (fs::directory_iterator it(input); it != fs::directory_iterator(); ++it) {
+        if (fs::is_regular_file(it->status()) && it->path().extension() == ".pcd") {
+            inputs->push_back(it->path().string());
+        }
+    }
+    std::sort(inputs->begin(), inputs->end());
+
+    boost::system::error_code error;
+    fs::create_directories(output, error);
+    if (!fs::is_directory(output)) {
+        std::cerr << "could not create the output directory " << output << std::endl;
+        return false;
+    }
+    for (size_t i = 0; i < inputs->size(); i++) {
+        outputs->push_back((fs::path(output) / fs::path((*inputs)[i]).filename()).string());
+    }
+    return true;
+}
+
+}
@@ -0,0 +1,101 @@
+#include <pcl_utils/bounding_box.h>
+
+#include <algorithm>
+#include <limits>
+
+namespace bounding_box {
+
+Moments::Moments()
+    : count(0), mean(Eigen::Vector3d::Zero()), scatter(Eigen::Matrix3d::Zero()) {}
+
+void Moments::add(const Eigen::Vector3d& point) {
+    count++;
+    Eigen::Vector3d delta = point - mean;
+    mean += delta / count;
+    scatter += delta * (point - mean).transpose();
+}
+
+void Moments::merge(const Moments& other) {
+    if (other.count == 0) {
+        return;
+    }
+    size_t total = count + other.count;
+    Eigen::Vector3d delta = other.mean - mean;
+    mean += delta * ((double) other.count / total);
+    scatter += other.scatter + delta * delta.transpose() * ((double) count * other.count / total);
+    count = total;
+}
+
+Eigen::Matrix3d Moments::covariance() const {
+    return scatter / (double) std::max<size_t>(count, 1);
+}
+
+Eigen::Matrix3d Moments::sample_covariance() const {
+    return scatter / (double) (count > 1 ? count - 1 : 1);
+}
+
+bool compute_axes(const Moments& moments, OrientedBoundingBox* box) {
+    if (moments.count == 0) {
+        return false;
+    }
+
+    // eigenvalues come out in increasing order
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver;
+    solver.computeDirect(moments.sample_covariance());
+    box->major_value = solver.eigenvalues()(2);
+    box->middle_value = solver.eigenvalues()(1);
+    box->minor_value = solver.eigenvalues()(0);
+    box->major_vector = solver.eigenvectors().col(2).cast<float>().normalized();
+    box->middle_vector = solver.eigenvectors().col(1).cast<float>().normalized();
+    box->minor_vector = solver.eigenvectors().col(0).cast<float>().normalized();
+    if (box->major_vector.dot(box->middle_vector.cross(box->minor_vector)) <= 0) {
+        box->major_vector = -box->major_vector;
+    }
+    box->rotational_matrix.col(0) = box->major_vector;
+    box->rotational_matrix.col(1) = box->middle_vector;
+    box->rotational_matrix.col(2) = box->minor_vector;
+    box->mass_center = moments.mean.cast<float>();
+    return true;
+}
+
+bool compute_obb(const pcl::PointCloud<pcl::PointXYZ>& cloud, OrientedBoundingBox* box) {
+    size_t num_points = cloud.points.size();
+    Moments moments;
+    for (size_t i = 0; i < num_points; i++) {
+        const pcl::PointXYZ& point = cloud.points[i];
+        moments.add(Eigen::Vector3d(point.x, point.y, point.z));
+    }
+    if (!compute_axes(moments, box)) {
+        return false;
+    }
+
+    // extents along the axes in a second pass
+    Eigen::Vector3f min_point = Eigen::Vector3f::Constant(std::numeric_limits<float>::max());
+    Eigen::Vector3f max_point = Eigen::Vector3f::Constant(-std::numeric_limits<float>::max());
+    Eigen::Matrix3f to_box = box->rotational_matrix.transpose();
+    for (size_t i = 0; i < num_points; i++) {
+        const pcl::PointXYZ& point = cloud.points[i];
+        Eigen::Vector3f p = to_box * (Eigen::Vector3f(point.x, point.y, point.z) - box->mass_center);
+        min_point = min_point.cwiseMin(p);
+        max_point = max_point.cwiseMax(p);
+    }
+
+    // center the box on its position
+    Eigen::Vector3f center = (min_point + max_point) / 2;
+    min_point -= center;
+    max_point -= center;
+    Eigen::Vector3f position = box->mass_center + box->rotational_matrix * center;
+
+    box->min_point.x = min_point(0);
+    box->min_point.y = min_point(1);
+    box->min_point.z = min_point(2);
+    box->max_point.x = max_point(0);
+    box->max_point.y = max_point(1);
+    box->max_point.z = max_point(2);
+    box->position.x = position(0);
+    box->position.y = position(1);
+    box->position.z = position(2);
+    return true;
+}
+
+}
@@ -0,0 +1,149 @@
+#include <pcl_utils/cloud_crop.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace cloud_crop {
+
+namespace {
+    const int CHUNK_SIZE = 4096;
+
+    // the crop as plain floats, so the loops below hold no Eigen temporaries and vectorize
+    struct Kernel {
+        bool use_box;
+        float box_min[3], box_max[3];
+        PlaneTest plane_test;
+        float plane[4];
+        float plane_distance;
+        float rotation[3][3];
+        float translation[3];
+
+        Kernel(const Crop& crop) : use_box(crop.use_box), plane_test(crop.plane_test), plane_distance(crop.plane_distance) {
+            for (int i = 0; i < 3; i++) {
+                box_min[i] = crop.box_min(i);
+                box_max[i] = crop.box_max(i);
+                translation[i] = crop.transform.translation()(i);
+                for (int j = 0; j < 3; j++) {
+                    rotation[i][j] = crop.transform.linear()(i, j);
+                }
+            }
+            for (int i = 0; i < 4; i++) {
+                plane[i] = crop.plane(i);
+            }
+        }
+
+        // one byte per point, without branching on the point
+        void mask(const pcl::PointXYZ* points, int num_points, unsigned char* keep) const {
+            for (int i = 0; i < num_points; i++) {
+                float x = points[i].x, y = points[i].y, z = points[i].z;
+                bool inside = true;
+                if (use_box) {
+                    inside = (x >= box_min[0]) & (x <= box_max[0]) & (y >= box_min[1]) & (y <= box_max[1]) &
+                             (z >= box_min[2]) & (z <= box_max[2]);
+                }
+                float distance = plane[0] * x + plane[1] * y + plane[2] * z + plane[3];
+                if (plane_test == ABOVE_PLANE) {
+                    inside = inside & (distance >= plane_distance);
+                } else if (plane_test == NEAR_PLANE) {
+                    inside = inside & (std::fabs(distance) <= plane_distance);
+                }
+                keep[i] = inside;
+            }
+        }
+
+        pcl::PointXYZ apply(const pcl::PointXYZ& p) const {
+            pcl::PointXYZ result;
+            result.x = rotation[0][0] * p.x + rotation[0][1] * p.y + rotation[0][2] * p.z + translation[0];
+            result.y = rotation[1][0] * p.x + rotation[1][1] * p.y + rotation[1][2] * p.z + translation[1];
+            result.z = rotation[2][0] * p.x + rotation[2][1] * p.y + rotation[2][2] * p.z + translation[2];
+            return result;
+        }
+    };
+
+    // the kept points of each chunk go to the offset the chunks before it leave, so the output keeps the input order
+    void run(const pcl::PointCloud<pcl::PointXYZ>& cloud, const Crop& crop, std::vector<int>* indices, pcl::PointCloud<pcl::PointXYZ>* points) {
+        Kernel kernel(crop);
+        int num_points = (int) cloud.points.size();
+        int num_chunks = (num_points + CHUNK_SIZE - 1) / CHUNK_SIZE;
+        std::vector<unsigned char> keep(num_points);
+        std::vector<int> offsets(num_chunks + 1, 0);
+
+        #ifdef _OPENMP
+        #pragma omp parallel for schedule(static)
+        #endif
+        for (int chunk = 0; chunk < num_chunks; chunk++) {
+            int begin = chunk * CHUNK_SIZE;
+            int end = std::min(num_points, begin + CHUNK_SIZE);
+            kernel.mask(&cloud.points[begin], end - begin, &keep[begin]);
+            int count = 0;
+            for (int i = begin; i < end; i++) {
+                count += keep[i];
+            }
+            offsets[chunk + 1] = count;
+        }
+        for (int chunk = 0; chunk < num_chunks; chunk++) {
+            offsets[chunk + 1] += offsets[chunk];
+        }
+
+        if (indices) {
+            indices->resize(offsets[num_chunks]);
+        }
+        if (points) {
+            points->points.resize(offsets[num_chunks]);
+        }
+
+        #ifdef _OPENMP
+        #pragma omp parallel for schedule(static)
+        #endif
+        for (int chunk = 0; chunk < num_chunks; chunk++) {
+            int begin = chunk * CHUNK_SIZE;
+            int end = std::min(num_points, begin + CHUNK_SIZE);
+            int out = offsets[chunk];
+            for (int i = begin; i < end; i++) {
+                if (!keep[i]) {
+                    continue;
+                }
+                if (indices) {
+                    (*indices)[out] = i;
+                }
+                if (points) {
+                    points->points[out] = kernel.apply(cloud.points[i]);
+                }
+                out++;
+            }
+        }
+    }
+}
+
+Crop::Crop()
+    : transform(Eigen::Affine3f::Identity()), use_box(false), box_min(Eigen::Vector3f::Zero()), box_max(Eigen::Vector3f::Zero()),
+      plane_test(NO_PLANE), plane(Eigen::Vector4f::Zero()), plane_distance(0) {}
+
+void Crop::set_box(const Eigen::Vector3f& min, const Eigen::Vector3f& max) {
+    use_box = true;
+    box_min = min;
+    box_max = max;
+}
+
+void Crop::set_plane(PlaneTest test, const Eigen::Vector4f& coefficients, float distance) {
+    plane_test = test;
+    plane = coefficients;
+    plane_distance = distance;
+}
+
+void crop_indices(const pcl::PointCloud<pcl::PointXYZ>& cloud, const Crop& crop, std::vector<int>* indices) {
+    run(cloud, crop, indices, NULL);
+}
+
+void crop_points(const pcl::PointCloud<pcl::PointXYZ>& cloud, const Crop& crop, pcl::PointCloud<pcl::PointXYZ>* points) {
+    // the input may be the output
+    pcl::PointCloud<pcl::PointXYZ> result;
+    run(cloud, crop, NULL, &result);
+    result.header = cloud.header;
+    result.width = result.points.size();
+    result.height = 1;
+    result.is_dense = cloud.is_dense;
+    points->swap(result);
+}
+
+}
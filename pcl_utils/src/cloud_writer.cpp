@@ -0,0 +1,123 @@
+#include <pcl_utils/cloud_writer.h>
+
+#include <pcl/exceptions.h>
+#include <pcl/io/pcd_io.h>
+
+#include <boost/bind.hpp>
+
+#include <iostream>
+
+namespace cloud_writer {
+
+Format parse_format(const std::string& name) {
+    if (name == "ascii") {
+        return ASCII;
+    }
+    if (name == "binary_compressed") {
+        return BINARY_COMPRESSED;
+    }
+    return BINARY;
+}
+
+bool save(const std::string& file, const pcl::PCLPointCloud2& cloud, Format format) {
+    if (cloud.data.empty()) {
+        std::cout << "not writing " << file << ", the cloud is empty" << std::endl;
+        return false;
+    }
+
+    pcl::PCDWriter writer;
+    int result = -1;
+    try {
+        switch (format) {
+        case ASCII:
+            result = writer.writeASCII(file, cloud);
+            break;
+        case BINARY:
+            result = writer.writeBinary(file, cloud);
+            break;
+        case BINARY_COMPRESSED:
+            result = writer.writeBinaryCompressed(file, cloud);
+            break;
+        }
+    } catch (pcl::IOException& e) {
+        std::cout << "couldn't write " << file << ": " << e.what() << std::endl;
+        return false;
+    }
+    if (result < 0) {
+        std::cout << "couldn't write " << file << std::endl;
+        return false;
+    }
+    return true;
+}
+
+AsyncWriter::AsyncWriter(size_t max_queued)
+    : max_queued(max_queued), writing(false), stopping(false), dropped(0) {
+    thread = boost::thread(boost::bind(&AsyncWriter::run, this));
+}
+
+AsyncWriter::~AsyncWriter() {
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        stopping = true;
+    }
+    changed.notify_all();
+    thread.join();
+}
+
+bool AsyncWriter::write(const std::string& file, pcl::PCLPointCloud2::ConstPtr cloud, Format format) {
+    boost::mutex::scoped_lock lock(mutex);
+    if (queue.size() >= max_queued) {
+        dropped++;
+        std::cout << "cloud writer queue is full, dropping " << file << std::endl;
+        return false;
+    }
+    Job job;
+    job.file = file;
+    job.cloud = cloud;
+    job.format = format;
+    queue.push_back(job);
+    changed.notify_all();
+    return true;
+}
+
+void AsyncWriter::flush() {
+    boost::mutex::scoped_lock lock(mutex);
+    while (!queue.empty() || writing) {
+        changed.wait(lock);
+    }
+}
+
+int AsyncWriter::num_dropped() const {
+    boost::mutex::scoped_lock lock(mutex);
+    return dropped;
+}
+
+void AsyncWriter::run() {
+    boost::mutex::scoped_lock lock(mutex);
+    while (true) {
+        while (queue.empty() && !stopping) {
+            changed.wait(lock);
+        }
+        if (queue.empty()) {
+            // stopping, with everything written
+            return;
+        }
+
+        Job job = queue.front();
+        queue.pop_front();
+        writing = true;
+        lock.unlock();
+        save(job.file, *job.cloud, job.format);
+        lock.lock();
+        writing = false;
+        changed.notify_all();
+    }
+}
+
+AsyncWriter& shared_writer() {
+    // room for the clusters and occluded regions of a few requests
+    static AsyncWriter writer(64);
+    return writer;
+}
+
+}
@@ -5,31 +5,187 @@
 
 #include <pcl_conversions/pcl_conversions.h>
 
+#include <algorithm>
+#include <stdint.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 namespace cluster_extraction {
 
-int extract_clusters(pcl::PointCloud<pcl::PointXYZ>::Ptr cloud, std::vector<pcl::PointCloud<pcl::PointXYZ> >* cloud_vector, ros::Publisher plane_points_pub) {
+// 21 bits per axis, so neighboring cells differ by 1 in each field
+static inline uint64_t cell_key(int x, int y, int z) {
+    return ((uint64_t) (x & 0x1fffff) << 42) | ((uint64_t) (y & 0x1fffff) << 21) | (uint64_t) (z & 0x1fffff);
+}
+
+static inline int find_root(std::vector<int>& parent, int i) {
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
 
+static inline void unite(std::vector<int>& parent, int a, int b) {
+    a = find_root(parent, a);
+    b = find_root(parent, b);
+    if (a != b) {
+        // the smaller index becomes the root, so roots stay inside the slab of both cells
+        parent[std::max(a, b)] = std::min(a, b);
+    }
+}
+
+static bool larger_cluster(const pcl::PointIndices& a, const pcl::PointIndices& b) {
+    return a.indices.size() > b.indices.size();
+}
+
+void grid_connected_components(const pcl::PointCloud<pcl::PointXYZ>& cloud, float cell_size, int min_cluster_size, int max_cluster_size, std::vector<pcl::PointIndices>* clusters) {
+    clusters->clear();
+    if (cloud.points.empty()) {
+        return;
+    }
+
+    // sort the points by cell, x slowest, so every x slab of cells is a contiguous range
+    std::vector<std::pair<uint64_t, int> > keys(cloud.points.size());
+    for (size_t i = 0; i < cloud.points.size(); i++) {
+        const pcl::PointXYZ& point = cloud.points[i];
+        keys[i] = std::make_pair(cell_key((int) floor(point.x / cell_size) + (1 << 20), (int) floor(point.y / cell_size) + (1 << 20),
+                                          (int) floor(point.z / cell_size) + (1 << 20)), (int) i);
+    }
+    std::sort(keys.begin(), keys.end());
 
-    float leaf_size, cluster_tolerance, plane_distance_threshold;
+    std::vector<uint64_t> cells;
+    std::vector<int> cell_start;
+    for (size_t i = 0; i < keys.size(); i++) {
+        if (i == 0 || keys[i].first != keys[i - 1].first) {
+            cells.push_back(keys[i].first);
+            cell_start.push_back(i);
+        }
+    }
+    cell_start.push_back(keys.size());
+    int num_cells = cells.size();
+
+    // split the cells into slabs along x, each slab starting at a new x
+    int num_slabs = 1;
+    #ifdef _OPENMP
+    num_slabs = 4 * omp_get_max_threads();
+    #endif
+    std::vector<int> slab_start;
+    for (int s = 0; s < num_slabs; s++) {
+        int start = (int) ((size_t) num_cells * s / num_slabs);
+        while (start > 0 && start < num_cells && (cells[start] >> 42) == (cells[start - 1] >> 42)) {
+            start++;
+        }
+        if (slab_start.empty() || start > slab_start.back()) {
+            slab_start.push_back(start);
+        }
+    }
+    if (slab_start.back() != num_cells) {
+        slab_start.push_back(num_cells);
+    }
+    num_slabs = slab_start.size() - 1;
+
+    // join each cell with the neighbors that come after it; joins within a slab run in parallel, the ones across
+    // slabs are merged afterwards
+    std::vector<int> parent(num_cells);
+    for (int i = 0; i < num_cells; i++) {
+        parent[i] = i;
+    }
+    std::vector<std::vector<std::pair<int, int> > > crossing(num_slabs);
+
+    #ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic, 1)
+    #endif
+    for (int s = 0; s < num_slabs; s++) {
+        for (int i = slab_start[s]; i < slab_start[s + 1]; i++) {
+            int x = (int) (cells[i] >> 42), y = (int) ((cells[i] >> 21) & 0x1fffff), z = (int) (cells[i] & 0x1fffff);
+            for (int dx = 0; dx <= 1; dx++) {
+                for (int dy = -1; dy <= 1; dy++) {
+                    for (int dz = -1; dz <= 1; dz++) {
+                        if (dx == 0 && (dy < 0 || (dy == 0 && dz <= 0))) {
+                            continue;
+                        }
+                        uint64_t neighbor_key = cell_key(x + dx, y + dy, z + dz);
+                        std::vector<uint64_t>::const_iterator found = std::lower_bound(cells.begin(), cells.end(), neighbor_key);
+                        if (found == cells.end() || *found != neighbor_key) {
+                            continue;
+                        }
+                        int neighbor = found - cells.begin();
+                        if (neighbor < slab_start[s + 1]) {
+                            unite(parent, i, neighbor);
+                        } else {
+                            crossing[s].push_back(std::make_pair(i, neighbor));
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    for (int s = 0; s < num_slabs; s++) {
+        for (size_t k = 0; k < crossing[s].size(); k++) {
+            unite(parent, crossing[s][k].first, crossing[s][k].second);
+        }
+    }
+
+    // gather the points of each component, in point order
+    std::vector<int> component(num_cells, -1);
+    std::vector<int> component_size;
+    for (int i = 0; i < num_cells; i++) {
+        int root = find_root(parent, i);
+        if (component[root] < 0) {
+            component[root] = component_size.size();
+            component_size.push_back(0);
+        }
+        component[i] = component[root];
+        component_size[component[i]] += cell_start[i + 1] - cell_start[i];
+    }
+
+    std::vector<int> cluster_of_component(component_size.size(), -1);
+    for (size_t c = 0; c < component_size.size(); c++) {
+        if (component_size[c] >= min_cluster_size && component_size[c] <= max_cluster_size) {
+            cluster_of_component[c] = clusters->size();
+            clusters->push_back(pcl::PointIndices());
+            clusters->back().indices.reserve(component_size[c]);
+        }
+    }
+
+    std::vector<int> cluster_of_point(cloud.points.size(), -1);
+    for (int i = 0; i < num_cells; i++) {
+        for (int k = cell_start[i]; k < cell_start[i + 1]; k++) {
+            cluster_of_point[keys[k].second] = cluster_of_component[component[i]];
+        }
+    }
+    for (size_t i = 0; i < cloud.points.size(); i++) {
+        if (cluster_of_point[i] >= 0) {
+            (*clusters)[cluster_of_point[i]].indices.push_back(i);
+        }
+    }
+
+    // largest first, like pcl::EuclideanClusterExtraction
+    std::stable_sort(clusters->begin(), clusters->end(), larger_cluster);
+}
+
+int extract_clusters(const scene_segmentation::Scene& scene, std::vector<pcl::PointCloud<pcl::PointXYZ> >* cloud_vector, ros::Publisher plane_points_pub) {
+
+
+    float cluster_tolerance, plane_distance_threshold;
     int min_cluster_size, max_cluster_size, min_planar_cluster_size;
-    ros::param::param<float>("/occlusion_parameters/cluster_extraction_leaf_size", leaf_size, 0.01f);
     ros::param::param<float>("/occlusion_parameters/cluster_tolerance", cluster_tolerance, 0.01f);
     ros::param::param<int>("/occlusion_parameters/min_cluster_size", min_cluster_size, 100);
     ros::param::param<int>("/occlusion_parameters/max_cluster_size", max_cluster_size, 25000);
     ros::param::param<float>("/occlusion_parameters/plane_cluster_distance_threshold", plane_distance_threshold, 0.02f);
     ros::param::param<int>("/occlusion_parameters/min_planar_cluster_size", min_planar_cluster_size, 500);
+    bool grid_clustering;
+    ros::param::param<bool>("/occlusion_parameters/grid_clustering", grid_clustering, false);
+    // neighbouring points of the downsampled scene are a leaf apart, so a smaller tolerance would split every cluster
+    cluster_tolerance = std::max(cluster_tolerance, scene.leaf_size);
 
     pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_f (new pcl::PointCloud<pcl::PointXYZ>);
 
-//    std::cout << "PointCloud before filtering has: " << cloud->points.size () << " data points." << std::endl; //*
-
-    // Create the filtering object: downsample the dataset using a leaf size of 1cm
-    pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_filtered (new pcl::PointCloud<pcl::PointXYZ>);
-    pcl::VoxelGrid<pcl::PointXYZ> vg;
-    vg.setInputCloud (cloud);
-    vg.setLeafSize (leaf_size, leaf_size, leaf_size);
-    vg.filter (*cloud_filtered);
-//    std::cout << "PointCloud after filtering has: " << cloud_filtered->points.size ()  << " data points." << std::endl; //*
+    // the scene is already downsampled
+    pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_filtered (new pcl::PointCloud<pcl::PointXYZ> (*scene.downsampled));
 
     // Create the segmentation object for the planar model and set all the parameters
     pcl::SACSegmentation<pcl::PointXYZ> seg;
@@ -43,7 +199,17 @@ int extract_clusters(pcl::PointCloud<pcl::PointXYZ>::Ptr cloud, std::vector<pcl:
     seg.setDistanceThreshold (plane_distance_threshold);
 
     int i=0, nr_points = (int) cloud_filtered->points.size ();
-    while (cloud_filtered->points.size () > 0.3 * nr_points)
+
+    // the largest plane is the table, which segment_scene already found
+    bool table_removed = false;
+    if (nr_points > 0 && scene.table_coefficients->values.size () == 4 && scene.num_table_points >= min_planar_cluster_size)
+    {
+        *cloud_filtered = *scene.remaining;
+        table_removed = true;
+        i++;
+    }
+
+    while (table_removed && cloud_filtered->points.size () > 0.3 * nr_points)
     {
         // Segment the largest planar component from the remaining cloud
         seg.setInputCloud (cloud_filtered);
@@ -96,18 +262,25 @@ int extract_clusters(pcl::PointCloud<pcl::PointXYZ>::Ptr cloud, std::vector<pcl:
     }
 
 
-    // Creating the KdTree object for the search method of the extraction
-    pcl::search::KdTree<pcl::PointXYZ>::Ptr tree (new pcl::search::KdTree<pcl::PointXYZ>);
-    tree->setInputCloud (cloud_filtered);
-
     std::vector<pcl::PointIndices> cluster_indices;
-    pcl::EuclideanClusterExtraction<pcl::PointXYZ> ec;
-    ec.setClusterTolerance (cluster_tolerance);
-    ec.setMinClusterSize (min_cluster_size);
-    ec.setMaxClusterSize (max_cluster_size);
-    ec.setSearchMethod (tree);
-    ec.setInputCloud (cloud_filtered);
-    ec.extract (cluster_indices);
+    if (grid_clustering)
+    {
+        grid_connected_components(*cloud_filtered, cluster_tolerance, min_cluster_size, max_cluster_size, &cluster_indices);
+    }
+    else
+    {
+        // Creating the KdTree object for the search method of the extraction
+        pcl::search::KdTree<pcl::PointXYZ>::Ptr tree (new pcl::search::KdTree<pcl::PointXYZ>);
+        tree->setInputCloud (cloud_filtered);
+
+        pcl::EuclideanClusterExtraction<pcl::PointXYZ> ec;
+        ec.setClusterTolerance (cluster_tolerance);
+        ec.setMinClusterSize (min_cluster_size);
+        ec.setMaxClusterSize (max_cluster_size);
+        ec.setSearchMethod (tree);
+        ec.setInputCloud (cloud_filtered);
+        ec.extract (cluster_indices);
+    }
 
     //pcl::PCDWriter writer;
     //int j = 0;
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <fstream>
 
 #include <pcl/point_cloud.h>
@@ -8,26 +9,145 @@
 #include <pcl/io/ply_io.h>
 
 #include <Eigen/Eigen>
+#include <stdint.h>
 
 #include <pcl_utils/pointcloud_voxel_grid.h>
 #include <pcl_utils/plane_recognition.h>
 #include <pcl_utils/timer.h>
 #include <pcl_utils/cluster_projection.h>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 namespace cluster_projection
 {
 
-pcl::PointCloud<pcl::PointXYZ> calculate_occluded(pcl::PointCloud<pcl::PointXYZ> cluster, pcl::PointCloud<pcl::PointXYZ>::Ptr inverse, pcl::PointCloud<pcl::PointXYZ>::Ptr plane_cloud,
-        Eigen::Matrix4d transformation_matrix, pcl::PointCloud<pcl::PointXYZ>::Ptr transformed_inverse,
-        pcl::PointCloud<pcl::PointXYZ>::Ptr projected_inverse, pcl::ModelCoefficients::Ptr plane_coeff,
+OccludedSpaceIndex::OccludedSpaceIndex(pcl::PointCloud<pcl::PointXYZ>::Ptr inverse, Eigen::Matrix4d transformation_matrix, float block_size)
+    : inverse(inverse)
+{
+    pcl::PointCloud<pcl::PointXYZ> transformed_inverse;
+    pcl::transformPointCloud(*inverse, transformed_inverse, transformation_matrix);
+
+    // sort the points by block, keeping the original order within a block
+    std::vector<std::pair<uint64_t, int> > keys(transformed_inverse.size());
+    for (size_t i = 0; i < transformed_inverse.size(); i++)
+    {
+        const pcl::PointXYZ& point = transformed_inverse.points[i];
+        uint64_t x = (uint64_t) (floor(point.x / block_size) + (1 << 20)) & 0x1fffff;
+        uint64_t y = (uint64_t) (floor(point.y / block_size) + (1 << 20)) & 0x1fffff;
+        uint64_t z = (uint64_t) (floor(point.z / block_size) + (1 << 20)) & 0x1fffff;
+        keys[i] = std::make_pair((x << 42) | (y << 21) | z, (int) i);
+    }
+    std::sort(keys.begin(), keys.end());
+
+    indices.resize(keys.size());
+    transformed.resize(keys.size());
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+        indices[i] = keys[i].second;
+        transformed.points[i] = transformed_inverse.points[keys[i].second];
+
+        if (i == 0 || keys[i].first != keys[i - 1].first)
+        {
+            Block block;
+            block.min = block.max = transformed.points[i].getVector3fMap();
+            block.original_min = block.original_max = inverse->points[indices[i]].getVector3fMap();
+            block.begin = i;
+            blocks.push_back(block);
+        }
+
+        Block& block = blocks.back();
+        block.min = block.min.cwiseMin(transformed.points[i].getVector3fMap());
+        block.max = block.max.cwiseMax(transformed.points[i].getVector3fMap());
+        block.original_min = block.original_min.cwiseMin(inverse->points[indices[i]].getVector3fMap());
+        block.original_max = block.original_max.cwiseMax(inverse->points[indices[i]].getVector3fMap());
+        block.end = i + 1;
+    }
+}
+
+// range of normal.p + offset over an axis aligned box
+static void box_range(const Eigen::Vector3f& normal, float offset, const Eigen::Vector3f& min, const Eigen::Vector3f& max, float* low, float* high)
+{
+    Eigen::Vector3f center = (min + max) / 2;
+    Eigen::Vector3f half_extent = (max - min) / 2;
+    float middle = normal.dot(center) + offset;
+    float radius = normal.cwiseAbs().dot(half_extent);
+    *low = middle - radius;
+    *high = middle + radius;
+}
+
+// whether no point (-1), some points (0) or all points (1) of a block satisfy the occlusion tests
+static int classify_block(const OccludedSpaceIndex::Block& block, const std::vector<Eigen::Vector3f>& normal_vectors, const std::vector<Eigen::Vector3f>& corners,
+                          const Eigen::Vector3f& plane_normal, float plane_offset, float min_squared_range)
+{
+    // tolerance so that the per-point tests decide points right on a boundary
+    const float eps = 1e-4;
+    bool inside = true;
+    float low, high;
+
+    // the sides and the back of the occlusion pyramid
+    for (int i = 0; i < 5; i++)
+    {
+        const Eigen::Vector3f& corner = (i < 4) ? corners[i] : corners[0];
+        box_range(normal_vectors[i], -normal_vectors[i].dot(corner), block.min, block.max, &low, &high);
+        if (low > eps)
+            return -1;
+        inside = inside && high <= -eps;
+    }
+
+    // above the table
+    box_range(plane_normal, plane_offset, block.original_min, block.original_max, &low, &high);
+    if (high < -eps)
+        return -1;
+    inside = inside && low >= eps;
+
+    // in front of the camera
+    if (block.max(2) <= 0)
+        return -1;
+    inside = inside && block.min(2) > eps;
+
+    // farther away than the cluster
+    Eigen::Vector3f nearest = block.min.cwiseMax(Eigen::Vector3f::Zero()).cwiseMin(block.max);
+    Eigen::Vector3f farthest = block.min.cwiseAbs().cwiseMax(block.max.cwiseAbs());
+    if (farthest.squaredNorm() < min_squared_range - eps)
+        return -1;
+    inside = inside && nearest.squaredNorm() >= min_squared_range + eps;
+
+    return inside ? 1 : 0;
+}
+
+bool OcclusionQuery::may_intersect(const Eigen::Vector3f& min, const Eigen::Vector3f& max, const Eigen::Matrix4d& transformation_matrix) const
+{
+    // bound the box in the camera frame by its transformed corners
+    OccludedSpaceIndex::Block block;
+    block.original_min = min;
+    block.original_max = max;
+    block.min = Eigen::Vector3f::Constant(INFINITY);
+    block.max = Eigen::Vector3f::Constant(-INFINITY);
+    Eigen::Affine3f transform(transformation_matrix.cast<float>());
+    for (int i = 0; i < 8; i++)
+    {
+        Eigen::Vector3f corner((i & 1) ? max(0) : min(0), (i & 2) ? max(1) : min(1), (i & 4) ? max(2) : min(2));
+        Eigen::Vector3f transformed_corner = transform * corner;
+        block.min = block.min.cwiseMin(transformed_corner);
+        block.max = block.max.cwiseMax(transformed_corner);
+    }
+    return classify_block(block, normal_vectors, corners, plane_normal, plane_offset, min_squared_range) >= 0;
+}
+
+void calculate_occluded(pcl::PointCloud<pcl::PointXYZ> cluster, const OccludedSpaceIndex& inverse_index, pcl::PointCloud<pcl::PointXYZ>::Ptr plane_cloud,
+        Eigen::Matrix4d transformation_matrix, pcl::ModelCoefficients::Ptr plane_coeff,
         int face_direction, int forward_back, pcl::PointXYZ min_point_OBB, pcl::PointXYZ max_point_OBB, Eigen::Vector3f position, Eigen::Matrix3f rotational_matrix_OBB,
-        visualization_msgs::MarkerArrayPtr markers, std::vector<Eigen::Vector3f> corners, ros::Publisher plane_pub)
+        visualization_msgs::MarkerArrayPtr markers, std::vector<Eigen::Vector3f> corners, ros::Publisher plane_pub,
+        bounding_box::Moments* moments, pcl::PointCloud<pcl::PointXYZ>* occluded_region, OcclusionQuery* query, std::ostream* log)
 {
 
 
     float table_tolerance;
     ros::param::param<float>("/occlusion_parameters/table_tolerance", table_tolerance, 0.05f);
-    std::cout << "table_tolerance: " << table_tolerance << std::endl;
+    if (log != NULL)
+        *log << "table_tolerance: " << table_tolerance << std::endl;
 
     Eigen::Vector3f min_vector(min_point_OBB.x, min_point_OBB.y, min_point_OBB.z);
     //Eigen::Vector3f min_vector_rotated = rotational_matrix_OBB * min_vector;
@@ -55,7 +175,8 @@ pcl::PointCloud<pcl::PointXYZ> calculate_occluded(pcl::PointCloud<pcl::PointXYZ>
 
     //Eigen::Affine3d affine1 = Eigen::Affine3d(transformation_matrix);
     pcl::transformPointCloud(cluster, *transformed_cluster, transformation_matrix);
-    std::cout << "\ttransforming cluster: " << Timer_toc(&timer) << std::endl;
+    if (log != NULL)
+        *log << "\ttransforming cluster: " << Timer_toc(&timer) << std::endl;
 
 
     double fx = 525., fy = 525., cx = 319.5, cy = 239.5;
@@ -71,15 +192,6 @@ pcl::PointCloud<pcl::PointXYZ> calculate_occluded(pcl::PointCloud<pcl::PointXYZ>
     Eigen::Affine3d affine_transformation = Eigen::Affine3d(P);
     pcl::transformPointCloud(*transformed_cluster, *projected_cluster, affine_transformation);
 
-    Timer_tic(&timer);
-    // only projects the inverse cloud once, as it will not vary between clusters
-    if (transformed_inverse->size() == 0)
-    {
-        pcl::transformPointCloud(*inverse, *transformed_inverse, transformation_matrix);
-        pcl::transformPointCloud(*transformed_inverse, *projected_inverse, affine_transformation);
-    }
-    std::cout << "\ttransforming inverse cloud: " << Timer_toc(&timer) << std::endl;
-
     //std::cout << "transforming and projecting: " << Timer_toc(&timer) << std::endl;
 
     // I thought combining the transformations would make things faster, but it didn't seem to help
@@ -107,8 +219,16 @@ pcl::PointCloud<pcl::PointXYZ> calculate_occluded(pcl::PointCloud<pcl::PointXYZ>
 //
 //    std::cout << "\tplane fitting: " << Timer_toc(&timer) << std::endl;
 
-    double a = plane_coeff->values[0], b = plane_coeff->values[1],
-                                           c = plane_coeff->values[2], d = plane_coeff->values[3];
+    // without a table, a plane that keeps every point: a * x + b * y + c * z + d + table_tolerance is never negative
+    double a = 0, b = 0, c = 0, d = std::max(0.0f, -table_tolerance);
+    if (plane_coeff->values.size() == 4) {
+        a = plane_coeff->values[0];
+        b = plane_coeff->values[1];
+        c = plane_coeff->values[2];
+        d = plane_coeff->values[3];
+    } else if (log != NULL) {
+        *log << "no table, the occluded region is not cut off below one" << std::endl;
+    }
 
 
     //std::cout << "plane coefficients: " << a << ", " << b << ", " << c << ", " << d << std::endl;
@@ -134,71 +254,92 @@ pcl::PointCloud<pcl::PointXYZ> calculate_occluded(pcl::PointCloud<pcl::PointXYZ>
     normal_vectors.push_back(current_normal);
 
     Timer_tic(&timer);
-    // loop through the clouds, finding the intersection of the inverse cloud and the bounding box
-    // of the projected object
-    pcl::PointCloud<pcl::PointXYZ>::iterator projected_inverse_iter;
-    pcl::PointCloud<pcl::PointXYZ>::iterator inverse_iter;
-    pcl::PointCloud<pcl::PointXYZ>::iterator transformed_inverse_iter;
-    pcl::PointCloud<pcl::PointXYZ> occluded_region;
-    //double tol = 25;
-    //std::cout << "face_direction: " << face_direction << std::endl;
-    //face_direction = 10;
-    for (projected_inverse_iter = projected_inverse->begin(), inverse_iter = inverse->begin(), transformed_inverse_iter = transformed_inverse->begin();
-            transformed_inverse_iter != transformed_inverse->end();
-            projected_inverse_iter++, inverse_iter++, transformed_inverse_iter++)
+    // find the points of the inverse cloud inside the occlusion pyramid behind the object, visiting only
+    // the blocks that intersect it
+    const pcl::PointCloud<pcl::PointXYZ>& inverse = *inverse_index.inverse;
+    Eigen::Vector3f plane_normal(a, b, c);
+    float plane_offset = d + table_tolerance;
+    double min_squared_range = std::pow(real_extremes.block<3, 1>(0,0).norm(), 2);
+    if (query != NULL)
+    {
+        query->normal_vectors = normal_vectors;
+        query->corners = corners;
+        query->plane_normal = plane_normal;
+        query->plane_offset = plane_offset;
+        query->min_squared_range = min_squared_range;
+    }
+
+    // the moments are taken of the points in the camera frame as they are classified, per block so the blocks can be
+    // classified in parallel and merged in the same order every time. Only one level is parallel: the blocks when
+    // this is called outside of a parallel region, e.g. for a single cluster, and otherwise the callers' clusters
+    // (nested parallelism is not enabled)
+    int num_blocks = inverse_index.blocks.size();
+    std::vector<bounding_box::Moments> block_moments(num_blocks);
+    std::vector<std::vector<int> > block_indices(occluded_region != NULL ? num_blocks : 0);
+    int blocks_visited = 0;
+
+    #ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic, 16) reduction(+:blocks_visited) if (!omp_in_parallel())
+    #endif
+    for (int i = 0; i < num_blocks; i++)
     {
+        const OccludedSpaceIndex::Block& block = inverse_index.blocks[i];
+        int block_class = classify_block(block, normal_vectors, corners, plane_normal, plane_offset, min_squared_range);
+        if (block_class < 0)
+            continue;
 
-        pcl::PointXYZ current_projected = *projected_inverse_iter;
-        pcl::PointXYZ current_inverse = *inverse_iter;
-        Eigen::Vector3f current_inverse_eigen(transformed_inverse_iter->x, transformed_inverse_iter->y, transformed_inverse_iter->z);
-        Eigen::Vector3f current_inverse_rotated = rotational_matrix_OBB * current_inverse_eigen;
-        if ((/*(current_projected.x / current_projected.z >= extremes(0) / extremes(2) - tol &&
-            current_projected.y / current_projected.z >= extremes(1) / extremes(2) - tol &&
-            current_projected.x / current_projected.z <= extremes(3) / extremes(5) + tol &&
-            current_projected.y / current_projected.z <= extremes(4) / extremes(5) + tol) &&*/
-
-            /*((face_direction == 0) || (major_vector_normalized.dot((current_inverse_eigen - position) - major_vector) <= 0)) &&
-            ((face_direction == 0) || (major_vector_normalized.dot(-1 * (current_inverse_eigen - position) - major_vector)) <= 0) &&
-            ((face_direction == 1) || (middle_vector_normalized.dot((current_inverse_eigen - position) - middle_vector) <= 0)) &&
-            ((face_direction == 1) || (middle_vector_normalized.dot(-1 * (current_inverse_eigen - position) - middle_vector)) <= 0) &&
-            ((face_direction == 2) || (minor_vector_normalized.dot((current_inverse_eigen - position) - minor_vector) <= 0)) &&
-            ((face_direction == 2) || (minor_vector_normalized.dot(-1 * (current_inverse_eigen - position) - minor_vector)) <= 0) &&*/
-
-            /*(((face_direction == 0 && forward_back == -1) || (major_vector_normalized.dot((current_inverse_eigen - position) - major_vector) <= 0)) &&
-            ((face_direction == 0 && forward_back == 1) || (major_vector_normalized.dot(-1 * (current_inverse_eigen - position) - major_vector)) <= 0) &&
-            ((face_direction == 1 && forward_back == -1) || (middle_vector_normalized.dot((current_inverse_eigen - position) - middle_vector) <= 0)) &&
-            ((face_direction == 1 && forward_back == 1) || (middle_vector_normalized.dot(-1 * (current_inverse_eigen - position) - middle_vector)) <= 0) &&
-            ((face_direction == 2 && forward_back == -1) || (minor_vector_normalized.dot((current_inverse_eigen - position) - minor_vector) <= 0)) &&
-            ((face_direction == 2 && forward_back == 1) || (minor_vector_normalized.dot(-1 * (current_inverse_eigen - position) - minor_vector)) <= 0))*/
-            (normal_vectors[0].dot(current_inverse_eigen - corners[0]) <= 0 &&
-             normal_vectors[1].dot(current_inverse_eigen - corners[1]) <= 0 &&
-             normal_vectors[2].dot(current_inverse_eigen - corners[2]) <= 0 &&
-             normal_vectors[3].dot(current_inverse_eigen - corners[3]) <= 0 &&
-             normal_vectors[4].dot(current_inverse_eigen - corners[0]) <= 0)
-
-             ) &&
-
-
-            a * current_inverse.x + b * current_inverse.y + c * current_inverse.z + d + table_tolerance >= 0 &&
-            transformed_inverse_iter->z > 0 &&
-            std::pow(transformed_inverse_iter->x, 2) + std::pow(transformed_inverse_iter->y, 2) + std::pow(transformed_inverse_iter->z, 2) >= std::pow(real_extremes.block<3, 1>(0,0).norm(), 2))
+        blocks_visited++;
+        for (int k = block.begin; k < block.end; k++)
         {
-            occluded_region.push_back(current_inverse);
-//            std::cout << "point" << std::endl;
-//            std::cout << (major_vector.dot((current_inverse_eigen - position) - major_vector) <= 0) << std::endl;
-//            std::cout << ((major_vector.dot(-1 * (current_inverse_eigen - position) - major_vector)) >= 0) << std::endl;
-//            std::cout << (middle_vector.dot((current_inverse_eigen - position) - middle_vector) <= 0) << std::endl;
-//            std::cout << ((middle_vector.dot(-1 * (current_inverse_eigen - position) - middle_vector)) >= 0) << std::endl;
-//            std::cout << (minor_vector.dot((current_inverse_eigen - position) - minor_vector) <= 0) << std::endl;
-//            std::cout << ((minor_vector.dot(-1 * (current_inverse_eigen - position) - minor_vector)) >= 0) << std::endl;
+            const pcl::PointXYZ& current_inverse = inverse.points[inverse_index.indices[k]];
+            const pcl::PointXYZ& current_transformed = inverse_index.transformed.points[k];
+            Eigen::Vector3f current_inverse_eigen(current_transformed.x, current_transformed.y, current_transformed.z);
+            if (block_class > 0 ||
+                ((normal_vectors[0].dot(current_inverse_eigen - corners[0]) <= 0 &&
+                  normal_vectors[1].dot(current_inverse_eigen - corners[1]) <= 0 &&
+                  normal_vectors[2].dot(current_inverse_eigen - corners[2]) <= 0 &&
+                  normal_vectors[3].dot(current_inverse_eigen - corners[3]) <= 0 &&
+                  normal_vectors[4].dot(current_inverse_eigen - corners[0]) <= 0) &&
+                 a * current_inverse.x + b * current_inverse.y + c * current_inverse.z + d + table_tolerance >= 0 &&
+                 current_transformed.z > 0 &&
+                 std::pow(current_transformed.x, 2) + std::pow(current_transformed.y, 2) + std::pow(current_transformed.z, 2) >= min_squared_range))
+            {
+                block_moments[i].add(current_inverse_eigen.cast<double>());
+                if (occluded_region != NULL)
+                    block_indices[i].push_back(inverse_index.indices[k]);
+            }
         }
-
     }
 
-    std::cout << "\toccluded region loop: " << Timer_toc(&timer) << std::endl;
+    *moments = bounding_box::Moments();
+    for (int i = 0; i < num_blocks; i++)
+    {
+        moments->merge(block_moments[i]);
+    }
 
+    if (occluded_region != NULL)
+    {
+        std::vector<int> occluded_indices;
+        occluded_indices.reserve(moments->count);
+        for (int i = 0; i < num_blocks; i++)
+        {
+            occluded_indices.insert(occluded_indices.end(), block_indices[i].begin(), block_indices[i].end());
+        }
 
-    return occluded_region;
+        // keep the order of the inverse cloud
+        std::sort(occluded_indices.begin(), occluded_indices.end());
+        occluded_region->clear();
+        occluded_region->reserve(occluded_indices.size());
+        for (size_t i = 0; i < occluded_indices.size(); i++)
+        {
+            occluded_region->push_back(inverse.points[occluded_indices[i]]);
+        }
+    }
+    if (log != NULL)
+    {
+        *log << "\tvisited " << blocks_visited << " of " << inverse_index.blocks.size() << " blocks" << std::endl;
+        *log << "\toccluded region loop: " << Timer_toc(&timer) << std::endl;
+    }
 
 }
 
@@ -0,0 +1,270 @@
+#include <pcl_utils/cpu_tsdf_volume.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace cpu_tsdf {
+
+TsdfVolume::TsdfVolume(const Eigen::Vector3i& resolution, const Eigen::Vector3f& size)
+    : resolution_(resolution), size_(size), trunc_dist_(0.03f), skip_outside_frustum_(true), num_blocks_integrated_(0)
+{
+    cell_size_ = size_.cwiseQuotient(resolution_.cast<float>());
+    reset();
+}
+
+void TsdfVolume::reset()
+{
+    size_t num_voxels = (size_t) resolution_(0) * resolution_(1) * resolution_(2);
+    tsdf_.assign(num_voxels, 0.0f);
+    weights_.assign(num_voxels, 0);
+    Eigen::Vector3i num_blocks = (resolution_ + Eigen::Vector3i::Constant(BLOCK_SIZE - 1)) / BLOCK_SIZE;
+    changed_blocks_.assign(num_blocks.prod(), 1);
+}
+
+void TsdfVolume::integrate(const DepthMap& depth, const Eigen::Affine3f& camera_pose, float fx, float fy, float cx, float cy)
+{
+    const int rows = depth.rows();
+    const int cols = depth.cols();
+
+    // depth along the ray through each pixel, so the signed distance is a difference of ray lengths
+    std::vector<float> scaled_depth(rows * cols);
+    float max_depth = 0;
+    for (int v = 0; v < rows; v++)
+    {
+        for (int u = 0; u < cols; u++)
+        {
+            float x = (u - cx) / fx;
+            float y = (v - cy) / fy;
+            float lambda = std::sqrt(x * x + y * y + 1);
+            float d = depth.ptr()[v * cols + u] * 0.001f * lambda;
+            scaled_depth[v * cols + u] = d;
+            max_depth = std::max(max_depth, d);
+        }
+    }
+
+    // voxel centers in the camera frame are base + x * dx + y * dy + z * dz
+    Eigen::Affine3f volume_to_camera = camera_pose.inverse();
+    Eigen::Matrix3f rotation = volume_to_camera.linear();
+    Eigen::Vector3f dx = rotation.col(0) * cell_size_(0);
+    Eigen::Vector3f dy = rotation.col(1) * cell_size_(1);
+    Eigen::Vector3f dz = rotation.col(2) * cell_size_(2);
+    Eigen::Vector3f base = volume_to_camera * (cell_size_ / 2);
+
+    const float u_max = cols - 0.5f;
+    const float v_max = rows - 0.5f;
+    const float inv_trunc_dist = 1.0f / trunc_dist_;
+
+    Eigen::Vector3i num_blocks = (resolution_ + Eigen::Vector3i::Constant(BLOCK_SIZE - 1)) / BLOCK_SIZE;
+    int total_blocks = num_blocks.prod();
+    int blocks_integrated = 0;
+
+    #ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic, 8) reduction(+:blocks_integrated)
+    #endif
+    for (int b = 0; b < total_blocks; b++)
+    {
+        Eigen::Vector3i start(b % num_blocks(0) * BLOCK_SIZE, b / num_blocks(0) % num_blocks(1) * BLOCK_SIZE,
+                              b / (num_blocks(0) * num_blocks(1)) * BLOCK_SIZE);
+        Eigen::Vector3i end = (start + Eigen::Vector3i::Constant(BLOCK_SIZE)).cwiseMin(resolution_);
+
+        if (skip_outside_frustum_)
+        {
+            // project the corners of the block; skip it if it is behind the camera, outside of the image,
+            // or farther away than every measurement
+            Eigen::Vector3f center = base + dx * ((start(0) + end(0) - 1) / 2.0f) + dy * ((start(1) + end(1) - 1) / 2.0f)
+                                     + dz * ((start(2) + end(2) - 1) / 2.0f);
+            float radius = 0.5f * (end - start).cast<float>().cwiseProduct(cell_size_).norm();
+            if (center.norm() - radius > max_depth + trunc_dist_)
+                continue;
+
+            bool all_in_front = true, all_behind = true;
+            float min_u = INFINITY, max_u = -INFINITY, min_v = INFINITY, max_v = -INFINITY;
+            for (int corner = 0; corner < 8; corner++)
+            {
+                Eigen::Vector3f p = base + dx * ((corner & 1) ? end(0) - 0.5f : start(0) - 0.5f)
+                                    + dy * ((corner & 2) ? end(1) - 0.5f : start(1) - 0.5f)
+                                    + dz * ((corner & 4) ? end(2) - 0.5f : start(2) - 0.5f);
+                if (p(2) <= 0)
+                {
+                    all_in_front = false;
+                    continue;
+                }
+                all_behind = false;
+                float u = fx * p(0) / p(2) + cx;
+                float v = fy * p(1) / p(2) + cy;
+                min_u = std::min(min_u, u);
+                max_u = std::max(max_u, u);
+                min_v = std::min(min_v, v);
+                max_v = std::max(max_v, v);
+            }
+            if (all_behind)
+                continue;
+            if (all_in_front && (max_u < -0.5f || min_u >= u_max || max_v < -0.5f || min_v >= v_max))
+                continue;
+        }
+
+        blocks_integrated++;
+        bool changed = false;
+
+        float ray_length[BLOCK_SIZE];
+        int pixel[BLOCK_SIZE];
+        int row_length = end(0) - start(0);
+
+        for (int z = start(2); z < end(2); z++)
+        {
+            for (int y = start(1); y < end(1); y++)
+            {
+                Eigen::Vector3f row_start = base + dx * start(0) + dy * y + dz * z;
+
+                // project the row of voxels; no memory access besides the row buffers, so this loop vectorizes
+                for (int i = 0; i < row_length; i++)
+                {
+                    float px = row_start(0) + dx(0) * i;
+                    float py = row_start(1) + dx(1) * i;
+                    float pz = row_start(2) + dx(2) * i;
+                    float u = fx * px / pz + cx;
+                    float v = fy * py / pz + cy;
+                    bool visible = pz > 0 && u >= -0.5f && u < u_max && v >= -0.5f && v < v_max;
+                    pixel[i] = visible ? (int) (u + 0.5f) + cols * (int) (v + 0.5f) : -1;
+                    ray_length[i] = std::sqrt(px * px + py * py + pz * pz);
+                }
+
+                size_t row_index = index(start(0), y, z);
+                for (int i = 0; i < row_length; i++)
+                {
+                    if (pixel[i] < 0)
+                        continue;
+
+                    float measured = scaled_depth[pixel[i]];
+                    if (measured <= 0)
+                        continue;
+
+                    float sdf = measured - ray_length[i];
+                    if (sdf < -trunc_dist_)
+                        continue;
+
+                    float tsdf = std::min(1.0f, sdf * inv_trunc_dist);
+                    size_t voxel = row_index + i;
+                    short weight = weights_[voxel];
+                    tsdf_[voxel] = (tsdf_[voxel] * weight + tsdf) / (weight + 1);
+                    weights_[voxel] = std::min<short>(weight + 1, MAX_WEIGHT);
+                    changed = true;
+                }
+            }
+        }
+
+        if (changed)
+            changed_blocks_[b] = 1;
+    }
+
+    num_blocks_integrated_ = blocks_integrated;
+}
+
+void TsdfVolume::takeChangedBlocks(std::vector<char>& changed)
+{
+    changed.assign(changed_blocks_.size(), 0);
+    changed.swap(changed_blocks_);
+}
+
+void TsdfVolume::downloadTsdfAndWeights(std::vector<float>& tsdf, std::vector<short>& weights) const
+{
+    tsdf = tsdf_;
+    weights = weights_;
+}
+
+void TsdfVolume::fetchCloudHost(pcl::PointCloud<pcl::PointXYZ>& cloud) const
+{
+    // collect the crossings of each z slice separately, then concatenate them in order
+    std::vector<pcl::PointCloud<pcl::PointXYZ> > slices(resolution_(2));
+
+    #ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic, 4)
+    #endif
+    for (int z = 0; z < resolution_(2); z++)
+    {
+        for (int y = 0; y < resolution_(1); y++)
+        {
+            for (int x = 0; x < resolution_(0); x++)
+            {
+                size_t voxel = index(x, y, z);
+                if (weights_[voxel] == 0)
+                    continue;
+
+                float f = tsdf_[voxel];
+                Eigen::Vector3f point = (Eigen::Vector3f(x, y, z) + Eigen::Vector3f::Constant(0.5f)).cwiseProduct(cell_size_);
+
+                // look for a sign change towards the next voxel along each axis
+                int next[3] = {x + 1, y + 1, z + 1};
+                size_t strides[3] = {1, (size_t) resolution_(0), (size_t) resolution_(0) * resolution_(1)};
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    if (next[axis] >= resolution_(axis))
+                        continue;
+
+                    size_t neighbor = voxel + strides[axis];
+                    if (weights_[neighbor] == 0)
+                        continue;
+
+                    float g = tsdf_[neighbor];
+                    if ((f > 0 && g < 0) || (f < 0 && g > 0))
+                    {
+                        pcl::PointXYZ crossing;
+                        Eigen::Vector3f p = point;
+                        p(axis) += cell_size_(axis) * f / (f - g);
+                        crossing.x = p(0);
+                        crossing.y = p(1);
+                        crossing.z = p(2);
+                        slices[z].points.push_back(crossing);
+                    }
+                }
+            }
+        }
+    }
+
+    cloud.clear();
+    for (size_t z = 0; z < slices.size(); z++)
+    {
+        cloud.points.insert(cloud.points.end(), slices[z].points.begin(), slices[z].points.end());
+    }
+    cloud.width = cloud.points.size();
+    cloud.height = 1;
+    cloud.is_dense = true;
+}
+
+KinfuTracker::KinfuTracker(const Eigen::Vector3f& volume_size, float shifting_distance, int rows, int cols, const Eigen::Vector3i& resolution)
+    : volume_(resolution, volume_size), rows_(rows), cols_(cols),
+      fx_(525.f), fy_(525.f), cx_(cols / 2 - 0.5f), cy_(rows / 2 - 0.5f)
+{
+    // the volume does not shift, so shifting_distance is ignored
+    init_camera_pose_ = Eigen::Affine3f::Identity();
+    camera_pose_ = init_camera_pose_;
+}
+
+void KinfuTracker::setDepthIntrinsics(float fx, float fy, float cx, float cy)
+{
+    fx_ = fx;
+    fy_ = fy;
+    cx_ = cx;
+    cy_ = cy;
+}
+
+void KinfuTracker::setInitialCameraPose(const Eigen::Affine3f& pose)
+{
+    init_camera_pose_ = pose;
+    camera_pose_ = pose;
+}
+
+void KinfuTracker::reset()
+{
+    camera_pose_ = init_camera_pose_;
+    volume_.reset();
+}
+
+bool KinfuTracker::operator()(const DepthMap& depth, const Eigen::Affine3f& pose)
+{
+    camera_pose_ = pose;
+    volume_.integrate(depth, pose, fx_, fy_, cx_, cy_);
+    return true;
+}
+
+}
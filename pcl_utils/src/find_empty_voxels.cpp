@@ -10,6 +10,7 @@
 
 
 #include <pcl_utils/plane_recognition.h>
+#include <pcl_utils/cloud_writer.h>
 
 int main(int argc, char** argv)
 {
@@ -87,7 +88,7 @@ int main(int argc, char** argv)
     }
 
     //pcl::io::savePCDFileASCII(outfile, *transformed_cloud);
-    pcl::io::savePCDFileASCII(outfile, plane_cloud);
+    cloud_writer::save(outfile, plane_cloud);
 
     return(0);
 
@@ -1,48 +1,75 @@
 #include <pcl/point_cloud.h>
 #include <pcl/point_types.h>
 
+#include <pcl/common/io.h>
 #include <pcl/io/pcd_io.h>
-#include <pcl/io/ply_io.h>
 
 #include <pcl/PCLPointCloud2.h>
+#include <pcl_utils/boundary_estimation.h>
+#include <pcl_utils/cloud_writer.h>
 
 using namespace std;
 
+// writes the boundary points of a cloud, for a single file or every cloud in a directory. The boundary flags are
+// taken from a boundary_point field, as boundary_detection writes it, or computed if there is none
 int main(int argc, char** argv) {
-  string infile = argv[1];
-  string outfile = argv[2];
-
-  //pcl::PointCloud2::Ptr input_cloud_2 (new pcl::PointCloud2);
-  pcl::PointCloud<pcl::Boundary>::Ptr input_cloud (new pcl::PointCloud<pcl::Boundary>);
-
-  if (pcl::io::loadPCDFile<pcl::Boundary>(infile, *input_cloud) == -1) {
-    cout << "Could not find input file." << endl;
-    exit(1);
+  if (argc < 3) {
+    cerr << "usage: generate_boundary_pointcloud input_file_or_directory output_file_or_directory" << endl;
+    return 1;
   }
 
-  //pcl::io::loadPCDFile<pcl::Boundary>(infile, *input_cloud);
+  vector<string> infiles, outfiles;
+  if (!boundary_estimation::list_files(argv[1], argv[2], &infiles, &outfiles)) {
+    return 1;
+  }
 
-  pcl::PointCloud<pcl::Boundary>::Ptr input_cloud_boundary (new pcl::PointCloud<pcl::Boundary>);
-  pcl::PointCloud<pcl::PointXYZ>::Ptr input_cloud_xyz (new pcl::PointCloud<pcl::PointXYZ>);
-  pcl::PointCloud<pcl::PointXYZ> output = pcl::PointCloud<pcl::PointXYZ>();
+  boundary_estimation::Parameters parameters;
+  int num_files = infiles.size();
+  int failed = 0;
 
-  pcl::io::loadPCDFile<pcl::Boundary>(infile, *input_cloud_boundary);
-  pcl::io::loadPCDFile<pcl::PointXYZ>(infile, *input_cloud_xyz);
+  #ifdef _OPENMP
+  #pragma omp parallel for schedule(dynamic, 1) if (num_files > 1)
+  #endif
+  for (int i = 0; i < num_files; i++) {
+    // read the file once, whatever its fields
+    pcl::PCLPointCloud2 input_blob;
+    if (pcl::io::loadPCDFile(infiles[i], input_blob) == -1) {
+      cout << "Could not read " << infiles[i] << endl;
+      #ifdef _OPENMP
+      #pragma omp atomic
+      #endif
+      failed++;
+      continue;
+    }
 
-  pcl::PointCloud<pcl::Boundary>::iterator boundary_iter;
-  pcl::PointCloud<pcl::PointXYZ>::iterator xyz_iter;
-  for (boundary_iter = input_cloud_boundary->begin(), xyz_iter = input_cloud_xyz->begin();
-       boundary_iter != input_cloud_boundary->end();
-       boundary_iter++, xyz_iter++) {
-    pcl::Boundary current = *boundary_iter;
-    pcl::PointXYZ xyz_point = *xyz_iter;
-    if (current.boundary_point) { // && xyz_point.y >= -0.05 + 1.35 && xyz_point.y <= 0.05 + 1.35) {
-      output.push_back(xyz_point);
+    pcl::PointCloud<pcl::PointXYZ>::Ptr input_cloud_xyz (new pcl::PointCloud<pcl::PointXYZ>);
+    pcl::PointCloud<pcl::Boundary> boundaries;
+    pcl::fromPCLPointCloud2(input_blob, *input_cloud_xyz);
+    if (pcl::getFieldIndex(input_blob, "boundary_point") >= 0) {
+      pcl::fromPCLPointCloud2(input_blob, boundaries);
+    } else {
+      pcl::PointCloud<pcl::Normal> normals;
+      boundary_estimation::compute_normals(input_cloud_xyz, parameters, &normals);
+      boundary_estimation::compute_boundaries(input_cloud_xyz, normals, parameters, &boundaries);
     }
-  }
 
-  //fromPCLPointCloud2(*input_cloud_2, *input_cloud_xyz);
+    pcl::PointCloud<pcl::PointXYZ> output;
+    boundary_estimation::extract_boundary_points(*input_cloud_xyz, boundaries, &output);
 
-  pcl::io::savePCDFileASCII(outfile, output);
+    if (output.empty()) {
+      cout << infiles[i] << " has no boundary points" << endl;
+      continue;
+    }
+    if (!cloud_writer::save(outfiles[i], output)) {
+      #ifdef _OPENMP
+      #pragma omp atomic
+      #endif
+      failed++;
+      continue;
+    }
+    cout << infiles[i] << " -> " << outfiles[i] << " (" << output.size() << " boundary points)" << endl;
+  }
 
+  cout << "done, " << failed << " of " << num_files << " files failed" << endl;
+  return failed > 0 ? 1 : 0;
 }
@@ -4,6 +4,7 @@
 #include <tf/transform_listener.h>
 #include <tf/transform_datatypes.h>
 #include <tf_conversions/tf_eigen.h>
+#include <pcl_utils/transform_cache.h>
 #include "sensor_msgs/PointCloud2.h"
 #include <std_msgs/Empty.h>
 #include <std_msgs/Float64.h>
@@ -22,14 +23,21 @@
 using namespace Eigen;
 
 #include <boost/thread.hpp>
+#include <pcl_utils/triple_buffer.h>
 
 #include <pcl/console/parse.h>
+#include <pcl_utils/tsdf_converter.h>
+#include <pcl_utils/tsdf_statistics.h>
+#ifdef KINFU_CPU
+#include <pcl_utils/cpu_tsdf_volume.h>
+#else
 #include <pcl/gpu/kinfu_large_scale/kinfu.h>
 #include <pcl/gpu/kinfu_large_scale/raycaster.h>
 //#include <pcl/gpu/kinfu_large_scale/marching_cubes.h>
 #include <pcl/gpu/kinfu_large_scale/tsdf_volume.h>
 #include <pcl/gpu/containers/initialization.h>
 #include <pcl/gpu/containers/device_array.h>
+#endif
 
 // stuff for writing tsdf vectors
 #include <fstream>
@@ -38,7 +46,9 @@ using namespace Eigen;
 #include <vector>
 #include <iostream>
 
+#ifndef KINFU_CPU
 #include <cuda_runtime.h>
+#endif
 #include <assert.h>
 
 typedef float VoxelT;
@@ -52,6 +62,7 @@ typedef short WeightT;
 #define N_SUB (W_SUB*H_SUB)
 
 //#define USE_COLOR
+// KINFU_CPU is defined by CMake when the node is built without CUDA
 //#define SAVE_TSDF
 #define FIND_OCCLUSIONS
 //#define PUBLISH_WEIGHTS
@@ -60,19 +71,41 @@ typedef short WeightT;
 #include <pcl_utils/occluded_region_finder.h>
 #endif
 
+#ifdef SAVE_TSDF
+#include <pcl_utils/tsdf_snapshot.h>
+#endif
+
+#ifdef KINFU_CPU
+#ifdef USE_COLOR
+#error "color integration needs the GPU kinfu"
+#endif
+typedef cpu_tsdf::KinfuTracker KinfuTracker;
+typedef cpu_tsdf::TsdfVolume KinfuVolume;
+typedef cpu_tsdf::DepthMap DepthMap;
+#else
+typedef pcl::gpu::kinfuLS::KinfuTracker KinfuTracker;
+typedef pcl::gpu::kinfuLS::TsdfVolume KinfuVolume;
+typedef pcl::gpu::DeviceArray2D<unsigned short> DepthMap;
+#endif
+
 boost::shared_ptr<tf::TransformListener> listener;
 ros::Publisher pub, current_pointcloud_pub, variable_pub, markers_pub, points_pub, regions_pub, plane_pub,
 			  object_points_pub, plane_points_pub, logger_pub;
 ros::Subscriber signal_sub, head_points_sub, reset_sub, head_camera_time_sub;
-bool downloading;
+// held while a frame is integrated and while the volume is downloaded or reset
+boost::mutex volume_mutex;
 int counter;
 bool publish_kinfu_under_cam_depth_reg;
-pcl::PointCloud<pcl::PointXYZRGB> last_cloud;
-pcl::PointCloud<pcl::PointXYZ> last_head_cloud;
 int current;
-pcl::gpu::kinfuLS::KinfuTracker *pcl_kinfu_tracker;
+KinfuTracker *pcl_kinfu_tracker;
 bool using_head_camera;
-bool head_camera_active;
+// head camera frames are integrated until then; set from the head_camera_duration callback
+ros::Time head_camera_deadline;
+boost::mutex head_camera_mutex;
+#ifdef FIND_OCCLUSIONS
+occluded_region_finder::OcclusionCache occlusion_cache;
+#endif
+tsdf_statistics::IncrementalStatistics weight_statistics;
 
 namespace carmine
 {
@@ -86,13 +119,28 @@ const double cx = 319.5;
 const double cy = 239.5;
 }
 
-namespace kinfu
+/** a camera frame as it is integrated: depth in millimeters, 0 where there is no measurement */
+struct DepthFrame
 {
-// x and y must be equal!
-const double x = 2;
-const double y = 2;
-const double z = 2;
+    DepthFrame() : depth(carmine::WIDTH * carmine::HEIGHT, 0)
+    #ifdef USE_COLOR
+                 , color(carmine::WIDTH * carmine::HEIGHT)
+    #endif
+    {
+    }
+
+    std::vector<unsigned short> depth;
+    #ifdef USE_COLOR
+    std::vector<pcl::gpu::kinfuLS::PixelRGB> color;
+    #endif
+};
 
+// from the grabber and head camera callbacks to update_kinfu_loop
+triple_buffer::TripleBuffer<DepthFrame> camera_frames, head_camera_frames;
+
+namespace kinfu
+{
+// the volume geometry comes from the volume_resolution and volume_size parameters
 const float shifting_distance = 5.0f;
 }
 
@@ -118,319 +166,332 @@ typename pcl::PointCloud<MergedT>::Ptr merge(const pcl::PointCloud<PointT>& poin
 
 void reset_kinfu(const std_msgs::EmptyConstPtr& empty)
 {
-    if (!downloading)
+    std::cout << "Resetting pointcloud..." << std::endl;
     {
-        downloading = true;
-        std::cout << "Resetting pointcloud..." << std::endl;
+        boost::mutex::scoped_lock volume_lock(volume_mutex);
         pcl_kinfu_tracker->reset();
-        std::cout << "Reset pointcloud" << std::endl;
-        downloading = false;
     }
+    #ifdef FIND_OCCLUSIONS
+    occlusion_cache.clear();
+    #endif
+    std::cout << "Reset pointcloud" << std::endl;
 }
 
 void activate_head_camera(const std_msgs::Float64ConstPtr duration)
 {
-  if (!head_camera_active)
+    // the integration loop checks the deadline, so the spinner is never held up here
+    boost::mutex::scoped_lock lock(head_camera_mutex);
+    if (ros::Time::now() >= head_camera_deadline)
     {
-      head_camera_active = true;
-      ros::Duration(duration->data).sleep();
-      head_camera_active = false;
+        head_camera_deadline = ros::Time::now() + ros::Duration(duration->data);
     }
 }
 
-void publish_to_logger(const std::vector<short>& tsdf_weights) {
-	int num_zero = 0, num_nonzero = 0;
-	for(int i=0; i < tsdf_weights.size(); ++i) {
-		if (tsdf_weights[i] > 0) {
-			num_nonzero++;
-		} else {
-			num_zero++;
-		}
-	}
-
-	std::stringstream ss_zero;
-	std_msgs::String msg_zero;
-	ss_zero << "kinfu zero weights " << num_zero;
-	msg_zero.data = ss_zero.str().c_str();
-	logger_pub.publish(msg_zero);
-
-	std::stringstream ss_nonzero;
-	std_msgs::String msg_nonzero;
-	ss_nonzero << "kinfu nonzero weights " << num_nonzero;
-	msg_nonzero.data = ss_nonzero.str().c_str();
-	logger_pub.publish(msg_nonzero);
+bool head_camera_active()
+{
+    boost::mutex::scoped_lock lock(head_camera_mutex);
+    return ros::Time::now() < head_camera_deadline;
 }
 
-void get_occluded(const std_msgs::EmptyConstPtr& str)
+void publish_to_logger(const std::string& text)
 {
-    if (!downloading)
+    std_msgs::String msg;
+    msg.data = text;
+    logger_pub.publish(msg);
+}
+
+void publish_to_logger(const tsdf_statistics::WeightStatistics& statistics)
+{
+    std::stringstream ss_zero;
+    ss_zero << "kinfu zero weights " << statistics.num_unobserved();
+    publish_to_logger(ss_zero.str());
+
+    std::stringstream ss_nonzero;
+    ss_nonzero << "kinfu nonzero weights " << statistics.num_observed;
+    publish_to_logger(ss_nonzero.str());
+
+    std::stringstream ss_weights;
+    ss_weights << "kinfu weight histogram";
+    for (int i = 0; i < tsdf_statistics::WeightStatistics::NUM_WEIGHT_BINS; i++)
+    {
+        ss_weights << " " << statistics.weight_histogram[i];
+    }
+    publish_to_logger(ss_weights.str());
+
+    std::stringstream ss_distances;
+    ss_distances << "kinfu distance histogram";
+    for (int i = 0; i < tsdf_statistics::WeightStatistics::NUM_DISTANCE_BINS; i++)
     {
-        downloading = true;
-        std::cout << "Publishing kinfu cloud...\n";
-        #ifndef USE_COLOR
-        pcl::PointCloud<pcl::PointXYZ> current_cloud;
-        // Download tsdf and convert to pointcloud
-        pcl::gpu::kinfuLS::TsdfVolume tsdf = pcl_kinfu_tracker->volume();
+        ss_distances << " " << statistics.distance_histogram[i];
+    }
+    publish_to_logger(ss_distances.str());
+}
 
+void get_occluded(const std_msgs::EmptyConstPtr& str)
+{
+    std::cout << "Publishing kinfu cloud...\n";
+    #ifndef USE_COLOR
+    pcl::PointCloud<pcl::PointXYZ> current_cloud;
+    // Download tsdf and convert to pointcloud
+    KinfuVolume& tsdf = pcl_kinfu_tracker->volume();
+
+    #if defined(FIND_OCCLUSIONS) || defined(SAVE_TSDF) || defined(PUBLISH_WEIGHTS)
+    // TODO: I don't know if these variable names are all correct
+    // i.e. maybe it should be called kinfu_to_rgb, etc.
+
+    // get the transform from from rgb optical frame to kinfu frame
+    tf::StampedTransform rgb_to_kinfu_write;
+    bool have_transform = transform_cache::lookup_transform("/camera_rgb_optical_frame", "/kinfu_frame", ros::Time(0), &rgb_to_kinfu_write);
+
+    std::vector<float> tsdf_vector;
+    std::vector<short> tsdf_weights;
+    //tsdf.save("kinfu_tsdf.dat"); // doesn't work for some reason
+    // the blocks integrated since the last download, if the volume keeps track of them
+    std::vector<char> changed_blocks;
+    #endif
+
+    {
+        // integration waits until both downloads are done, so the cloud and the tsdf show the same frames
+        boost::mutex::scoped_lock volume_lock(volume_mutex);
         std::cout << "Fetching cloud host...\n";
         tsdf.fetchCloudHost(current_cloud);
-        // Publish the data
-        sensor_msgs::PointCloud2 output;
-        //toROSMsg(transformed_cloud, output);
-        toROSMsg(current_cloud, output);
-        output.header.stamp = ros::Time::now();
-        //output.header.frame_id = "/camera_rgb_optical_frame";
-        output.header.frame_id = "/kinfu_frame";
-        pub.publish (output);
-        if (publish_kinfu_under_cam_depth_reg)
+        #if defined(FIND_OCCLUSIONS) || defined(SAVE_TSDF) || defined(PUBLISH_WEIGHTS)
+        if (have_transform)
         {
-        	variable_pub.publish(output);
+            tsdf.downloadTsdfAndWeights(tsdf_vector, tsdf_weights);
+            #ifdef KINFU_CPU
+            tsdf.takeChangedBlocks(changed_blocks);
+            #endif
         }
-        std::cout << "Kinfu cloud published\n";
-        std::cout << "Kinfu cloud size: " << output.data.size() << "\n\n";
-
-
-        #if defined(FIND_OCCLUSIONS) || defined(SAVE_TSDF) || defined(PUBLISH_WEIGHTS)
-        // TODO: I don't know if these variable names are all correct
-        // i.e. maybe it should be called kinfu_to_rgb, etc.
-
-        // get the transform from from rgb optical frame to kinfu frame
-        tf::StampedTransform rgb_to_kinfu_write;
-        listener->waitForTransform("/camera_rgb_optical_frame", "/kinfu_frame",
-                                   ros::Time(0), ros::Duration(5));
-        listener->lookupTransform("/camera_rgb_optical_frame", "/kinfu_frame",
-                                  ros::Time(0), rgb_to_kinfu_write);
+        #endif
+    }
+    // Publish the data
+    sensor_msgs::PointCloud2 output;
+    //toROSMsg(transformed_cloud, output);
+    toROSMsg(current_cloud, output);
+    output.header.stamp = ros::Time::now();
+    //output.header.frame_id = "/camera_rgb_optical_frame";
+    output.header.frame_id = "/kinfu_frame";
+    pub.publish (output);
+    if (publish_kinfu_under_cam_depth_reg)
+    {
+    	variable_pub.publish(output);
+    }
+    std::cout << "Kinfu cloud published\n";
+    std::cout << "Kinfu cloud size: " << output.data.size() << "\n\n";
 
 
-        std::vector<float> tsdf_vector;
-        std::vector<short> tsdf_weights;
-        //tsdf.save("kinfu_tsdf.dat"); // doesn't work for some reason
+    #if defined(FIND_OCCLUSIONS) || defined(SAVE_TSDF) || defined(PUBLISH_WEIGHTS)
+    if (!have_transform)
+    {
+        std::cout << "no transform from /camera_rgb_optical_frame to /kinfu_frame, skipping occlusion finding\n";
+        return;
+    }
 
+    std::cout << "distances: " << tsdf_vector.size() << std::endl;
+    std::cout << "weights: " << tsdf_weights.size() << std::endl;
 
-        tsdf.downloadTsdfAndWeights(tsdf_vector, tsdf_weights);
-        std::cout << "distances: " << tsdf_vector.size() << std::endl;
-        std::cout << "weights: " << tsdf_weights.size() << std::endl;
-        publish_to_logger(tsdf_weights);
+    // only count the blocks that changed since the last request, if they are known
+    bool incremental_statistics;
+    ros::param::param<bool>("/occlusion_parameters/incremental_statistics", incremental_statistics, true);
+    tsdf_converter::TsdfVolumeView statistics_view(&tsdf_vector[0], &tsdf_weights[0], tsdf_converter::VolumeGeometry(tsdf.getResolution(), tsdf.getSize()));
+    if (incremental_statistics)
+    {
+        publish_to_logger(weight_statistics.update(statistics_view, changed_blocks.empty() ? NULL : &changed_blocks));
+        std::cout << "weight statistics: " << weight_statistics.num_blocks_updated() << " blocks counted" << std::endl;
+    }
+    else
+    {
+        weight_statistics.clear();
+        publish_to_logger(tsdf_statistics::compute_statistics(statistics_view));
+    }
 
-        // transform kinfu points back to rgb optical frame
-        Affine3d current_transform_write;
-        tf::transformTFToEigen(rgb_to_kinfu_write, current_transform_write);
+    // transform kinfu points back to rgb optical frame
+    Affine3d current_transform_write;
+    tf::transformTFToEigen(rgb_to_kinfu_write, current_transform_write);
 
-        Matrix4d transformation_matrix = current_transform_write.matrix();
-        #endif // defined(FIND_OCCLUSIONS) || defined(SAVE_TSDF) || defined(PUBLISH_WEIGHTS)
+    Matrix4d transformation_matrix = current_transform_write.matrix();
+    #endif // defined(FIND_OCCLUSIONS) || defined(SAVE_TSDF) || defined(PUBLISH_WEIGHTS)
 
-        #ifdef PUBLISH_WEIGHTS
-        // TODO: fill this in later with code to publish weighted cloud -- currently in separate file (get_weight_cloud.cpp)
-        #endif
+    #ifdef PUBLISH_WEIGHTS
+    // TODO: fill this in later with code to publish weighted cloud -- currently in separate file (get_weight_cloud.cpp)
+    #endif
 
-        #ifdef FIND_OCCLUSIONS
+    #ifdef FIND_OCCLUSIONS
 //		pcl::PointCloud<pcl::PointXYZ>::Ptr zero_crossing_cloud = pcl::PointCloud<pcl::PointXYZ>::Ptr(new  pcl::PointCloud<pcl::PointXYZ>);
 //        pcl::PointCloud<pcl::PointXYZ>::Ptr foreground_cloud = pcl::PointCloud<pcl::PointXYZ>::Ptr(new  pcl::PointCloud<pcl::PointXYZ>);
 //        PointCloudVoxelGrid::CloudType::Ptr inverse_cloud = pcl::PointCloud<pcl::PointXYZ>::Ptr(new  pcl::PointCloud<pcl::PointXYZ>);
-        pcl::PointCloud<pcl::PointXYZ>::Ptr current_cloud_ptr (new pcl::PointCloud<pcl::PointXYZ> (current_cloud));
-        occluded_region_finder::find_occluded_regions(tsdf_vector, tsdf_weights, current_cloud_ptr, transformation_matrix, false, "kinfu", markers_pub, points_pub, regions_pub, plane_pub, object_points_pub, plane_points_pub); //,
-        //zero_crossing_cloud, foreground_cloud, inverse_cloud);
-        #endif // FIND_OCCLUSIONS
-
-
-        #ifdef SAVE_TSDF
-        // write the vectors as binary data
-
-        std::stringstream current_stream;
-        current_stream << current;
-
-        std::ofstream dist_out;
-        const char* dist_pointer = reinterpret_cast<const char*>(&tsdf_vector[0]);
-        size_t bytes = tsdf_vector.size() * sizeof(tsdf_vector[0]);
-        std::string dist_file = "kinfu_dist" + current_stream.str() + ".dat";
-        dist_out.open(dist_file.c_str(), std::ios::out | std::ios::binary);
-        dist_out.write(dist_pointer, bytes);
-        dist_out.close();
-
-        std::ofstream weight_out;
-        const char* weight_pointer = reinterpret_cast<const char*>(&tsdf_weights[0]);
-        bytes = tsdf_weights.size() * sizeof(tsdf_weights[0]);
+    pcl::PointCloud<pcl::PointXYZ>::Ptr current_cloud_ptr (new pcl::PointCloud<pcl::PointXYZ> (current_cloud));
+    tsdf_converter::TsdfVolumeView tsdf_view(&tsdf_vector[0], &tsdf_weights[0], tsdf_converter::VolumeGeometry(tsdf.getResolution(), tsdf.getSize()));
+    // only redo the parts of the volume that changed since the last request
+    bool incremental_occlusion;
+    ros::param::param<bool>("/occlusion_parameters/incremental_occlusion", incremental_occlusion, true);
+    if (!incremental_occlusion)
+    {
+        occlusion_cache.clear();
+    }
+    occluded_region_finder::find_occluded_regions(tsdf_view, current_cloud_ptr, transformation_matrix, false, "kinfu", markers_pub, points_pub, regions_pub, plane_pub, object_points_pub, plane_points_pub,
+                                                  incremental_occlusion ? &occlusion_cache : NULL, NULL, changed_blocks.empty() ? NULL : &changed_blocks); //,
+    //zero_crossing_cloud, foreground_cloud, inverse_cloud);
+    transform_cache::print_statistics();
+    #endif // FIND_OCCLUSIONS
 
-        std::string weight_file = "kinfu_weights" + current_stream.str() + ".dat";
-        weight_out.open(weight_file.c_str(), std::ios::out | std::ios::binary);
-        weight_out.write(weight_pointer, bytes);
-        weight_out.close();
 
+    #ifdef SAVE_TSDF
+    // write the observed blocks of the volume together with the matrix
 
-        std::ofstream matrix_outstream;
-        std::string matrix_file = "transform_matrix" + current_stream.str() + ".txt";
-        matrix_outstream.open(matrix_file.c_str());
-        for (int x = 0; x < transformation_matrix.rows(); x++)
-        {
-            for (int y = 0; y < transformation_matrix.cols(); y++)
-            {
-                matrix_outstream << transformation_matrix(x, y) << std::endl;
-            }
-        }
-        matrix_outstream.close();
+    std::stringstream current_stream;
+    current_stream << current;
 
+    std::string snapshot_file = "kinfu_tsdf" + current_stream.str() + ".tsdf";
+    tsdf_snapshot::write_snapshot(snapshot_file, tsdf_converter::TsdfVolumeView(&tsdf_vector[0], &tsdf_weights[0], tsdf_converter::VolumeGeometry(tsdf.getResolution(), tsdf.getSize())),
+                                  transformation_matrix);
 
-        current++;
-        std::cout << "saved!" << std::endl;
-        #endif // SAVE_TSDF
+    current++;
+    std::cout << "saved!" << std::endl;
+    #endif // SAVE_TSDF
 
-        #else
-        // new way of doing it, with color
+    #else
+    // new way of doing it, with color
 
-        pcl::gpu::DeviceArray<pcl::PointXYZ> cloud_buffer_device_;
-        pcl::gpu::DeviceArray<pcl::RGB> point_colors_device_;
+    pcl::gpu::DeviceArray<pcl::PointXYZ> cloud_buffer_device_;
+    pcl::gpu::DeviceArray<pcl::RGB> point_colors_device_;
 
-        pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_ptr_ = pcl::PointCloud<pcl::PointXYZ>::Ptr (new pcl::PointCloud<pcl::PointXYZ>);
-        pcl::PointCloud<pcl::RGB>::Ptr point_colors_ptr_ = pcl::PointCloud<pcl::RGB>::Ptr (new pcl::PointCloud<pcl::RGB>);
+    pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_ptr_ = pcl::PointCloud<pcl::PointXYZ>::Ptr (new pcl::PointCloud<pcl::PointXYZ>);
+    pcl::PointCloud<pcl::RGB>::Ptr point_colors_ptr_ = pcl::PointCloud<pcl::RGB>::Ptr (new pcl::PointCloud<pcl::RGB>);
 
+    {
+        boost::mutex::scoped_lock volume_lock(volume_mutex);
         pcl::gpu::DeviceArray<pcl::PointXYZ> extracted = pcl_kinfu_tracker->volume().fetchCloud(cloud_buffer_device_); // cloud_buffer_device_ is just another pcl::gpu::DeviceArray<pcl::PointXYZ>
         extracted.download (cloud_ptr_->points);
-        cloud_ptr_->width = (int)cloud_ptr_->points.size ();
-        cloud_ptr_->height = 1;
-
         pcl_kinfu_tracker->colorVolume().fetchColors(extracted, point_colors_device_); // same as above for point_colors_device
         point_colors_device_.download(point_colors_ptr_->points);
-        point_colors_ptr_->width = (int)point_colors_ptr_->points.size ();
-        point_colors_ptr_->height = 1;
+    }
+    cloud_ptr_->width = (int)cloud_ptr_->points.size ();
+    cloud_ptr_->height = 1;
 
+    point_colors_ptr_->width = (int)point_colors_ptr_->points.size ();
+    point_colors_ptr_->height = 1;
 
-        pcl::PointCloud<pcl::PointXYZRGB> current_cloud = *(merge<pcl::PointXYZRGB>(*cloud_ptr_, *point_colors_ptr_));
 
-        #endif // ndef USE_COLOR
+    pcl::PointCloud<pcl::PointXYZRGB> current_cloud = *(merge<pcl::PointXYZRGB>(*cloud_ptr_, *point_colors_ptr_));
 
-        downloading = false;
-    }
+    #endif // ndef USE_COLOR
 
 }
 
 
-void update_kinfu_loop(pcl::gpu::kinfuLS::KinfuTracker *pcl_kinfu_tracker)
+void update_kinfu_loop(KinfuTracker *pcl_kinfu_tracker)
 {
+    // allocated once, upload only copies into them
+    DepthMap depth(carmine::HEIGHT,carmine::WIDTH);
+    #ifdef USE_COLOR
+    pcl::gpu::DeviceArray2D<pcl::gpu::kinfuLS::PixelRGB> color(carmine::HEIGHT,carmine::WIDTH);
+    #endif
+
+    const int cols = carmine::WIDTH;
+
     while(ros::ok())
     {
-        if (!downloading)
+        // sleep until the grabber hands over a frame that was not integrated yet
+        const DepthFrame* frame = camera_frames.take(boost::posix_time::milliseconds(100));
+        if (frame == NULL)
         {
-            std::cout << "Updating kinfu...\n";
-
-            pcl::PointCloud<pcl::PointXYZRGB> cloud;
-            pcl::copyPointCloud(last_cloud, cloud);
-
-            // get the current location of the camera relative to the kinfu frame (see kinfu.launch)
-            tf::StampedTransform kinfu_to_camera;
-            listener->waitForTransform("/kinfu_frame", "/camera_rgb_optical_frame",
-                                       ros::Time(0), ros::Duration(5));
-            listener->lookupTransform("/kinfu_frame", "/camera_rgb_optical_frame",
-                                      ros::Time(0), kinfu_to_camera);
-
-            // convert camera pose to format suitable for kinfu
-            Affine3d affine_current_cam_pose;
-            tf::transformTFToEigen(kinfu_to_camera, affine_current_cam_pose);
-
-            pcl::PointCloud<pcl::PointXYZRGB> transformed_cloud;
-            pcl::transformPointCloud(cloud, transformed_cloud, affine_current_cam_pose);
-
-
-            // convert the data into gpu format for kinfu tracker to use
-            pcl::gpu::DeviceArray2D<unsigned short> depth(carmine::HEIGHT,carmine::WIDTH);
-            std::vector<unsigned short> data(carmine::HEIGHT*carmine::WIDTH);
-
-            #ifdef USE_COLOR
-            // the same for color data
-            pcl::gpu::DeviceArray2D<pcl::gpu::kinfuLS::PixelRGB> color(carmine::HEIGHT,carmine::WIDTH);
-            std::vector<pcl::gpu::kinfuLS::PixelRGB> color_data(carmine::HEIGHT*carmine::WIDTH);
-            #endif
-
-            const int cols = carmine::WIDTH;
+            continue;
+        }
 
-            int i;
-            pcl::PointCloud<pcl::PointXYZRGB>::iterator cloud_iter;
-            for(cloud_iter = cloud.begin(), i = 0;
-                    cloud_iter != cloud.end();
-                    cloud_iter++, i++)
-            {
-                data[i] = static_cast<unsigned short>(1e3*cloud_iter->z);
-            #ifdef USE_COLOR
-                pcl::gpu::kinfuLS::PixelRGB current_pixel = pcl::gpu::kinfuLS::PixelRGB();
-                current_pixel.r = cloud_iter->r;
-                current_pixel.g = cloud_iter->g;
-                current_pixel.b = cloud_iter->b;
-                color_data[i] = current_pixel;
-            #endif
+        std::cout << "Updating kinfu...\n";
 
-            }
+        // get the current location of the camera relative to the kinfu frame (see kinfu.launch);
+        // skip this frame rather than block the loop if the transform is not there yet
+        tf::StampedTransform kinfu_to_camera;
+        if (!transform_cache::lookup_transform("/kinfu_frame", "/camera_rgb_optical_frame", ros::Time(0), &kinfu_to_camera))
+        {
+            continue;
+        }
 
+        // convert camera pose to format suitable for kinfu
+        Affine3d affine_current_cam_pose;
+        tf::transformTFToEigen(kinfu_to_camera, affine_current_cam_pose);
 
-            depth.upload(data, cols);
-            #ifdef USE_COLOR
-            color.upload(color_data, cols);
-            #endif
+        // convert the data into gpu format for kinfu tracker to use
+        depth.upload(frame->depth, cols);
+        #ifdef USE_COLOR
+        // the same for color data
+        color.upload(frame->color, cols);
+        #endif
 
+        {
+            boost::mutex::scoped_lock volume_lock(volume_mutex);
             // update kinfu tracker with new depth map and camera pose
             (*pcl_kinfu_tracker)(depth, affine_current_cam_pose.cast<float>());
             #ifdef USE_COLOR
             (*pcl_kinfu_tracker)(depth, color);
             #endif
+        }
 
+        if (using_head_camera && head_camera_active()) {
+            // a head camera frame is only integrated once too, along with the next camera frame
+            const DepthFrame* head_frame = head_camera_frames.try_take();
 
-
-            if (using_head_camera && head_camera_active) {
-
-                pcl::PointCloud<pcl::PointXYZ> head_cloud;
-                pcl::copyPointCloud(last_head_cloud, head_cloud);
-
-                // get the current location of the camera relative to the kinfu frame (see kinfu.launch)
-                tf::StampedTransform kinfu_to_head_camera;
-		std::string head_camera_frame = "/head_camera_rgb_optical_frame";
-                listener->waitForTransform("/kinfu_frame", head_camera_frame,
-                                           ros::Time(0), ros::Duration(5));
-                listener->lookupTransform("/kinfu_frame", head_camera_frame,
-                                          ros::Time(0), kinfu_to_head_camera);
-
+            // get the current location of the camera relative to the kinfu frame (see kinfu.launch)
+            tf::StampedTransform kinfu_to_head_camera;
+            std::string head_camera_frame = "/head_camera_rgb_optical_frame";
+            if (head_frame != NULL && transform_cache::lookup_transform("/kinfu_frame", head_camera_frame, ros::Time(0), &kinfu_to_head_camera))
+            {
                 // convert camera pose to format suitable for kinfu
                 Affine3d affine_current_head_cam_pose;
                 tf::transformTFToEigen(kinfu_to_head_camera, affine_current_head_cam_pose);
 
-                pcl::PointCloud<pcl::PointXYZ> transformed_head_cloud;
-                pcl::transformPointCloud(head_cloud, transformed_head_cloud, affine_current_head_cam_pose);
-
-
-                // convert the data into gpu format for kinfu tracker to use
-                pcl::gpu::DeviceArray2D<unsigned short> head_depth(carmine::HEIGHT,carmine::WIDTH);
-                std::vector<unsigned short> head_data(carmine::HEIGHT*carmine::WIDTH);
-
-                const int cols = carmine::WIDTH;
-
-                // TODO: Greg - does this really iterate through the points in the correct order?
-                int i;
-                pcl::PointCloud<pcl::PointXYZ>::iterator head_cloud_iter;
-                for(head_cloud_iter = head_cloud.begin(), i = 0;
-                        head_cloud_iter != head_cloud.end();
-                        head_cloud_iter++, i++)
-                {
-                    head_data[i] = static_cast<unsigned short>(1e3*head_cloud_iter->z);
-
-                }
-
-
-                head_depth.upload(head_data, cols);
+                depth.upload(head_frame->depth, cols);
 
+                boost::mutex::scoped_lock volume_lock(volume_mutex);
                 // update kinfu tracker with new depth map and camera pose
-                (*pcl_kinfu_tracker)(head_depth, affine_current_head_cam_pose.cast<float>());
+                (*pcl_kinfu_tracker)(depth, affine_current_head_cam_pose.cast<float>());
 
                 std::cout << "added head camera data" << std::endl;
-
             }
-
-            std::cout << "Updated kinfu!\n\n";
         }
 
-        ros::spinOnce();
+        std::cout << "Updated kinfu!\n\n";
     }
 }
 
+/** the depth of an organized cloud in millimeters, with 0 for missing points; false if the cloud does not have
+    the size of the frame */
+template<typename PointT>
+bool fill_depth(const pcl::PointCloud<PointT>& cloud, DepthFrame* frame)
+{
+    if (cloud.points.size() != frame->depth.size())
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < cloud.points.size(); i++)
+    {
+        float z = cloud.points[i].z;
+        frame->depth[i] = pcl_isfinite(z) ? static_cast<unsigned short>(1e3*z) : 0;
+    }
+    return true;
+}
+
 void _cloud_callback (const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& input)
 {
-    pcl::copyPointCloud(*input, last_cloud);
+    DepthFrame& frame = camera_frames.write_slot();
+    if (fill_depth(*input, &frame))
+    {
+        #ifdef USE_COLOR
+        for (size_t i = 0; i < input->points.size(); i++)
+        {
+            pcl::gpu::kinfuLS::PixelRGB current_pixel = pcl::gpu::kinfuLS::PixelRGB();
+            current_pixel.r = input->points[i].r;
+            current_pixel.g = input->points[i].g;
+            current_pixel.b = input->points[i].b;
+            frame.color[i] = current_pixel;
+        }
+        #endif
+        camera_frames.publish();
+    }
 
     sensor_msgs::PointCloud2 output;
     toROSMsg(*input, output);
@@ -451,13 +512,31 @@ void _head_cloud_callback(sensor_msgs::PointCloud2 input) {
     pcl::PointCloud<pcl::PointXYZ> head_points;
     fromROSMsg(input, head_points);
 
-    pcl::copyPointCloud(head_points, last_head_cloud);
+    if (fill_depth(head_points, &head_camera_frames.write_slot()))
+    {
+        head_camera_frames.publish();
+    }
+    else if (using_head_camera)
+    {
+        std::cout << "head camera cloud has " << head_points.size() << " points, not " << carmine::WIDTH * carmine::HEIGHT << std::endl;
+    }
 }
 
-pcl::gpu::kinfuLS::KinfuTracker* init_kinfu()
+KinfuTracker* init_kinfu()
 {
     // setup kinfu tracker
-    pcl::gpu::kinfuLS::KinfuTracker *pcl_kinfu_tracker = new pcl::gpu::kinfuLS::KinfuTracker(Vector3f(kinfu::y, kinfu::z, kinfu::x), kinfu::shifting_distance, carmine::HEIGHT, carmine::WIDTH);
+    tsdf_converter::VolumeGeometry geometry = tsdf_converter::get_volume_geometry();
+    #ifdef KINFU_CPU
+    KinfuTracker *pcl_kinfu_tracker = new KinfuTracker(geometry.size, kinfu::shifting_distance, carmine::HEIGHT, carmine::WIDTH, geometry.resolution);
+    #else
+    // the GPU volume's resolution is fixed when kinfu_large_scale is compiled, and its x and y sizes must be equal
+    KinfuTracker *pcl_kinfu_tracker = new KinfuTracker(geometry.size, kinfu::shifting_distance, carmine::HEIGHT, carmine::WIDTH);
+    if (pcl_kinfu_tracker->volume().getResolution() != geometry.resolution)
+    {
+        std::cout << "the GPU volume has resolution " << pcl_kinfu_tracker->volume().getResolution().transpose()
+                  << ", not the configured " << geometry.resolution.transpose() << std::endl;
+    }
+    #endif
     pcl_kinfu_tracker->setDepthIntrinsics(carmine::fx, carmine::fy, carmine::cx, carmine::cy);
 
     // the transform from /base_link to /kinfu_frame
@@ -492,6 +571,7 @@ int main (int argc, char** argv)
     std::string dev;
     // fill in tf listener
     listener.reset(new tf::TransformListener(ros::Duration(20.0)));
+    transform_cache::set_listener(listener);
 
     ros::param::param<bool>("/occlusion_parameters/using_head_camera", using_head_camera, false);
 
@@ -558,8 +638,6 @@ int main (int argc, char** argv)
     boost::thread update_kinfu_thread(update_kinfu_loop, pcl_kinfu_tracker);
 
     std::cout << "Ready to publish clouds\n";
-    downloading = false;
-    head_camera_active = false;
 
     current = 1;
 //	while(ros::ok()) {
@@ -580,6 +658,7 @@ int main (int argc, char** argv)
     // Spin
     ros::spin ();
     grabber->stop();
+    camera_frames.close();
 
     update_kinfu_thread.join();
 }
@@ -1,10 +1,15 @@
 #include <pcl_utils/occluded_region_finder.h>
+#include <pcl/common/centroid.h>
 #include <pcl/common/transforms.h>
 #include <pcl_utils/timer.h>
+#include <pcl_utils/cloud_writer.h>
+#include <pcl_utils/cloud_crop.h>
 #include <pcl_utils/plane_recognition.h>
+#include <pcl_utils/transform_cache.h>
 #include <tf/transform_listener.h>
 #include <tf/transform_datatypes.h>
 #include <tf_conversions/tf_eigen.h>
+#include <cstring>
 
 namespace occluded_region_finder
 {
@@ -38,25 +43,24 @@ void publish_graspable(pcl::PointCloud<pcl::PointXYZ>::Ptr zero_crossing_cloud,
 	float table_cutoff;
 	ros::param::param<float>("/occlusion_parameters/table_cutoff_above", table_cutoff, 0.005f);
 	pcl::PointCloud<pcl::PointXYZ> new_points;
-	tf::TransformListener listener;
 	tf::StampedTransform tf_transform;
-	listener.waitForTransform("/kinfu_frame", "/base_link", ros::Time(0), ros::Duration(5));
-	listener.lookupTransform("/kinfu_frame", "/base_link", ros::Time(0), tf_transform);
+	if (!transform_cache::lookup_transform("/kinfu_frame", "/base_link", ros::Time(0), &tf_transform))
+	{
+		std::cout << "no transform from /kinfu_frame to /base_link, not publishing graspable points" << std::endl;
+		return;
+	}
 	Eigen::Affine3d transform_affine;
 	tf::transformTFToEigen(tf_transform, transform_affine);
-	for (pcl::PointCloud<pcl::PointXYZ>::iterator iter = zero_crossing_cloud->begin();
-			iter != zero_crossing_cloud->end(); iter++)
+
+	// the points inside the work space and above the table, moved to /base_link
+	cloud_crop::Crop crop;
+	crop.transform = transform_affine.inverse().cast<float>();
+	crop.set_box(Eigen::Vector3f(min_x, min_y, min_z), Eigen::Vector3f(max_x, max_y, max_z));
+	if (plane_coeff->values.size() == 4)
 	{
-		if (iter->x >= min_x && iter->x <= max_x &&
-				iter->y >= min_y && iter->y <= max_y &&
-				iter->z >= min_z && iter->z <= max_z) {
-			if (plane_coeff->values[0] * iter->x + plane_coeff->values[1] * iter->y + plane_coeff->values[2] * iter->z + plane_coeff->values[3] - table_cutoff >= 0) {
-				pcl::PointXYZ new_point;
-				new_point = pcl::transformPoint(*iter, transform_affine.inverse());
-				new_points.push_back(new_point);
-			}
-		}
+		crop.set_plane(cloud_crop::ABOVE_PLANE, Eigen::Vector4f(plane_coeff->values[0], plane_coeff->values[1], plane_coeff->values[2], plane_coeff->values[3]), table_cutoff);
 	}
+	cloud_crop::crop_points(*zero_crossing_cloud, crop, &new_points);
 
 	sensor_msgs::PointCloud2 cloud_msg;
 	pcl::toROSMsg(new_points, cloud_msg);
@@ -185,8 +189,321 @@ Eigen::Vector2i calculate_face(pcl::PointXYZ min_point_OBB, pcl::PointXYZ max_po
 }
 
 
-void find_occluded_regions(std::vector<float> tsdf_distances, std::vector<short> tsdf_weights, pcl::PointCloud<pcl::PointXYZ>::Ptr current_cloud_ptr, Eigen::Matrix4d transformation_matrix, bool saving, std::string outfile,
-		ros::Publisher markers_pub, ros::Publisher points_pub, ros::Publisher regions_pub, ros::Publisher plane_pub, ros::Publisher object_points_pub, ros::Publisher plane_points_pub)
+/** Finds the occluded region behind a single cluster. Only touches its own result, so clusters can be processed in parallel. */
+void process_cluster(const pcl::PointCloud<pcl::PointXYZ>& cluster, int j, bool rotate_box, const cluster_projection::OccludedSpaceIndex& inverse_index,
+		pcl::PointCloud<pcl::PointXYZ>::Ptr zero_crossing_cloud, Eigen::Matrix4d transformation_matrix, pcl::ModelCoefficients::Ptr plane_coeff,
+		float table_cutoff, bool face_use_eigenvalues, bool keep_region_cloud, ros::Publisher plane_pub, ClusterResult* result)
+{
+	Timer timer2 = Timer();
+	Timer timer3 = Timer();
+	Timer_tic(&timer3);
+	std::stringstream log;
+	log << std::endl << "cluster: " << j << std::endl;
+	result->has_region = false;
+	result->has_query = false;
+	result->occluded_region = pcl::PointCloud<pcl::PointXYZ>::Ptr(new pcl::PointCloud<pcl::PointXYZ>);
+	pcl::PointCloud<pcl::PointXYZ>::Ptr occluded_region = result->occluded_region;
+	pcl::PointCloud<pcl::PointXYZ>::Ptr current_cloud(new pcl::PointCloud<pcl::PointXYZ>(cluster));
+	pcl::PointCloud<pcl::PointXYZ>::Ptr transformed_occluded_region(new pcl::PointCloud<pcl::PointXYZ>);
+	pcl::PointCloud<pcl::PointXYZ>::Ptr transformed_current_cloud(new pcl::PointCloud<pcl::PointXYZ>);
+	visualization_msgs::MarkerArrayPtr markers(new visualization_msgs::MarkerArray);
+
+	pcl_utils::OccludedRegion& region = result->region;
+
+	log << "number of points: " << current_cloud->size() << std::endl;
+
+	pcl::PointXYZ centroid;
+	pcl::computeCentroid(*current_cloud, centroid);
+	// clusters below the table are skipped, if a table was found
+	if (plane_coeff->values.size() == 4 &&
+			plane_coeff->values[0] * centroid.x + plane_coeff->values[1] * centroid.y + plane_coeff->values[2] * centroid.z + plane_coeff->values[3] - table_cutoff < 0) {
+		result->log = log.str();
+		return;
+	}
+
+	Eigen::Matrix<double, 4, 1> mean;
+	Eigen::Matrix3d covariance;
+
+	pcl::transformPointCloud(*current_cloud, *transformed_current_cloud, transformation_matrix);
+
+	Timer_tic(&timer2);
+	bounding_box::OrientedBoundingBox obb;
+	bounding_box::compute_obb(*transformed_current_cloud, &obb);
+
+	pcl::PointXYZ min_point_OBB = obb.min_point;
+	pcl::PointXYZ max_point_OBB = obb.max_point;
+	pcl::PointXYZ position_OBB = obb.position;
+	Eigen::Matrix3f rotational_matrix_OBB = obb.rotational_matrix;
+	float major_value = obb.major_value, middle_value = obb.middle_value, minor_value = obb.minor_value;
+	Eigen::Vector3f mass_center = obb.mass_center;
+
+	if (face_use_eigenvalues) {
+		min_point_OBB.x = -major_value;
+		min_point_OBB.y = -middle_value;
+		min_point_OBB.z = -minor_value;
+		min_point_OBB.x = major_value;
+		min_point_OBB.y = middle_value;
+		min_point_OBB.z = minor_value;
+	}
+
+	log << "cluster feature extraction: " << Timer_toc(&timer2) << std::endl;
+	Eigen::Vector3f position (position_OBB.x, position_OBB.y, position_OBB.z);
+	std::vector<Eigen::Vector3f> corners;
+
+	Timer_tic(&timer2);
+	Eigen::Vector2i directions = calculate_face(min_point_OBB, max_point_OBB, position, rotational_matrix_OBB, j, markers, &region, &corners, rotate_box);
+	log << "corners size: " << corners.size() << std::endl;
+	log << "calculate front face: " << Timer_toc(&timer2) << std::endl;
+
+
+	// the region's moments are accumulated while its points are found; the points are only kept for the debugging output
+	Timer_tic(&timer2);
+	bounding_box::Moments moments;
+	cluster_projection::calculate_occluded(*current_cloud, inverse_index, zero_crossing_cloud, transformation_matrix, plane_coeff,
+			directions(0), directions(1), min_point_OBB, max_point_OBB, position, rotational_matrix_OBB, markers, corners, plane_pub,
+			&moments, keep_region_cloud ? occluded_region.get() : NULL, &result->query, &log);
+	result->has_query = true;
+	log << "cluster projection: " << Timer_toc(&timer2) << std::endl;
+	log << "occluded_region size: " << moments.count << std::endl;
+
+	if (moments.count > 0) // TODO: filter based on number of points?
+	{
+		// as pcl::compute3DCentroid and pcl::computeCovarianceMatrixNormalized return them
+		mean << moments.mean, 1;
+		covariance = moments.covariance();
+
+
+		region.gaussian.mean.x = mean(0);
+		region.gaussian.mean.y = mean(1);
+		region.gaussian.mean.z = mean(2);
+
+		for (int x = 0; x < covariance.rows(); x++)
+		{
+			for (int y = 0; y < covariance.cols(); y++)
+			{
+				region.gaussian.covariance.push_back(covariance(x, y));
+			}
+		}
+
+
+
+//			viewer->addPointCloud<pcl::PointXYZ> (transformed_current_cloud, ss.str());
+		if (mass_center.norm() < mean.norm())
+		{
+
+//				direction = 20;
+//				viewer->addPointCloud<pcl::PointXYZ> (transformed_occluded_region, ss2.str());
+
+
+			Timer_tic(&timer2);
+			bounding_box::OrientedBoundingBox obb;
+			bounding_box::compute_axes(moments, &obb);
+
+			float major_value = obb.major_value, middle_value = obb.middle_value, minor_value = obb.minor_value;
+			Eigen::Vector3f major_vector = obb.major_vector, middle_vector = obb.middle_vector, minor_vector = obb.minor_vector;
+			Eigen::Vector3f mass_center = obb.mass_center;
+
+
+			log << "occluded region feature extraction: " << Timer_toc(&timer2) << std::endl;
+
+			if (major_value != 0 && middle_value != 0 && minor_value != 0)
+			{
+
+				Eigen::Matrix3f eigenvector_rotation;
+				eigenvector_rotation.block<3,1>(0, 0) = major_vector;
+				eigenvector_rotation.block<3,1>(0, 1) = middle_vector;
+				eigenvector_rotation.block<3,1>(0, 2) = minor_vector;
+
+				Eigen::Quaternion<float> eigen_quat(eigenvector_rotation);
+
+
+				std::stringstream ss3;
+				ss3 << "sphere" << j;
+//					viewer->addSphere(position_OBB, 0.005, ss3.str());
+				pcl::PointXYZ p;
+				p.x = mass_center(0);
+				p.y = mass_center(1);
+				p.z = mass_center(2);
+//					ss3 << "sphere max corner" << j;
+//					viewer->addSphere(max_point_OBB, 0.005, ss3.str());
+//					ss3 << "sphere min corner" << j;
+//					viewer->addSphere(min_point_OBB, 0.005, ss3.str());
+//					log << "position: " << std::endl << position << std::endl;
+//					log << "min: " << std::endl << min_point_OBB << std::endl;
+//					log << "max: " << std::endl << max_point_OBB << std::endl;
+
+//					Eigen::Quaternionf quat (rotational_matrix_OBB);
+
+				visualization_msgs::Marker marker;
+				marker.header.frame_id = "/camera_rgb_optical_frame";
+				marker.header.stamp = ros::Time::now();
+				//marker.header.seq = j;
+				marker.id = j + 500;
+				marker.type = visualization_msgs::Marker::SPHERE;
+				marker.action = visualization_msgs::Marker::ADD;
+				marker.pose.position.x = mass_center(0);
+				marker.pose.position.y = mass_center(1);
+				marker.pose.position.z = mass_center(2);
+				marker.pose.orientation.x = eigen_quat.x();
+				marker.pose.orientation.y = eigen_quat.y();
+				marker.pose.orientation.z = eigen_quat.z();
+				marker.pose.orientation.w = eigen_quat.w();
+				marker.scale.x = isnanf(2 * sqrt(major_value)) ? 0 : (2 * sqrt(major_value));
+				marker.scale.y = isnanf(2 * sqrt(middle_value)) ? 0 : (2 * sqrt(middle_value)); //(min_direction != 1) * (max_point_OBB.y - min_point_OBB.y);
+				marker.scale.z = isnanf(2 * sqrt(minor_value)) ? 0 : (2 * sqrt(minor_value)); //(min_direction != 2) * (max_point_OBB.z - min_point_OBB.z);
+				marker.color.a = 0.3;
+				marker.color.r = 0.0;
+				marker.color.g = 0.0;
+				marker.color.b = 1.0;
+
+				markers->markers.push_back(marker);
+
+				//visualization_msgs::Marker marker;
+				marker.header.frame_id = "/camera_rgb_optical_frame";
+				marker.header.stamp = ros::Time::now();
+				//marker.header.
+				marker.id = j + 20000;
+				marker.type = visualization_msgs::Marker::CUBE;
+				marker.action = visualization_msgs::Marker::ADD;
+				marker.pose.position.x = mass_center(0);
+				marker.pose.position.y = mass_center(1);
+				marker.pose.position.z = mass_center(2);
+				marker.pose.orientation.x = 0;
+				marker.pose.orientation.y = 0;
+				marker.pose.orientation.z = 0;
+				marker.pose.orientation.w = 1;
+				marker.scale.x = 0.01;
+				marker.scale.y = 0.01;
+				marker.scale.z = 0.01;
+				marker.color.a = 0.5;
+				marker.color.r = 1.0;
+				marker.color.g = 0.0;
+				marker.color.b = 0.0;
+
+				markers->markers.push_back(marker);
+
+				// the clouds are published in cluster order once all clusters are done
+				if (keep_region_cloud)
+				{
+					pcl::transformPointCloud(*occluded_region, *transformed_occluded_region, transformation_matrix);
+					toROSMsg(*transformed_occluded_region, result->occluded_cloud_msg);
+					result->occluded_cloud_msg.header.frame_id = "/camera_rgb_optical_frame";
+				}
+
+				toROSMsg(*transformed_current_cloud, region.points);
+				region.points.header.frame_id = "/camera_rgb_optical_frame";
+
+				result->has_region = true;
+			} // all eigenvalues non-zero
+
+		}
+		else
+		{
+			log << "cloud " << j << "isn't behind its occlusion" << std::endl;
+			log << markers->markers.size() << std::endl;
+			markers->markers.pop_back();
+			log << markers->markers.size() << std::endl;
+		}
+	}
+	else
+	{
+		log << "cloud " << j << "is too small" << std::endl;
+		log << markers->markers.size() << std::endl;
+		markers->markers.pop_back();
+		log << markers->markers.size() << std::endl;
+	}
+
+	log << "cluster " << j << " total time: " << Timer_toc(&timer3) << std::endl;
+	result->markers = *markers;
+	result->log = log.str();
+}
+
+
+void OcclusionCache::clear()
+{
+	converter.clear();
+	valid = false;
+	clusters.clear();
+	results.clear();
+}
+
+const char* StageStatistics::stage_name(int stage)
+{
+	static const char* names[NUM_STAGES] = {"convert", "plane", "clusters", "occlusion", "markers", "save"};
+	return stage >= 0 && stage < NUM_STAGES ? names[stage] : "unknown";
+}
+
+StageStatistics::StageStatistics() : count_allocations(NULL)
+{
+	clear();
+}
+
+void StageStatistics::clear()
+{
+	for (int i = 0; i < NUM_STAGES; i++)
+	{
+		seconds[i] = 0;
+		allocations[i] = 0;
+		allocated_bytes[i] = 0;
+	}
+	num_clusters = 0;
+	num_clusters_processed = 0;
+}
+
+void StageStatistics::begin(Stage stage)
+{
+	if (count_allocations != NULL)
+		count_allocations(&start_allocations[stage], &start_bytes[stage]);
+	Timer_tic(&timers[stage]);
+}
+
+void StageStatistics::end(Stage stage)
+{
+	seconds[stage] += Timer_toc(&timers[stage]);
+	if (count_allocations != NULL)
+	{
+		uint64_t current_allocations, current_bytes;
+		count_allocations(&current_allocations, &current_bytes);
+		allocations[stage] += current_allocations - start_allocations[stage];
+		allocated_bytes[stage] += current_bytes - start_bytes[stage];
+	}
+}
+
+/** Identifies a cluster between calls by its points, which come out of cluster extraction in a fixed order. */
+static uint64_t cluster_key(const pcl::PointCloud<pcl::PointXYZ>& cluster, bool rotate_box)
+{
+	uint64_t key = 0xcbf29ce484222325ULL ^ rotate_box;
+	for (size_t i = 0; i < cluster.size(); i++)
+	{
+		const float coordinates[3] = {cluster.points[i].x, cluster.points[i].y, cluster.points[i].z};
+		for (int k = 0; k < 3; k++)
+		{
+			uint32_t bits;
+			memcpy(&bits, &coordinates[k], sizeof(bits));
+			key = (key ^ bits) * 0x100000001b3ULL;
+		}
+	}
+	return key;
+}
+
+/** Whether a cached result is still valid: none of the changed parts of the volume may reach its occlusion frustum. */
+static bool can_reuse(const ClusterResult& result, const tsdf_converter::IncrementalConverter& converter, const Eigen::Matrix4d& transformation_matrix)
+{
+	if (!result.has_query)
+		return true;
+
+	const std::vector<tsdf_converter::IncrementalConverter::Region>& changed = converter.changed_regions();
+	for (size_t i = 0; i < changed.size(); i++)
+	{
+		if (result.query.may_intersect(changed[i].min, changed[i].max, transformation_matrix))
+			return false;
+	}
+	return true;
+}
+
+void find_occluded_regions(const tsdf_converter::TsdfVolumeView& tsdf, pcl::PointCloud<pcl::PointXYZ>::Ptr current_cloud_ptr, Eigen::Matrix4d transformation_matrix, bool saving, std::string outfile,
+		ros::Publisher markers_pub, ros::Publisher points_pub, ros::Publisher regions_pub, ros::Publisher plane_pub, ros::Publisher object_points_pub, ros::Publisher plane_points_pub,
+		OcclusionCache* cache, StageStatistics* stages, const std::vector<char>* changed_blocks)
 {
 	float table_cutoff;
 	ros::param::param<float>("/occlusion_parameters/table_cutoff_above", table_cutoff, 0.005f);
@@ -205,311 +522,208 @@ void find_occluded_regions(std::vector<float> tsdf_distances, std::vector<short>
 
 	Timer timer = Timer();
 	Timer timer2 = Timer();
-	Timer timer3 = Timer();
 
+	if (stages != NULL)
+		stages->begin(StageStatistics::CONVERT);
 	Timer_tic(&timer);
-	tsdf_converter::convert_tsdf(tsdf_distances, tsdf_weights, zero_crossing_cloud, foreground_cloud, inverse_cloud);
+	if (cache != NULL)
+	{
+		cache->converter.convert(tsdf, zero_crossing_cloud, foreground_cloud, inverse_cloud, changed_blocks);
+	}
+	else
+	{
+		tsdf_converter::convert_tsdf(tsdf, zero_crossing_cloud, foreground_cloud, inverse_cloud);
+	}
 	std::cout << "convert tsdf: " << Timer_toc(&timer) << std::endl;
+	if (stages != NULL)
+		stages->end(StageStatistics::CONVERT);
 
 	std::cout << "converted tsdf vectors" << std::endl;
 	std::cout << "zero crossing: " << zero_crossing_cloud->width << std::endl;
 	std::cout << "foreground: " << foreground_cloud->width << std::endl;
 	std::cout << "inverse crossing: " << inverse_cloud->width << std::endl;
 
-	// fit a plane to the zero-crossing points to find a table top
-	pcl::ModelCoefficients::Ptr plane_coeff(new pcl::ModelCoefficients);
-	pcl::PointIndices::Ptr unused(new pcl::PointIndices);
-	plane_recognition::calculate_plane(zero_crossing_cloud, unused, plane_coeff, plane_pub, markers, plane_points_pub); // was zero_crossing_cloud
+	// downsample the zero-crossing points and fit the table top once, for both the table and the clusters
+	if (stages != NULL)
+		stages->begin(StageStatistics::PLANE);
+	Timer_tic(&timer);
+	scene_segmentation::Scene scene;
+	scene_segmentation::segment_scene(zero_crossing_cloud, tsdf.voxel_size().maxCoeff(), &scene);
+	std::cout << "scene segmentation: " << Timer_toc(&timer) << std::endl;
+	pcl::ModelCoefficients::Ptr plane_coeff = scene.table_coefficients;
+	plane_recognition::calculate_plane(scene, plane_pub, markers, plane_points_pub);
 
 	occluded_region_finder::publish_graspable(current_cloud_ptr, plane_coeff, object_points_pub); // was zero_crossing_cloud
+	if (stages != NULL)
+	{
+		stages->end(StageStatistics::PLANE);
+		stages->begin(StageStatistics::CLUSTERS);
+	}
 
 	Timer_tic(&timer);
 
+	bool face_use_eigenvalues;
+	ros::param::param<bool>("/occlusion_parameters/face_use_eigenvalues", face_use_eigenvalues, false);
+	// the occluded points themselves are only gathered if they are published, as they always were by default, or saved
+	bool publish_occluded_points;
+	ros::param::param<bool>("/occlusion_parameters/publish_occluded_points", publish_occluded_points, true);
+	bool keep_region_clouds = saving || publish_occluded_points;
+	float plane_tolerance;
+	ros::param::param<float>("/occlusion_parameters/incremental_plane_tolerance", plane_tolerance, 0.002f);
+
+	// cached results only hold if the camera, the table and the parameters stayed the same
+	bool use_cache = cache != NULL && cache->valid && !cache->converter.all_changed() &&
+			cache->transformation_matrix == transformation_matrix && cache->table_cutoff == table_cutoff &&
+			cache->face_use_eigenvalues == face_use_eigenvalues && cache->keep_region_clouds == keep_region_clouds &&
+			cache->plane_coefficients.size() == plane_coeff->values.size();
+	for (size_t i = 0; use_cache && i < plane_coeff->values.size(); i++)
+	{
+		use_cache = std::fabs(cache->plane_coefficients[i] - plane_coeff->values[i]) <= plane_tolerance;
+	}
+
 	std::vector<pcl::PointCloud<pcl::PointXYZ> >* clusters = new std::vector<pcl::PointCloud<pcl::PointXYZ> >;
-	int num_plane_clusters = cluster_extraction::extract_clusters(zero_crossing_cloud, clusters, plane_points_pub);
+	int num_plane_clusters;
+	if (cache != NULL && cache->valid && !cache->converter.all_changed() && cache->converter.changed_regions().empty())
+	{
+		// the zero crossings did not change
+		*clusters = cache->clusters;
+		num_plane_clusters = cache->num_plane_clusters;
+	}
+	else
+	{
+		num_plane_clusters = cluster_extraction::extract_clusters(scene, clusters, plane_points_pub);
+	}
 	std::cout << "number of planar clusters: " << num_plane_clusters << std::endl;
 	std::cout << "number of regular clusters: " << clusters->size() - num_plane_clusters << std::endl;
 
 	std::cout << "cluster extraction: " << Timer_toc(&timer) << std::endl;
+	if (stages != NULL)
+	{
+		stages->end(StageStatistics::CLUSTERS);
+		stages->begin(StageStatistics::OCCLUSION);
+	}
 
 	Timer_tic(&timer);
 
-	pcl::PointCloud<pcl::PointXYZ>::Ptr projected_inverse(new pcl::PointCloud<pcl::PointXYZ>);
-	pcl::PointCloud<pcl::PointXYZ>::Ptr transformed_inverse(new pcl::PointCloud<pcl::PointXYZ>);
-
+	int num_clusters = clusters->size();
+	std::cout << "number of clusters: " << num_clusters << std::endl;
+	std::vector<ClusterResult> results(num_clusters);
+	std::vector<uint64_t> keys(num_clusters);
 
-	std::vector<Eigen::Matrix<double, 4, 1> > means;
-	std::vector<Eigen::Matrix3d> covariances;
-
-	Eigen::Matrix<double, 4, 1> mean;
-	Eigen::Matrix3d covariance;
-
-	pcl_utils::OccludedRegionArray regions;
-
-	int j = 1;
-	std::vector<pcl::PointCloud<pcl::PointXYZ> >::iterator cluster_iter;
-	std::cout << "number of clusters: " << clusters->size() << std::endl;
-	for (cluster_iter = clusters->begin(); cluster_iter != clusters->end(); cluster_iter++, j++)
+	// take the results of unchanged clusters from the last call
+	std::vector<int> to_process;
+	for (int i = 0; i < num_clusters; i++)
 	{
-		Timer_tic(&timer3);
-		std::cout << std::endl << "cluster: " << j << std::endl;
-		pcl::PointCloud<pcl::PointXYZ>::Ptr occluded_region(new pcl::PointCloud<pcl::PointXYZ>);
-		pcl::PointCloud<pcl::PointXYZ>::Ptr current_cloud(new pcl::PointCloud<pcl::PointXYZ>);
-		pcl::PointCloud<pcl::PointXYZ>::Ptr transformed_occluded_region(new pcl::PointCloud<pcl::PointXYZ>);
-		pcl::PointCloud<pcl::PointXYZ>::Ptr transformed_current_cloud(new pcl::PointCloud<pcl::PointXYZ>);
-
-		pcl_utils::OccludedRegion region;
-
-		*current_cloud = *cluster_iter;
-		std::cout << "number of points: " << current_cloud->size() << std::endl;
-
-		pcl::PointXYZ centroid;
-		pcl::computeCentroid(*current_cloud, centroid);
-		if (plane_coeff->values[0] * centroid.x + plane_coeff->values[1] * centroid.y + plane_coeff->values[2] * centroid.z + plane_coeff->values[3] - table_cutoff < 0) {
-			continue;
-		}
-
-		pcl::transformPointCloud(*current_cloud, *transformed_current_cloud, transformation_matrix);
+		int j = i + 1;
+		keys[i] = cluster_key((*clusters)[i], j > num_plane_clusters);
+		bool reused = false;
+		for (size_t k = 0; use_cache && !reused && k < cache->results.size(); k++)
+		{
+			const OcclusionCache::CachedCluster& cached = cache->results[k];
+			if (cached.key != keys[i] || !can_reuse(cached.result, cache->converter, transformation_matrix))
+				continue;
 
-		Timer_tic(&timer2);
-		pcl::MomentOfInertiaEstimation <pcl::PointXYZ> feature_extractor;
-//		feature_extractor.setInputCloud (transformed_occluded_region);
-		feature_extractor.setInputCloud(transformed_current_cloud);
-//		feature_extractor.setInputCloud(cloud_filtered);
-		feature_extractor.compute ();
-
-
-		pcl::PointXYZ min_point_OBB;
-		pcl::PointXYZ max_point_OBB;
-		pcl::PointXYZ position_OBB;
-		Eigen::Matrix3f rotational_matrix_OBB;
-		float major_value, middle_value, minor_value;
-		Eigen::Vector3f major_vector, middle_vector, minor_vector;
-		Eigen::Vector3f mass_center;
-
-		feature_extractor.getOBB (min_point_OBB, max_point_OBB, position_OBB, rotational_matrix_OBB);
-		feature_extractor.getEigenValues (major_value, middle_value, minor_value);
-		feature_extractor.getEigenVectors (major_vector, middle_vector, minor_vector);
-		feature_extractor.getMassCenter (mass_center);
-
-		bool face_use_eigenvalues;
-		ros::param::param<bool>("/occlusion_parameters/face_use_eigenvalues", face_use_eigenvalues, false);
-
-		if (face_use_eigenvalues) {
-			min_point_OBB.x = -major_value;
-			min_point_OBB.y = -middle_value;
-			min_point_OBB.z = -minor_value;
-			min_point_OBB.x = major_value;
-			min_point_OBB.y = middle_value;
-			min_point_OBB.z = minor_value;
+			// the marker ids are offset by the cluster number
+			results[i] = cached.result;
+			for (size_t m = 0; m < results[i].markers.markers.size(); m++)
+			{
+				results[i].markers.markers[m].id += j - cached.j;
+				results[i].markers.markers[m].header.stamp = ros::Time::now();
+			}
+			std::stringstream log;
+			log << std::endl << "cluster: " << j << " is unchanged since the last call" << std::endl;
+			results[i].log = log.str();
+			reused = true;
 		}
+		if (!reused)
+			to_process.push_back(i);
+	}
+	if (cache != NULL)
+		std::cout << "clusters to process: " << to_process.size() << " of " << num_clusters << std::endl;
 
-		std::cout << "cluster feature extraction: " << Timer_toc(&timer2) << std::endl;
-		Eigen::Vector3f position (position_OBB.x, position_OBB.y, position_OBB.z);
-		std::vector<Eigen::Vector3f> corners;
-
+	if (!to_process.empty())
+	{
+		// index the inverse cloud once, as it does not vary between clusters
+		float index_block_size;
+		ros::param::param<float>("/occlusion_parameters/occluded_space_block_size", index_block_size, 0.1f);
 		Timer_tic(&timer2);
-		Eigen::Vector2i directions = calculate_face(min_point_OBB, max_point_OBB, position, rotational_matrix_OBB, j, markers, &region, &corners, j > num_plane_clusters);
-		std::cout << "corners size: " << corners.size() << std::endl;
-		std::cout << "calculate front face: " << Timer_toc(&timer2) << std::endl;
+		cluster_projection::OccludedSpaceIndex inverse_index(inverse_cloud, transformation_matrix, index_block_size);
+		std::cout << "indexing inverse cloud: " << Timer_toc(&timer2) << " (" << inverse_index.blocks.size() << " blocks)" << std::endl;
 
+		// the clusters are independent, so process them in parallel and assemble the results in cluster order; a
+		// single cluster is processed by itself so that calculate_occluded can split its blocks between the threads
+		int num_to_process = to_process.size();
 
-		Timer_tic(&timer2);
-		*occluded_region = cluster_projection::calculate_occluded(*current_cloud, inverse_cloud, zero_crossing_cloud, transformation_matrix, transformed_inverse, projected_inverse, plane_coeff,
-				directions(0), directions(1), min_point_OBB, max_point_OBB, position, rotational_matrix_OBB, markers, corners, plane_pub);
-		std::cout << "cluster projection: " << Timer_toc(&timer2) << std::endl;
-		std::cout << "occluded_region size: " << occluded_region->size() << std::endl;
-
-		if (occluded_region->size() > 0) // TODO: filter based on number of points?
+		#ifdef _OPENMP
+		#pragma omp parallel for schedule(dynamic, 1) if (num_to_process > 1)
+		#endif
+		for (int n = 0; n < num_to_process; n++)
 		{
-			pcl::transformPointCloud(*occluded_region, *transformed_occluded_region, transformation_matrix);
-
-			Timer_tic(&timer2);
-			pcl::compute3DCentroid(*transformed_occluded_region, mean);
-//			pcl::computeCovarianceMatrix(*transformed_occluded_region, mean, covariance);
-			pcl::computeCovarianceMatrixNormalized(*transformed_occluded_region, mean, covariance); // ????
-			std::cout << "calculate mean/cov: " << Timer_toc(&timer2) << std::endl;
+			int i = to_process[n];
+			int j = i + 1;
+			process_cluster((*clusters)[i], j, j > num_plane_clusters, inverse_index, zero_crossing_cloud, transformation_matrix, plane_coeff,
+					table_cutoff, face_use_eigenvalues, keep_region_clouds, plane_pub, &results[i]);
+		}
+	}
 
+	if (cache != NULL)
+	{
+		cache->valid = true;
+		cache->transformation_matrix = transformation_matrix;
+		cache->plane_coefficients = plane_coeff->values;
+		cache->table_cutoff = table_cutoff;
+		cache->face_use_eigenvalues = face_use_eigenvalues;
+		cache->keep_region_clouds = keep_region_clouds;
+		cache->clusters = *clusters;
+		cache->num_plane_clusters = num_plane_clusters;
+		cache->results.resize(num_clusters);
+		for (int i = 0; i < num_clusters; i++)
+		{
+			cache->results[i].key = keys[i];
+			cache->results[i].j = i + 1;
+			cache->results[i].result = results[i];
+		}
+	}
+	if (stages != NULL)
+	{
+		stages->end(StageStatistics::OCCLUSION);
+		stages->num_clusters += num_clusters;
+		stages->num_clusters_processed += to_process.size();
+		stages->begin(StageStatistics::MARKERS);
+	}
 
-			means.push_back(mean);
-			covariances.push_back(covariance);
+	pcl_utils::OccludedRegionArray regions;
 
-			region.gaussian.mean.x = mean(0);
-			region.gaussian.mean.y = mean(1);
-			region.gaussian.mean.z = mean(2);
+	// debugging output is written on the shared writer thread, so it does not hold up the request
+	std::string pcd_format;
+	ros::param::param<std::string>("/occlusion_parameters/pcd_format", pcd_format, "binary_compressed");
+	cloud_writer::Format format = cloud_writer::parse_format(pcd_format);
+	bool async_pcd_writing;
+	ros::param::param<bool>("/occlusion_parameters/async_pcd_writing", async_pcd_writing, true);
 
-			for (int x = 0; x < covariance.rows(); x++)
-			{
-				for (int y = 0; y < covariance.cols(); y++)
-				{
-					region.gaussian.covariance.push_back(covariance(x, y));
-				}
-			}
+	for (int i = 0; i < num_clusters; i++)
+	{
+		ClusterResult& result = results[i];
+		std::cout << result.log;
 
-			std::stringstream ss;
-			ss << outfile << "_cloud_cluster_" << j << ".pcd";
-			std::stringstream ss2;
-			ss2 << outfile << "_occluded_region_" << j << ".pcd";
+		markers->markers.insert(markers->markers.end(), result.markers.markers.begin(), result.markers.markers.end());
 
-			if (saving)
+		if (result.has_region)
+		{
+			if (publish_occluded_points)
 			{
-				pcl::io::savePCDFileASCII(ss.str(), *current_cloud);
-				try
-				{
-					pcl::io::savePCDFileASCII(ss2.str(), *occluded_region);
-				}
-				catch (pcl::IOException)
-				{
-					std::cout << "couldn't find occluded region for cluster " << j << std::endl;
-				}
+				result.occluded_cloud_msg.header.stamp = ros::Time::now();
+				points_pub.publish(result.occluded_cloud_msg);
+				ros::spinOnce();
 			}
 
+			// also publish the clusters themselves. TODO: make this a separate publisher?
+			result.region.points.header.stamp = ros::Time::now();
+			points_pub.publish(result.region.points);
+			ros::spinOnce();
 
-
-//			viewer->addPointCloud<pcl::PointXYZ> (transformed_current_cloud, ss.str());
-			if (mass_center.norm() < mean.norm())
-			{
-
-//				direction = 20;
-//				viewer->addPointCloud<pcl::PointXYZ> (transformed_occluded_region, ss2.str());
-
-
-				Timer_tic(&timer2);
-				feature_extractor.setInputCloud (transformed_occluded_region);
-//				feature_extractor.setInputCloud(transformed_current_cloud);
-				feature_extractor.compute ();
-
-
-				pcl::PointXYZ min_point_OBB;
-				pcl::PointXYZ max_point_OBB;
-				pcl::PointXYZ position_OBB;
-				Eigen::Matrix3f rotational_matrix_OBB;
-				float major_value, middle_value, minor_value;
-				Eigen::Vector3f major_vector, middle_vector, minor_vector;
-				Eigen::Vector3f mass_center;
-
-				feature_extractor.getOBB (min_point_OBB, max_point_OBB, position_OBB, rotational_matrix_OBB);
-				feature_extractor.getEigenValues (major_value, middle_value, minor_value);
-				feature_extractor.getEigenVectors (major_vector, middle_vector, minor_vector);
-				feature_extractor.getMassCenter (mass_center);
-
-
-				std::cout << "occluded region feature extraction: " << Timer_toc(&timer2) << std::endl;
-
-				if (major_value != 0 && middle_value != 0 && minor_value != 0)
-				{
-
-					Eigen::Matrix3f eigenvector_rotation;
-					eigenvector_rotation.block<3,1>(0, 0) = major_vector;
-					eigenvector_rotation.block<3,1>(0, 1) = middle_vector;
-					eigenvector_rotation.block<3,1>(0, 2) = minor_vector;
-
-					Eigen::Quaternion<float> eigen_quat(eigenvector_rotation);
-
-
-					std::stringstream ss3;
-					ss3 << "sphere" << j;
-//					viewer->addSphere(position_OBB, 0.005, ss3.str());
-					pcl::PointXYZ p;
-					p.x = mass_center(0);
-					p.y = mass_center(1);
-					p.z = mass_center(2);
-//					ss3 << "sphere max corner" << j;
-//					viewer->addSphere(max_point_OBB, 0.005, ss3.str());
-//					ss3 << "sphere min corner" << j;
-//					viewer->addSphere(min_point_OBB, 0.005, ss3.str());
-//					std::cout << "position: " << std::endl << position << std::endl;
-//					std::cout << "min: " << std::endl << min_point_OBB << std::endl;
-//					std::cout << "max: " << std::endl << max_point_OBB << std::endl;
-
-//					Eigen::Quaternionf quat (rotational_matrix_OBB);
-
-					visualization_msgs::Marker marker;
-					marker.header.frame_id = "/camera_rgb_optical_frame";
-					marker.header.stamp = ros::Time::now();
-					//marker.header.seq = j;
-					marker.id = j + 500;
-					marker.type = visualization_msgs::Marker::SPHERE;
-					marker.action = visualization_msgs::Marker::ADD;
-					marker.pose.position.x = mass_center(0);
-					marker.pose.position.y = mass_center(1);
-					marker.pose.position.z = mass_center(2);
-					marker.pose.orientation.x = eigen_quat.x();
-					marker.pose.orientation.y = eigen_quat.y();
-					marker.pose.orientation.z = eigen_quat.z();
-					marker.pose.orientation.w = eigen_quat.w();
-					marker.scale.x = isnanf(2 * sqrt(major_value)) ? 0 : (2 * sqrt(major_value));
-					marker.scale.y = isnanf(2 * sqrt(middle_value)) ? 0 : (2 * sqrt(middle_value)); //(min_direction != 1) * (max_point_OBB.y - min_point_OBB.y);
-					marker.scale.z = isnanf(2 * sqrt(minor_value)) ? 0 : (2 * sqrt(minor_value)); //(min_direction != 2) * (max_point_OBB.z - min_point_OBB.z);
-					marker.color.a = 0.3;
-					marker.color.r = 0.0;
-					marker.color.g = 0.0;
-					marker.color.b = 1.0;
-
-					markers->markers.push_back(marker);
-
-					//visualization_msgs::Marker marker;
-					marker.header.frame_id = "/camera_rgb_optical_frame";
-					marker.header.stamp = ros::Time::now();
-					//marker.header.
-					marker.id = j + 20000;
-					marker.type = visualization_msgs::Marker::CUBE;
-					marker.action = visualization_msgs::Marker::ADD;
-					marker.pose.position.x = mass_center(0);
-					marker.pose.position.y = mass_center(1);
-					marker.pose.position.z = mass_center(2);
-					marker.pose.orientation.x = 0;
-					marker.pose.orientation.y = 0;
-					marker.pose.orientation.z = 0;
-					marker.pose.orientation.w = 1;
-					marker.scale.x = 0.01;
-					marker.scale.y = 0.01;
-					marker.scale.z = 0.01;
-					marker.color.a = 0.5;
-					marker.color.r = 1.0;
-					marker.color.g = 0.0;
-					marker.color.b = 0.0;
-
-					markers->markers.push_back(marker);
-
-					sensor_msgs::PointCloud2 published_cloud;
-					toROSMsg(*transformed_occluded_region, published_cloud);
-					published_cloud.header.frame_id = "/camera_rgb_optical_frame";
-					published_cloud.header.stamp = ros::Time::now();
-					points_pub.publish(published_cloud);
-					ros::spinOnce();
-
-					// also publish the clusters themselves. TODO: make this a separate publisher?
-					toROSMsg(*transformed_current_cloud, published_cloud);
-					published_cloud.header.frame_id = "/camera_rgb_optical_frame";
-					published_cloud.header.stamp = ros::Time::now();
-					points_pub.publish(published_cloud);
-					ros::spinOnce();
-
-
-					region.points = published_cloud;
-
-					regions.regions.push_back(region);
-				} // all eigenvalues non-zero
-
-			}
-			else
-			{
-				std::cout << "cloud " << j << "isn't behind its occlusion" << std::endl;
-				std::cout << markers->markers.size() << std::endl;
-				markers->markers.pop_back();
-				std::cout << markers->markers.size() << std::endl;
-			}
+			regions.regions.push_back(result.region);
 		}
-		else
-		{
-			std::cout << "cloud " << j << "is too small" << std::endl;
-			std::cout << markers->markers.size() << std::endl;
-			markers->markers.pop_back();
-			std::cout << markers->markers.size() << std::endl;
-		}
-
-		std::cout << "cluster " << j << " total time: " << Timer_toc(&timer3) << std::endl;
 	}
 
 	regions.header.frame_id = "/camera_rgb_optical_frame";
@@ -521,23 +735,62 @@ void find_occluded_regions(std::vector<float> tsdf_distances, std::vector<short>
 	//        boost::this_thread::sleep (boost::posix_time::microseconds (100000));
 	//    }
 
+	// the regions go out before the debugging output is written
+	markers_pub.publish(*markers);
+	ros::spinOnce();
+
+	regions_pub.publish(regions);
+	ros::spinOnce();
+	if (stages != NULL)
+	{
+		stages->end(StageStatistics::MARKERS);
+		stages->begin(StageStatistics::SAVE);
+	}
+
 	if (saving)
 	{
+		for (int i = 0; i < num_clusters; i++)
+		{
+			int j = i + 1;
+			ClusterResult& result = results[i];
+			if (result.occluded_region->size() == 0)
+				continue;
+
+			std::stringstream ss;
+			ss << outfile << "_cloud_cluster_" << j << ".pcd";
+			std::stringstream ss2;
+			ss2 << outfile << "_occluded_region_" << j << ".pcd";
+
+			if (async_pcd_writing)
+			{
+				cloud_writer::shared_writer().write(ss.str(), (*clusters)[i], format);
+				cloud_writer::shared_writer().write(ss2.str(), *result.occluded_region, format);
+			}
+			else
+			{
+				cloud_writer::save(ss.str(), (*clusters)[i], format);
+				cloud_writer::save(ss2.str(), *result.occluded_region, format);
+			}
+		}
+
 		pcl::PointCloud<pcl::PointXYZ> transformed_zero_crossing;
 		pcl::transformPointCloud(*zero_crossing_cloud, transformed_zero_crossing, transformation_matrix);
-		pcl::io::savePCDFileASCII(outfile + "_zero.pcd", transformed_zero_crossing);
+		if (async_pcd_writing)
+		{
+			cloud_writer::shared_writer().write(outfile + "_zero.pcd", transformed_zero_crossing, format);
+		}
+		else
+		{
+			cloud_writer::save(outfile + "_zero.pcd", transformed_zero_crossing, format);
+		}
 //		pcl::io::savePCDFileASCII(outfile + "_foreground.pcd", *foreground_cloud);
 //		pcl::io::savePCDFileASCII(outfile + "_inverse.pcd", *inverse_cloud);
 	}
+	if (stages != NULL)
+		stages->end(StageStatistics::SAVE);
 
 	std::cout << "occlusion finding: " << Timer_toc(&timer) << std::endl;
 
-	markers_pub.publish(*markers);
-	ros::spinOnce();
-
-	regions_pub.publish(regions);
-	ros::spinOnce();
-
 }
 
 }
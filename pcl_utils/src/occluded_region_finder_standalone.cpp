@@ -2,9 +2,391 @@
 #include <iostream>
 #include <boost/program_options.hpp>
 #include <pcl_utils/BoundingBox.h>
+#include <pcl_utils/cloud_writer.h>
+#include <pcl_utils/transform_cache.h>
+#include <pcl_utils/tsdf_snapshot.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <set>
+#include <stdexcept>
 
 namespace po = boost::program_options;
 
+#ifdef __GLIBC__
+// For the benchmark, the allocations of the whole process are counted by wrapping glibc's allocator. operator new and
+// Eigen's aligned allocations end up here as well; frees are not counted. Counting is off unless the benchmark turns
+// it on, and each thread counts in its own slot, so the wrappers add no shared writes to the timed code.
+extern "C"
+{
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* pointer, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+}
+
+static bool counting_allocations = false;
+
+struct AllocationSlot
+{
+    uint64_t allocations;
+    uint64_t bytes;
+    char padding[64 - 2 * sizeof(uint64_t)]; // a cache line each
+};
+
+static const int NUM_ALLOCATION_SLOTS = 256;
+static AllocationSlot allocation_slots[NUM_ALLOCATION_SLOTS];
+static int num_allocation_slots = 0;
+// threads beyond NUM_ALLOCATION_SLOTS share the last slot, which is updated atomically
+static __thread int allocation_slot = -1;
+
+static inline void count_allocation(size_t size)
+{
+    if (!counting_allocations)
+        return;
+
+    if (allocation_slot < 0)
+        allocation_slot = std::min(__sync_fetch_and_add(&num_allocation_slots, 1), NUM_ALLOCATION_SLOTS - 1);
+    AllocationSlot& slot = allocation_slots[allocation_slot];
+    if (allocation_slot < NUM_ALLOCATION_SLOTS - 1)
+    {
+        slot.allocations++;
+        slot.bytes += size;
+    }
+    else
+    {
+        __sync_fetch_and_add(&slot.allocations, 1);
+        __sync_fetch_and_add(&slot.bytes, size);
+    }
+}
+
+/** the slots of all threads added up, at the end of a stage when its OpenMP threads are done */
+static void count_allocations(uint64_t* allocations, uint64_t* bytes)
+{
+    __sync_synchronize();
+    *allocations = 0;
+    *bytes = 0;
+    int num_slots = std::min(num_allocation_slots, NUM_ALLOCATION_SLOTS);
+    for (int i = 0; i < num_slots; i++)
+    {
+        *allocations += allocation_slots[i].allocations;
+        *bytes += allocation_slots[i].bytes;
+    }
+}
+
+extern "C"
+{
+void* malloc(size_t size) throw()
+{
+    count_allocation(size);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) throw()
+{
+    count_allocation(count * size);
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* pointer, size_t size) throw()
+{
+    count_allocation(size);
+    return __libc_realloc(pointer, size);
+}
+
+void* memalign(size_t alignment, size_t size) throw()
+{
+    count_allocation(size);
+    return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size) throw()
+{
+    count_allocation(size);
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void** pointer, size_t alignment, size_t size) throw()
+{
+    if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0)
+        return EINVAL;
+    count_allocation(size);
+    void* memory = __libc_memalign(alignment, size);
+    if (memory == NULL)
+        return ENOMEM;
+    *pointer = memory;
+    return 0;
+}
+}
+#endif
+
+/** a volume to find the occluded regions in, from a snapshot or from the .dat dumps and the matrix file */
+struct Volume
+{
+    tsdf_converter::MappedTsdfVolume mapped_tsdf;
+    tsdf_snapshot::Snapshot snapshot;
+    tsdf_converter::TsdfVolumeView tsdf;
+    Eigen::Matrix4d transformation_matrix;
+
+public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+bool load_snapshot(const std::string& snapshot_file, Volume* volume)
+{
+    if (!volume->snapshot.read(snapshot_file)) {
+        std::cerr << "could not read the tsdf snapshot " << snapshot_file << "!" << std::endl;
+        return false;
+    }
+    volume->transformation_matrix = volume->snapshot.transformation_matrix();
+    volume->tsdf = volume->snapshot.view();
+    return true;
+}
+
+bool load_dumps(const std::string& distances_file, const std::string& weights_file, const std::string& matrix_file, Volume* volume)
+{
+    // load in the transformation matrix
+    volume->transformation_matrix = Eigen::Matrix4d::Zero();
+    std::ifstream matrix_instream;
+    matrix_instream.open(matrix_file.c_str());
+    std::string current_input;
+    for (int x = 0; x < volume->transformation_matrix.rows(); x++)
+    {
+        for (int y = 0; y < volume->transformation_matrix.cols(); y++)
+        {
+            getline(matrix_instream, current_input);
+            volume->transformation_matrix(x, y) = std::atof(current_input.c_str());
+        }
+    }
+    matrix_instream.close();
+
+    // map the volume instead of reading it, so it is never copied
+    if (!volume->mapped_tsdf.open(distances_file, weights_file, tsdf_converter::get_volume_geometry())) {
+        std::cerr << "could not map the tsdf files!" << std::endl;
+        return false;
+    }
+    volume->tsdf = volume->mapped_tsdf.view();
+    return true;
+}
+
+/** nearest-rank percentile of values, which are sorted */
+template<typename T>
+T percentile(const std::vector<T>& values, double p)
+{
+    if (values.empty())
+        return T();
+    int rank = (int) std::ceil(p / 100 * values.size()) - 1;
+    return values[std::max(0, std::min((int) values.size() - 1, rank))];
+}
+
+template<typename T>
+double mean(const std::vector<T>& values)
+{
+    double sum = 0;
+    for (size_t i = 0; i < values.size(); i++)
+        sum += values[i];
+    return values.empty() ? 0 : sum / values.size();
+}
+
+/** Points stdout at /dev/null, so that neither printf nor std::cout output of the pipeline reaches the console while
+    it is timed; returns the descriptor to restore it with, or -1 if stdout stays as it is. */
+int mute_stdout()
+{
+    fflush(stdout);
+    std::cout.flush();
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (null_fd < 0)
+        return -1;
+    int saved_fd = dup(STDOUT_FILENO);
+    if (saved_fd >= 0 && dup2(null_fd, STDOUT_FILENO) < 0)
+    {
+        close(saved_fd);
+        saved_fd = -1;
+    }
+    close(null_fd);
+    return saved_fd;
+}
+
+void restore_stdout(int saved_fd)
+{
+    if (saved_fd < 0)
+        return;
+    fflush(stdout);
+    std::cout.flush();
+    dup2(saved_fd, STDOUT_FILENO);
+    close(saved_fd);
+}
+
+/** one line of the benchmark CSV: the distribution of a stage over the runs of a volume */
+void write_stage(std::ostream& csv, const std::string& volume_name, const std::string& stage, std::vector<double> seconds,
+                 std::vector<uint64_t> allocations, std::vector<uint64_t> bytes, double clusters, double clusters_processed)
+{
+    std::sort(seconds.begin(), seconds.end());
+    std::sort(allocations.begin(), allocations.end());
+    std::sort(bytes.begin(), bytes.end());
+    csv << volume_name << "," << stage << "," << seconds.size() << ","
+        << mean(seconds) << "," << seconds.front() << "," << percentile(seconds, 50) << "," << percentile(seconds, 90) << ","
+        << percentile(seconds, 99) << "," << seconds.back() << ","
+        << mean(allocations) << "," << percentile(allocations, 50) << "," << allocations.back() << ","
+        << mean(bytes) << "," << percentile(bytes, 50) << ","
+        << clusters << "," << clusters_processed << std::endl;
+}
+
+/** Runs the whole pipeline warmup times and then runs times on the volume, and writes the distribution of the time
+    and the allocations of each stage and of the whole call to csv. */
+void benchmark(const Volume& volume, const std::string& volume_name, int warmup, int runs, bool incremental, bool saving, const std::string& outfile,
+               bool verbose, ros::Publisher markers_pub, ros::Publisher points_pub, ros::Publisher regions_pub, ros::Publisher plane_pub,
+               ros::Publisher object_points_pub, ros::Publisher plane_points_pub, std::ostream& csv)
+{
+    typedef occluded_region_finder::StageStatistics StageStatistics;
+
+    // as in kinfu, the cache is kept between the calls on a volume, so later runs show the incremental path
+    occluded_region_finder::OcclusionCache cache;
+    std::vector<std::vector<double> > seconds(StageStatistics::NUM_STAGES + 1);
+    std::vector<std::vector<uint64_t> > allocations(StageStatistics::NUM_STAGES + 1), bytes(StageStatistics::NUM_STAGES + 1);
+    double clusters = 0, clusters_processed = 0;
+
+    std::cerr << volume_name << ": " << warmup << " warm-up and " << runs << " timed runs" << std::endl;
+    for (int run = 0; run < warmup + runs; run++)
+    {
+        StageStatistics stages;
+        #ifdef __GLIBC__
+        stages.count_allocations = count_allocations;
+        #endif
+
+        // the pipeline prints a lot, with printf as well as std::cout, and the console would be timed as well
+        int saved_stdout = verbose ? -1 : mute_stdout();
+        pcl::PointCloud<pcl::PointXYZ>::Ptr current_points(new pcl::PointCloud<pcl::PointXYZ>);
+        occluded_region_finder::find_occluded_regions(volume.tsdf, current_points, volume.transformation_matrix, saving, outfile, markers_pub, points_pub, regions_pub,
+                                                      plane_pub, object_points_pub, plane_points_pub, incremental ? &cache : NULL, &stages);
+        restore_stdout(saved_stdout);
+
+        // keep the writer's queue from filling up, outside of the timed stages
+        if (saving)
+            cloud_writer::shared_writer().flush();
+
+        if (run < warmup)
+            continue;
+
+        double total_seconds = 0;
+        uint64_t total_allocations = 0, total_bytes = 0;
+        for (int i = 0; i < StageStatistics::NUM_STAGES; i++)
+        {
+            seconds[i].push_back(stages.seconds[i]);
+            allocations[i].push_back(stages.allocations[i]);
+            bytes[i].push_back(stages.allocated_bytes[i]);
+            total_seconds += stages.seconds[i];
+            total_allocations += stages.allocations[i];
+            total_bytes += stages.allocated_bytes[i];
+        }
+        seconds[StageStatistics::NUM_STAGES].push_back(total_seconds);
+        allocations[StageStatistics::NUM_STAGES].push_back(total_allocations);
+        bytes[StageStatistics::NUM_STAGES].push_back(total_bytes);
+        clusters += stages.num_clusters / (double) runs;
+        clusters_processed += stages.num_clusters_processed / (double) runs;
+        std::cerr << "run " << run - warmup + 1 << " of " << runs << ": " << total_seconds << " s" << std::endl;
+    }
+
+    for (int i = 0; i <= StageStatistics::NUM_STAGES; i++)
+    {
+        write_stage(csv, volume_name, i < StageStatistics::NUM_STAGES ? StageStatistics::stage_name(i) : "total",
+                    seconds[i], allocations[i], bytes[i], clusters, clusters_processed);
+    }
+}
+
+typedef std::multiset<std::vector<float> > PointSet;
+
+/** the points of a cloud regardless of their order, which differs between the converters */
+PointSet point_set(const pcl::PointCloud<pcl::PointXYZ>& cloud)
+{
+    PointSet points;
+    for (size_t i = 0; i < cloud.size(); i++)
+    {
+        std::vector<float> point(3);
+        point[0] = cloud.points[i].x;
+        point[1] = cloud.points[i].y;
+        point[2] = cloud.points[i].z;
+        points.insert(point);
+    }
+    return points;
+}
+
+/** Builds the volume up over steps, as kinfu integrates it: each step copies a random set of its blocks in, or
+    clears them again, and converts it both with an IncrementalConverter that is told which blocks changed and with
+    convert_tsdf. Every third step passes no changed blocks, so the checksums are checked as well. Returns false if
+    the clouds of a step differ. */
+bool check_incremental(const Volume& volume, const std::string& volume_name, int steps)
+{
+    typedef pcl::PointCloud<pcl::PointXYZ> Cloud;
+    const int BLOCK_SIZE = tsdf_converter::IncrementalConverter::BLOCK_SIZE;
+
+    const tsdf_converter::TsdfVolumeView& source = volume.tsdf;
+    Eigen::Vector3i resolution = source.resolution;
+    Eigen::Vector3i num_blocks = (resolution + Eigen::Vector3i::Constant(BLOCK_SIZE - 1)) / BLOCK_SIZE;
+    int total_blocks = num_blocks(0) * num_blocks(1) * num_blocks(2);
+
+    // starts out unobserved
+    std::vector<float> distances(source.num_voxels(), 1.0f);
+    std::vector<short> weights(source.num_voxels(), 0);
+    tsdf_converter::TsdfVolumeView tsdf(&distances[0], &weights[0], source.geometry());
+
+    tsdf_converter::IncrementalConverter converter;
+    srand(1);
+    int failures = 0;
+    std::cerr << volume_name << ": checking incremental conversion over " << steps << " steps" << std::endl;
+    for (int step = 0; step < steps; step++)
+    {
+        // a few blocks on most steps, and a large part of the volume now and then
+        std::vector<char> changed_blocks(total_blocks, 0);
+        int num_changed = (step % 5 == 0) ? total_blocks / 4 : 1 + rand() % 8;
+        for (int i = 0; i < num_changed; i++)
+        {
+            int b = rand() % total_blocks;
+            bool clear = rand() % 5 == 0;
+            changed_blocks[b] = 1;
+
+            Eigen::Vector3i corner = BLOCK_SIZE * Eigen::Vector3i(b % num_blocks(0), b / num_blocks(0) % num_blocks(1), b / (num_blocks(0) * num_blocks(1)));
+            Eigen::Vector3i end = (corner + Eigen::Vector3i::Constant(BLOCK_SIZE)).cwiseMin(resolution);
+            for (int z = corner(2); z < end(2); z++)
+            {
+                for (int y = corner(1); y < end(1); y++)
+                {
+                    for (int x = corner(0); x < end(0); x++)
+                    {
+                        size_t index = tsdf.index(x, y, z);
+                        distances[index] = clear ? 1.0f : source.distances[index];
+                        weights[index] = clear ? 0 : source.weights[index];
+                    }
+                }
+            }
+        }
+
+        Cloud::Ptr zero_crossing(new Cloud), foreground(new Cloud), inverse(new Cloud);
+        Cloud::Ptr incremental_zero_crossing(new Cloud), incremental_foreground(new Cloud), incremental_inverse(new Cloud);
+        tsdf_converter::convert_tsdf(tsdf, zero_crossing, foreground, inverse);
+        converter.convert(tsdf, incremental_zero_crossing, incremental_foreground, incremental_inverse, (step % 3 == 2) ? NULL : &changed_blocks);
+
+        bool same = point_set(*zero_crossing) == point_set(*incremental_zero_crossing) && point_set(*foreground) == point_set(*incremental_foreground)
+                    && point_set(*inverse) == point_set(*incremental_inverse);
+        if (!same)
+            failures++;
+        std::cerr << "step " << step + 1 << " of " << steps << ": " << num_changed << " blocks changed, "
+                  << zero_crossing->size() << "/" << foreground->size() << "/" << inverse->size() << " points, incremental "
+                  << incremental_zero_crossing->size() << "/" << incremental_foreground->size() << "/" << incremental_inverse->size()
+                  << (same ? "" : " MISMATCH") << std::endl;
+    }
+
+    std::cerr << volume_name << ": " << failures << " of " << steps << " steps differ" << std::endl;
+    return failures == 0;
+}
+
 int main(int argc, char** argv)
 {
 
@@ -14,8 +396,10 @@ int main(int argc, char** argv)
 //        exit(1);
 //    }
 
-    std::string infile1, infile2, matrix_file, outfile;
-    bool saving;
+    std::string infile1, infile2, matrix_file, outfile, csv_file;
+    std::vector<std::string> snapshot_files;
+    bool saving, incremental, verbose;
+    int runs, warmup, check_steps;
 
     po::options_description desc("Run the occluded region finder on a pointcloud.");
     desc.add_options()
@@ -23,7 +407,14 @@ int main(int argc, char** argv)
      ("distances-file,d", po::value<std::string >(), "The input file for kinfu distances.")
      ("weights-file,w", po::value<std::string >(), "The input file for kinfu weights.")
      ("matrix-file,m", po::value<std::string >(), "The input file for the transformation matrix.")
-     ("output-file-prefix,o", po::value<std::string >()->default_value(""), "The prefix to be appended to the output files.");
+     ("snapshot-file,t", po::value<std::vector<std::string> >()->composing(), "A tsdf snapshot, instead of the distances, weights and matrix files. Several can be given to benchmark them all.")
+     ("output-file-prefix,o", po::value<std::string >()->default_value(""), "The prefix to be appended to the output files.")
+     ("benchmark,b", po::value<int>()->default_value(0), "Time the stages of this many runs on each volume instead of a single run.")
+     ("warmup", po::value<int>()->default_value(1), "The number of untimed runs on each volume before the benchmark runs.")
+     ("incremental", "Keep the occlusion cache between the benchmark runs on a volume, as kinfu does.")
+     ("check-incremental", po::value<int>()->default_value(0), "Instead of a run, check over this many steps of a growing volume that incremental conversion gives the same clouds as a full one.")
+     ("csv-file,c", po::value<std::string >()->default_value("occlusion_benchmark.csv"), "Where the benchmark writes its statistics.")
+     ("verbose,v", "Keep the output of the pipeline during the benchmark.");
      po::positional_options_description pos;
      pos.add("distances-file", 1);
      pos.add("weights-file", 1);
@@ -38,10 +429,27 @@ int main(int argc, char** argv)
         po::notify(opts);
         saving = opts.count("saving");
         std::cout << "saving: " << saving << std::endl;
-        infile1 = opts["distances-file"].as<std::string >();
-        infile2 = opts["weights-file"].as<std::string >();
-        matrix_file = opts["matrix-file"].as<std::string >();
+        if (opts.count("snapshot-file"))
+        {
+            snapshot_files = opts["snapshot-file"].as<std::vector<std::string> >();
+        }
+        else
+        {
+            infile1 = opts["distances-file"].as<std::string >();
+            infile2 = opts["weights-file"].as<std::string >();
+            matrix_file = opts["matrix-file"].as<std::string >();
+        }
         outfile = opts["output-file-prefix"].as<std::string >();
+        runs = opts["benchmark"].as<int>();
+        check_steps = opts["check-incremental"].as<int>();
+        warmup = std::max(0, opts["warmup"].as<int>());
+        incremental = opts.count("incremental");
+        verbose = opts.count("verbose");
+        csv_file = opts["csv-file"].as<std::string >();
+        if (runs == 0 && check_steps == 0 && snapshot_files.size() > 1)
+        {
+            throw std::runtime_error("only a benchmark or a check takes several snapshot files");
+        }
     }
     catch (std::exception& e)
     {
@@ -58,6 +466,8 @@ int main(int argc, char** argv)
     ros::init(argc, argv, "occlusion_detection");
     //ros::Duration(2).sleep();
     ros::NodeHandle nh("~");
+    // start filling the tf buffer while the files are read
+    transform_cache::get_listener();
     ros::Publisher markers_pub;
     ros::Publisher points_pub;
     ros::Publisher regions_pub, plane_pub, object_points_pub, plane_points_pub;
@@ -71,28 +481,64 @@ int main(int argc, char** argv)
     ros::spinOnce();
 
 
-    // load in the transformation matrix
-    Eigen::Matrix4d transformation_matrix = Eigen::Matrix4d::Zero();
-
-    std::ifstream matrix_instream;
-    matrix_instream.open(matrix_file.c_str());
-    std::string current_input;
-    for (int x = 0; x < transformation_matrix.rows(); x++)
+    if (check_steps > 0)
     {
-        for (int y = 0; y < transformation_matrix.cols(); y++)
+        bool same = true;
+        int num_volumes = snapshot_files.empty() ? 1 : snapshot_files.size();
+        for (int v = 0; v < num_volumes; v++)
         {
-            getline(matrix_instream, current_input);
-            transformation_matrix(x, y) = std::atof(current_input.c_str());
+            Volume volume;
+            std::string volume_name = snapshot_files.empty() ? infile1 : snapshot_files[v];
+            if (snapshot_files.empty() ? !load_dumps(infile1, infile2, matrix_file, &volume) : !load_snapshot(snapshot_files[v], &volume))
+            {
+                return 1;
+            }
+            same = check_incremental(volume, volume_name, check_steps) && same;
         }
+        return same ? 0 : 1;
     }
-    matrix_instream.close();
 
-//    std::cout << "transformation matrix: " << std::endl << transformation_matrix << std::endl;
+    if (runs > 0)
+    {
+        std::ofstream csv(csv_file.c_str());
+        if (!csv)
+        {
+            std::cerr << "could not write " << csv_file << "!" << std::endl;
+            return 1;
+        }
+        csv.precision(10);
+        csv << "volume,stage,runs,mean_s,min_s,p50_s,p90_s,p99_s,max_s,mean_allocations,p50_allocations,max_allocations,"
+            << "mean_bytes,p50_bytes,mean_clusters,mean_clusters_processed" << std::endl;
+        #ifdef __GLIBC__
+        counting_allocations = true;
+        #else
+        std::cerr << "allocations are only counted with glibc" << std::endl;
+        #endif
 
-    std::vector<float>* tsdf_distances = new std::vector<float>;
-    std::vector<short>* tsdf_weights = new std::vector<short>;
+        // one volume is loaded at a time
+        int num_volumes = snapshot_files.empty() ? 1 : snapshot_files.size();
+        for (int v = 0; v < num_volumes; v++)
+        {
+            Volume volume;
+            std::string volume_name = snapshot_files.empty() ? infile1 : snapshot_files[v];
+            if (snapshot_files.empty() ? !load_dumps(infile1, infile2, matrix_file, &volume) : !load_snapshot(snapshot_files[v], &volume))
+            {
+                return 1;
+            }
+            benchmark(volume, volume_name, warmup, runs, incremental, saving, outfile, verbose, markers_pub, points_pub, regions_pub,
+                      plane_pub, object_points_pub, plane_points_pub, csv);
+        }
+        std::cerr << "wrote " << csv_file << std::endl;
+        return 0;
+    }
+
+    Volume volume;
+    if (!snapshot_files.empty() ? !load_snapshot(snapshot_files[0], &volume) : !load_dumps(infile1, infile2, matrix_file, &volume))
+    {
+        return 1;
+    }
 
-    tsdf_converter::read_files(infile1.c_str(), infile2.c_str(), tsdf_distances, tsdf_weights);
+//    std::cout << "transformation matrix: " << std::endl << transformation_matrix << std::endl;
 
 //    std::cout << "press enter to start" << std::endl;
 //    std::string unused;
@@ -100,7 +546,8 @@ int main(int argc, char** argv)
 
     // TODO: must download current_cloud
     pcl::PointCloud<pcl::PointXYZ>::Ptr current_points = pcl::PointCloud<pcl::PointXYZ>::Ptr(new pcl::PointCloud<pcl::PointXYZ>);
-    occluded_region_finder::find_occluded_regions(*tsdf_distances, *tsdf_weights, current_points, transformation_matrix, saving, outfile, markers_pub, points_pub, regions_pub, plane_pub, object_points_pub, plane_points_pub);
+    occluded_region_finder::find_occluded_regions(volume.tsdf, current_points, volume.transformation_matrix, saving, outfile, markers_pub, points_pub, regions_pub, plane_pub, object_points_pub, plane_points_pub);
+    transform_cache::print_statistics();
 
     return 0;
 
@@ -8,54 +8,30 @@
 #include <pcl/point_types.h>
 
 #include <pcl_utils/BoundingBox.h>
+#include <pcl_utils/transform_cache.h>
 #include <tf/transform_listener.h>
 #include <tf/transform_datatypes.h>
 #include <tf_conversions/tf_eigen.h>
-#include <pcl/common/transforms.h>
-#include <pcl/features/moment_of_inertia_estimation.h>
+#include <pcl_utils/bounding_box.h>
+#include <pcl_utils/cloud_crop.h>
 
 using namespace std;
 
 namespace plane_recognition
 {
-void calculate_plane(pcl::PointCloud<pcl::PointXYZ>::Ptr cloud, pcl::PointIndices::Ptr inliers, pcl::ModelCoefficients::Ptr coefficients, ros::Publisher plane_pub, visualization_msgs::MarkerArrayPtr markers, ros::Publisher plane_points_pub)
+void calculate_plane(const scene_segmentation::Scene& scene, ros::Publisher plane_pub, visualization_msgs::MarkerArrayPtr markers, ros::Publisher plane_points_pub)
 {
 
-    float leaf_size, distance_threshold;
     bool publish_plane_marker;
-    ros::param::param<float>("/occlusion_parameters/plane_recognition_leaf_size", leaf_size, 0.05f); // TODO: find the right value for this - could be pretty high I think?
-    ros::param::param<float>("/occlusion_parameters/plane_recognition_distance_threshold", distance_threshold, 0.04f);
     ros::param::param<bool>("/occlusion_parameters/publish_plane_marker", publish_plane_marker, false);
 
-    std::cout << "PointCloud before filtering has: " << cloud->points.size () << " data points." << std::endl; //*
-    pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_filtered (new pcl::PointCloud<pcl::PointXYZ>);
-    pcl::VoxelGrid<pcl::PointXYZ> vg;
-    vg.setInputCloud (cloud);
-    vg.setLeafSize (leaf_size, leaf_size, leaf_size);
-    vg.filter (*cloud_filtered);
-    std::cout << "PointCloud after filtering has: " << cloud_filtered->points.size ()  << " data points." << std::endl; //*
-
-    // Create the segmentation object
-    pcl::SACSegmentation<pcl::PointXYZ> seg;
-    // Optional
-    seg.setOptimizeCoefficients (true);
-    // Mandatory
-    seg.setModelType (pcl::SACMODEL_PLANE);
-//    seg.setMethodType(pcl::SAC_MLESAC);
-    seg.setMethodType (pcl::SAC_RANSAC);
-    seg.setDistanceThreshold (distance_threshold);
-
-    // input cloud
-    seg.setInputCloud (cloud_filtered);
-    seg.segment (*inliers, *coefficients);
-
     pcl::PointCloud<pcl::PointXYZ> plane_points;
 
     // Create the filtering object
     pcl::ExtractIndices<pcl::PointXYZ> extract;
     // Extract the inliers
-    extract.setInputCloud(cloud_filtered);
-    extract.setIndices(inliers);
+    extract.setInputCloud(scene.downsampled);
+    extract.setIndices(scene.table_inliers);
     extract.setNegative (false);
     extract.filter(plane_points);
 
@@ -66,31 +42,32 @@ void calculate_plane(pcl::PointCloud<pcl::PointXYZ>::Ptr cloud, pcl::PointIndice
     plane_points_pub.publish(ros_plane_points);
 
 
-    tf::TransformListener listener;
     tf::StampedTransform kinfu_to_base;
-    listener.waitForTransform("/kinfu_frame", "/base_link",
-                               ros::Time(0), ros::Duration(5));
-    listener.lookupTransform("/kinfu_frame", "/base_link",
-                              ros::Time(0), kinfu_to_base);
+    if (!transform_cache::lookup_transform("/kinfu_frame", "/base_link", ros::Time(0), &kinfu_to_base))
+    {
+        std::cout << "no transform from /kinfu_frame to /base_link, not publishing plane bounding box" << std::endl;
+        return;
+    }
 
     Eigen::Affine3d kinfu_to_base_affine;
     tf::transformTFToEigen(kinfu_to_base, kinfu_to_base_affine);
 
     pcl::PointCloud<pcl::PointXYZ>::Ptr plane_points_base_link = pcl::PointCloud<pcl::PointXYZ>::Ptr(new pcl::PointCloud<pcl::PointXYZ>);
-    pcl::transformPointCloud(plane_points, *plane_points_base_link, kinfu_to_base_affine.inverse());
-
+    cloud_crop::Crop to_base;
+    to_base.transform = kinfu_to_base_affine.inverse().cast<float>();
+    cloud_crop::crop_points(plane_points, to_base, plane_points_base_link.get());
 
-    pcl::MomentOfInertiaEstimation <pcl::PointXYZ> feature_extractor;
-    feature_extractor.setInputCloud(plane_points_base_link);
-    feature_extractor.compute ();
 
+    bounding_box::OrientedBoundingBox obb;
+    if (!bounding_box::compute_obb(*plane_points_base_link, &obb))
+    {
+        return;
+    }
 
-    pcl::PointXYZ min_point_OBB;
-    pcl::PointXYZ max_point_OBB;
-    pcl::PointXYZ position_OBB;
-    Eigen::Matrix3f rotational_matrix_OBB;
-
-    feature_extractor.getOBB (min_point_OBB, max_point_OBB, position_OBB, rotational_matrix_OBB);
+    pcl::PointXYZ min_point_OBB = obb.min_point;
+    pcl::PointXYZ max_point_OBB = obb.max_point;
+    pcl::PointXYZ position_OBB = obb.position;
+    Eigen::Matrix3f rotational_matrix_OBB = obb.rotational_matrix;
     Eigen::Vector3f max_point_eigen(max_point_OBB.x, max_point_OBB.y, max_point_OBB.z);
 
     Eigen::Matrix3f vectors = rotational_matrix_OBB * max_point_eigen.asDiagonal();
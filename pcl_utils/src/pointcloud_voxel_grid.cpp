@@ -21,7 +21,10 @@ PointCloudVoxelGrid::PointCloudVoxelGrid(CloudType::Ptr cloud, double resolution
 
 
 
-    array = Eigen::VectorXi(x_size * y_size * z_size);
+    // one voxel of padding, points on the maximum land just past the last voxel when the extent is a multiple of the resolution
+    x_blocks = x_size / BLOCK_X + 1;
+    y_blocks = y_size / BLOCK_Y + 1;
+    z_blocks = z_size / BLOCK_Z + 1;
 
     set_all(NOT_VISITED);
 
@@ -39,16 +42,72 @@ void PointCloudVoxelGrid::walk_cloud(CloudType::Ptr cloud) {
 
 /** Goes through the grid, creating a cloud of points that have not been visited. */
 void PointCloudVoxelGrid::get_inverse_cloud(PointCloudVoxelGrid::CloudType::Ptr cloud) {
-    // TODO: reverse the order of these loops - i.e. x, y, z
+    cloud->reserve(cloud->size() + (size_t) x_size * y_size * z_size - count_visited());
+
+    // same x, y, z order as walking the voxels one by one, but skipping whole runs of visited voxels
     for (int x = 0; x < x_size; x++) {
         for (int y = 0; y < y_size; y++) {
-            for (int z = 0; z < z_size; z++) {
-                if (!get(x, y, z)) {
+            for (int z_start = 0; z_start < z_size; z_start += BLOCK_Z) {
+                int offset = block_offsets[block_index(x, y, z_start)];
+                uint64_t empty = (offset < 0) ? ~uint64_t(0) : ~words[offset + word_index(x, y)];
+                // drop the bits past the end of the grid
+                int run = std::min(BLOCK_Z, z_size - z_start);
+                if (run < BLOCK_Z) {
+                    empty &= (uint64_t(1) << run) - 1;
+                }
+
+                while (empty) {
+                    int z = z_start + __builtin_ctzll(empty);
                     cloud->push_back(voxel_to_point(voxel(x, y, z)));
+                    empty &= empty - 1;
+                }
+            }
+        }
+    }
+}
+
+void PointCloudVoxelGrid::set_all(int val) {
+    if (val == NOT_VISITED) {
+        block_offsets.assign((size_t) x_blocks * y_blocks * z_blocks, -1);
+        words.clear();
+        return;
+    }
+
+    block_offsets.resize((size_t) x_blocks * y_blocks * z_blocks);
+    words.assign(block_offsets.size() * WORDS_PER_BLOCK, ~uint64_t(0));
+    for (size_t i = 0; i < block_offsets.size(); i++) {
+        block_offsets[i] = i * WORDS_PER_BLOCK;
+    }
+}
+
+void PointCloudVoxelGrid::allocate_block(int block) {
+    block_offsets[block] = words.size();
+    words.resize(words.size() + WORDS_PER_BLOCK, 0);
+}
+
+size_t PointCloudVoxelGrid::count_visited() const {
+    size_t count = 0;
+    for (int x = 0; x < x_size; x++) {
+        for (int y = 0; y < y_size; y++) {
+            for (int z_start = 0; z_start < z_size; z_start += BLOCK_Z) {
+                int offset = block_offsets[block_index(x, y, z_start)];
+                if (offset >= 0) {
+                    // ignore the padding
+                    uint64_t word = words[offset + word_index(x, y)];
+                    int run = std::min(BLOCK_Z, z_size - z_start);
+                    if (run < BLOCK_Z) {
+                        word &= (uint64_t(1) << run) - 1;
+                    }
+                    count += __builtin_popcountll(word);
                 }
             }
         }
     }
+    return count;
+}
+
+size_t PointCloudVoxelGrid::memory_usage() const {
+    return words.size() * sizeof(uint64_t) + block_offsets.size() * sizeof(int);
 }
 
 /** Converts a point to an integer voxel. */
@@ -0,0 +1,84 @@
+#include <pcl_utils/tsdf_converter.h>
+#include <pcl_utils/tsdf_raycaster.h>
+#include <pcl_utils/tsdf_snapshot.h>
+#include <pcl_utils/cloud_writer.h>
+#include <pcl_utils/timer.h>
+
+#include <cstring>
+#include <fstream>
+
+// renders a saved kinfu volume from the camera pose that was saved with it, from a snapshot (-t) or the dense dumps
+int main(int argc, char** argv) {
+    bool from_snapshot = argc > 1 && std::strcmp(argv[1], "-t") == 0;
+    if ((from_snapshot && argc < 4) || (!from_snapshot && argc < 5)) {
+        std::cerr << "usage: render_tsdf -t snapshot_file output_file" << std::endl;
+        std::cerr << "       render_tsdf dist_file weight_file matrix_file output_file [res_x res_y res_z size_x size_y size_z]" << std::endl;
+        return 1;
+    }
+
+    tsdf_snapshot::Snapshot snapshot;
+    tsdf_converter::MappedTsdfVolume mapped_tsdf;
+    tsdf_converter::TsdfVolumeView tsdf;
+    // the saved matrix takes kinfu points to the camera frame, so the camera pose is its inverse
+    Eigen::Matrix4d transformation_matrix = Eigen::Matrix4d::Zero();
+    std::string output_file;
+
+    if (from_snapshot) {
+        std::string snapshot_file = argv[2];
+        output_file = argv[3];
+
+        if (!snapshot.read(snapshot_file)) {
+            std::cerr << "could not read the tsdf snapshot " << snapshot_file << "!" << std::endl;
+            return 1;
+        }
+        tsdf = snapshot.view();
+        transformation_matrix = snapshot.transformation_matrix();
+    } else {
+        std::string dist_file = argv[1];
+        std::string weight_file = argv[2];
+        std::string matrix_file = argv[3];
+        output_file = argv[4];
+
+        tsdf_converter::VolumeGeometry geometry;
+        if (!tsdf_converter::parse_volume_geometry(argc, argv, 5, &geometry)) {
+            return 1;
+        }
+
+        if (!mapped_tsdf.open(dist_file, weight_file, geometry)) {
+            std::cerr << "could not map the tsdf files!" << std::endl;
+            return 1;
+        }
+        tsdf = mapped_tsdf.view();
+
+        std::ifstream matrix_instream;
+        matrix_instream.open(matrix_file.c_str());
+        std::string current_input;
+        for (int x = 0; x < transformation_matrix.rows(); x++)
+        {
+            for (int y = 0; y < transformation_matrix.cols(); y++)
+            {
+                getline(matrix_instream, current_input);
+                transformation_matrix(x, y) = std::atof(current_input.c_str());
+            }
+        }
+        matrix_instream.close();
+    }
+
+    Timer timer;
+    Timer_tic(&timer);
+    tsdf_raycaster::Raycaster raycaster(tsdf);
+    std::cout << "built the min-distance pyramid (" << raycaster.num_levels() << " levels) in " << Timer_toc(&timer) << " s" << std::endl;
+
+    Timer_tic(&timer);
+    tsdf_raycaster::RaycastImage image;
+    raycaster.raycast(transformation_matrix.inverse(), tsdf_raycaster::CameraIntrinsics(), &image);
+    std::cout << "raycast took " << Timer_toc(&timer) << " s" << std::endl;
+
+    pcl::PointCloud<pcl::PointXYZ>::Ptr cloud = pcl::PointCloud<pcl::PointXYZ>::Ptr (new pcl::PointCloud<pcl::PointXYZ>);
+    image.get_surface_cloud(cloud);
+
+    std::cout << "about to save cloud (size: " << cloud->size() << ")"<< std::endl;
+    cloud_writer::save(output_file, *cloud);
+
+    std::cout << "done" << std::endl;
+}
@@ -1,32 +1,58 @@
 #include <pcl_utils/tsdf_converter.h>
+#include <pcl_utils/tsdf_snapshot.h>
+#include <pcl_utils/cloud_writer.h>
 
+#include <cstring>
+
+// saves the weights of a kinfu volume as a colored cloud, from a snapshot (-t) or the dense dumps
 int main(int argc, char** argv) {
+    bool from_snapshot = argc > 1 && std::strcmp(argv[1], "-t") == 0;
     if (argc < 4) {
         std::cerr << "not enough input arguments!" << std::endl;
+        std::cerr << "usage: save_weight_cloud -t snapshot_file output_file [jump]" << std::endl;
+        std::cerr << "       save_weight_cloud dist_file weight_file output_file [jump [res_x res_y res_z size_x size_y size_z]]" << std::endl;
         return 1;
     }
 
-    std::string dist_file = argv[1];
-    std::string weight_file = argv[2];
+    tsdf_snapshot::Snapshot snapshot;
+    tsdf_converter::MappedTsdfVolume mapped_tsdf;
+    tsdf_converter::TsdfVolumeView tsdf;
+    pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud = pcl::PointCloud<pcl::PointXYZRGB>::Ptr (new pcl::PointCloud<pcl::PointXYZRGB>);
     std::string output_file = argv[3];
     int jump = 1;
     if (argc > 4) {
         jump = std::atoi(argv[4]);
     }
 
-    std::vector<float>* distances = new std::vector<float>;
-    std::vector<short>* weights = new std::vector<short>;
-    pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud = pcl::PointCloud<pcl::PointXYZRGB>::Ptr (new pcl::PointCloud<pcl::PointXYZRGB>);
-
     std::cout << "about to read files" << std::endl;
-    tsdf_converter::read_files(dist_file, weight_file, distances, weights);
+    if (from_snapshot) {
+        std::string snapshot_file = argv[2];
+        if (!snapshot.read(snapshot_file)) {
+            std::cerr << "could not read the tsdf snapshot " << snapshot_file << "!" << std::endl;
+            return 1;
+        }
+        tsdf = snapshot.view();
+    } else {
+        std::string dist_file = argv[1];
+        std::string weight_file = argv[2];
+        tsdf_converter::VolumeGeometry geometry;
+        if (!tsdf_converter::parse_volume_geometry(argc, argv, 5, &geometry)) {
+            return 1;
+        }
+
+        if (!mapped_tsdf.open(dist_file, weight_file, geometry)) {
+            std::cerr << "could not map the tsdf files!" << std::endl;
+            return 1;
+        }
+        tsdf = mapped_tsdf.view();
+    }
 
     std::cout << "about to get cloud" << std::endl;
-    tsdf_converter::get_weight_cloud(*distances, *weights, cloud, jump);
+    tsdf_converter::get_weight_cloud(tsdf, cloud, jump);
 
     std::cout << "about to save cloud (size: " << cloud->size() << ")"<< std::endl;
 
-    pcl::io::savePCDFileASCII(output_file, *cloud);
+    cloud_writer::save(output_file, *cloud);
 
     std::cout << "done" << std::endl;
 }
@@ -0,0 +1,73 @@
+#include <pcl_utils/scene_segmentation.h>
+
+#include "ros/ros.h"
+#include <pcl/filters/voxel_grid.h>
+#include <pcl/sample_consensus/method_types.h>
+#include <pcl/sample_consensus/model_types.h>
+#include <pcl/segmentation/sac_segmentation.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+namespace scene_segmentation
+{
+void segment_scene(pcl::PointCloud<pcl::PointXYZ>::Ptr cloud, float point_spacing, Scene* scene)
+{
+    float leaf_size, distance_threshold, cluster_distance_threshold;
+    ros::param::param<float>("/occlusion_parameters/segmentation_leaf_size", leaf_size, 0.01f);
+    ros::param::param<float>("/occlusion_parameters/plane_recognition_distance_threshold", distance_threshold, 0.04f);
+    ros::param::param<float>("/occlusion_parameters/plane_cluster_distance_threshold", cluster_distance_threshold, 0.02f);
+    // a finer grid than the points themselves would not remove anything
+    scene->leaf_size = std::max(leaf_size, point_spacing);
+
+    std::cout << "PointCloud before filtering has: " << cloud->points.size () << " data points." << std::endl; //*
+    scene->downsampled = pcl::PointCloud<pcl::PointXYZ>::Ptr(new pcl::PointCloud<pcl::PointXYZ>);
+    pcl::VoxelGrid<pcl::PointXYZ> vg;
+    vg.setInputCloud (cloud);
+    vg.setLeafSize (scene->leaf_size, scene->leaf_size, scene->leaf_size);
+    vg.filter (*scene->downsampled);
+    std::cout << "PointCloud after filtering has: " << scene->downsampled->points.size ()  << " data points." << std::endl; //*
+
+    // the table is the dominant plane
+    scene->table_coefficients = pcl::ModelCoefficients::Ptr(new pcl::ModelCoefficients);
+    scene->table_inliers = pcl::PointIndices::Ptr(new pcl::PointIndices);
+    if (scene->downsampled->points.size () > 0)
+    {
+        pcl::SACSegmentation<pcl::PointXYZ> seg;
+        seg.setOptimizeCoefficients (true);
+        seg.setModelType (pcl::SACMODEL_PLANE);
+        seg.setMethodType (pcl::SAC_RANSAC);
+        seg.setDistanceThreshold (distance_threshold);
+        seg.setInputCloud (scene->downsampled);
+        seg.segment (*scene->table_inliers, *scene->table_coefficients);
+    }
+
+    // clustering removes the table with a tighter threshold, so objects standing on it keep their bottoms
+    const pcl::PointCloud<pcl::PointXYZ>& downsampled = *scene->downsampled;
+    scene->table_mask.assign(downsampled.size(), false);
+    scene->num_table_points = 0;
+    scene->remaining = pcl::PointCloud<pcl::PointXYZ>::Ptr(new pcl::PointCloud<pcl::PointXYZ>);
+    bool has_table = scene->table_coefficients->values.size() == 4;
+    for (size_t i = 0; i < downsampled.size(); i++)
+    {
+        if (has_table)
+        {
+            const std::vector<float>& c = scene->table_coefficients->values;
+            const pcl::PointXYZ& p = downsampled.points[i];
+            scene->table_mask[i] = std::fabs(c[0] * p.x + c[1] * p.y + c[2] * p.z + c[3]) <= cluster_distance_threshold;
+        }
+        if (scene->table_mask[i])
+        {
+            scene->num_table_points++;
+        }
+        else
+        {
+            scene->remaining->points.push_back(downsampled.points[i]);
+        }
+    }
+    scene->remaining->width = scene->remaining->points.size ();
+    scene->remaining->height = 1;
+    scene->remaining->is_dense = true;
+}
+}
@@ -0,0 +1,73 @@
+#include <pcl_utils/transform_cache.h>
+#include <pcl_utils/timer.h>
+#include <boost/thread/mutex.hpp>
+#include <algorithm>
+
+namespace transform_cache {
+
+namespace {
+    boost::mutex mutex;
+    boost::shared_ptr<tf::TransformListener> shared_listener;
+    LookupStatistics statistics = {0, 0, 0.0, 0.0, 0.0, 0.0};
+}
+
+boost::shared_ptr<tf::TransformListener> get_listener() {
+    boost::mutex::scoped_lock lock(mutex);
+    if (!shared_listener) {
+        shared_listener.reset(new tf::TransformListener(ros::Duration(20.0)));
+    }
+    return shared_listener;
+}
+
+void set_listener(boost::shared_ptr<tf::TransformListener> listener) {
+    boost::mutex::scoped_lock lock(mutex);
+    shared_listener = listener;
+}
+
+bool lookup_transform(const std::string& target_frame, const std::string& source_frame, const ros::Time& stamp,
+                      tf::StampedTransform* transform, ros::Duration timeout) {
+    boost::shared_ptr<tf::TransformListener> listener = get_listener();
+
+    Timer timer;
+    Timer_tic(&timer);
+    bool found = false;
+    try {
+        if (timeout == ros::Duration(0) ? listener->canTransform(target_frame, source_frame, stamp)
+                                        : listener->waitForTransform(target_frame, source_frame, stamp, timeout)) {
+            listener->lookupTransform(target_frame, source_frame, stamp, *transform);
+            found = true;
+        }
+    } catch (tf::TransformException& ex) {
+        ROS_WARN("transform_cache: %s", ex.what());
+    }
+    double lookup_time = Timer_toc(&timer);
+
+    boost::mutex::scoped_lock lock(mutex);
+    statistics.num_lookups++;
+    statistics.total_lookup_time += lookup_time;
+    statistics.max_lookup_time = std::max(statistics.max_lookup_time, lookup_time);
+    if (found) {
+        double age = (ros::Time::now() - transform->stamp_).toSec();
+        statistics.total_age += age;
+        statistics.max_age = std::max(statistics.max_age, age);
+    } else {
+        statistics.num_failures++;
+    }
+
+    return found;
+}
+
+LookupStatistics get_statistics() {
+    boost::mutex::scoped_lock lock(mutex);
+    return statistics;
+}
+
+void print_statistics() {
+    LookupStatistics s = get_statistics();
+    int num_found = s.num_lookups - s.num_failures;
+    std::cout << "tf lookups: " << s.num_lookups << ", failed: " << s.num_failures
+              << ", mean/max lookup time: " << (s.num_lookups > 0 ? s.total_lookup_time / s.num_lookups : 0.0) << "/" << s.max_lookup_time
+              << " s, mean/max transform age: " << (num_found > 0 ? s.total_age / num_found : 0.0) << "/" << s.max_age << " s" << std::endl;
+}
+
+}
@@ -1,14 +1,119 @@
 #include <pcl_utils/tsdf_converter.h>
 #include <pcl_utils/timer.h>
 #include <climits>
+#include <cstdlib>
+#include <cstring>
 #include <pcl/filters/extract_indices.h>
 #include <pcl/filters/voxel_grid.h>
-#include <boost/random/mersenne_twister.hpp>
-#include <boost/random/uniform_int.hpp>
-#include <boost/random/variate_generator.hpp>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 
 namespace tsdf_converter {
+
+// maps a whole file read-only, returns NULL if it cannot be mapped or has the wrong size
+static void* map_file(std::string file, size_t expected_bytes) {
+    int fd = ::open(file.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cout << "could not open " << file << std::endl;
+        return NULL;
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || (size_t) file_stat.st_size != expected_bytes) {
+        std::cout << file << " does not have the expected " << expected_bytes << " bytes" << std::endl;
+        ::close(fd);
+        return NULL;
+    }
+
+    void* map = mmap(NULL, expected_bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping stays valid after the descriptor is closed
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        std::cout << "could not map " << file << std::endl;
+        return NULL;
+    }
+
+    // the volume is scanned front to back
+    madvise(map, expected_bytes, MADV_SEQUENTIAL);
+    return map;
+}
+
+VolumeGeometry get_volume_geometry() {
+    VolumeGeometry geometry;
+    ros::param::param<int>("/occlusion_parameters/volume_resolution_x", geometry.resolution(0), 512);
+    ros::param::param<int>("/occlusion_parameters/volume_resolution_y", geometry.resolution(1), 512);
+    ros::param::param<int>("/occlusion_parameters/volume_resolution_z", geometry.resolution(2), 512);
+    ros::param::param<float>("/occlusion_parameters/volume_size_x", geometry.size(0), 2);
+    ros::param::param<float>("/occlusion_parameters/volume_size_y", geometry.size(1), 2);
+    ros::param::param<float>("/occlusion_parameters/volume_size_z", geometry.size(2), 2);
+    return geometry;
+}
+
+bool parse_volume_geometry(int argc, char** argv, int first, VolumeGeometry* geometry) {
+    if (argc <= first) {
+        return true;
+    }
+    if (argc < first + 6) {
+        std::cerr << "the volume geometry needs three resolutions and three sizes" << std::endl;
+        return false;
+    }
+    for (int axis = 0; axis < 3; axis++) {
+        geometry->resolution(axis) = std::atoi(argv[first + axis]);
+        geometry->size(axis) = std::atof(argv[first + 3 + axis]);
+        if (geometry->resolution(axis) <= 0 || geometry->size(axis) <= 0) {
+            std::cerr << "invalid volume geometry" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+MappedTsdfVolume::MappedTsdfVolume()
+    : distance_map(NULL), weight_map(NULL), distance_bytes(0), weight_bytes(0) {
+}
+
+MappedTsdfVolume::~MappedTsdfVolume() {
+    close();
+}
+
+bool MappedTsdfVolume::open(std::string distance_file, std::string weight_file, const VolumeGeometry& geometry) {
+    close();
+
+    size_t num_voxels = geometry.num_voxels();
+    distance_bytes = num_voxels * sizeof(float);
+    weight_bytes = num_voxels * sizeof(short);
+    distance_map = map_file(distance_file, distance_bytes);
+    weight_map = map_file(weight_file, weight_bytes);
+    this->geometry = geometry;
+
+    if (!is_open()) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void MappedTsdfVolume::close() {
+    if (distance_map != NULL) {
+        munmap(distance_map, distance_bytes);
+    }
+    if (weight_map != NULL) {
+        munmap(weight_map, weight_bytes);
+    }
+    distance_map = NULL;
+    weight_map = NULL;
+    distance_bytes = 0;
+    weight_bytes = 0;
+}
+
+TsdfVolumeView MappedTsdfVolume::view() const {
+    return TsdfVolumeView(static_cast<const float*>(distance_map), static_cast<const short*>(weight_map), geometry);
+}
+
 void read_files(std::string distance_file, std::string weight_file, std::vector<float>* tsdf_distances, std::vector<short>* tsdf_weights) {
 
     // read the raw binary files into vectors
@@ -33,64 +138,156 @@ void read_files(std::string distance_file, std::string weight_file, std::vector<
 
 }
 
-void convert_tsdf(std::vector<float> tsdf_distances, std::vector<short> tsdf_weights, pcl::PointCloud<pcl::PointXYZ>::Ptr zero_crossing_cloud, pcl::PointCloud<pcl::PointXYZ>::Ptr foreground_cloud, pcl::PointCloud<pcl::PointXYZ>::Ptr inverse_cloud) {
-    // loop the pointcloud, finding zero crossing points and "foreground" points
+bool ConversionParameters::operator==(const ConversionParameters& other) const {
+    return jump == other.jump && prob == other.prob && voxel_size == other.voxel_size &&
+           min_x == other.min_x && max_x == other.max_x && min_y == other.min_y && max_y == other.max_y &&
+           min_z == other.min_z && max_z == other.max_z &&
+           tsdf_min_distance == other.tsdf_min_distance && tsdf_max_distance == other.tsdf_max_distance;
+}
 
-    double resolution = 512;
-    double size = 2;
-
-    // get parameters
-    int jump, prob;
-    float voxel_size, min_x, max_x, min_y, max_y, min_z, max_z, tsdf_min_distance, tsdf_max_distance;
-    ros::param::param<int>("/occlusion_parameters/tsdf_converter_jump", jump, 1);
-    ros::param::param<float>("/occlusion_parameters/voxel_size", voxel_size, 0.02f);
-    ros::param::param<int>("/occlusion_parameters/downsampling_rate", prob, 100);
-    ros::param::param<float>("/occlusion_parameters/min_x", min_x, 0);
-    ros::param::param<float>("/occlusion_parameters/max_x", max_x, 2);
-    ros::param::param<float>("/occlusion_parameters/min_y", min_y, 0);
-    ros::param::param<float>("/occlusion_parameters/max_y", max_y, 2);
-    ros::param::param<float>("/occlusion_parameters/min_z", min_z, 0);
-    ros::param::param<float>("/occlusion_parameters/max_z", max_z, 2);
-    ros::param::param<float>("/occlusion_parameters/tsdf_min_distance", tsdf_min_distance, 0.2);
-    ros::param::param<float>("/occlusion_parameters/tsdf_max_distance", tsdf_max_distance, 0.8);
+ConversionParameters get_conversion_parameters() {
+    ConversionParameters parameters;
+    ros::param::param<int>("/occlusion_parameters/tsdf_converter_jump", parameters.jump, 1);
+    ros::param::param<float>("/occlusion_parameters/voxel_size", parameters.voxel_size, 0.02f);
+    ros::param::param<int>("/occlusion_parameters/downsampling_rate", parameters.prob, 100);
+    ros::param::param<float>("/occlusion_parameters/min_x", parameters.min_x, 0);
+    ros::param::param<float>("/occlusion_parameters/max_x", parameters.max_x, 2);
+    ros::param::param<float>("/occlusion_parameters/min_y", parameters.min_y, 0);
+    ros::param::param<float>("/occlusion_parameters/max_y", parameters.max_y, 2);
+    ros::param::param<float>("/occlusion_parameters/min_z", parameters.min_z, 0);
+    ros::param::param<float>("/occlusion_parameters/max_z", parameters.max_z, 2);
+    ros::param::param<float>("/occlusion_parameters/tsdf_min_distance", parameters.tsdf_min_distance, 0.2);
+    ros::param::param<float>("/occlusion_parameters/tsdf_max_distance", parameters.tsdf_max_distance, 0.8);
+    return parameters;
+}
 
-    pcl::PointCloud<pcl::PointXYZ>::Ptr inverse_full (new pcl::PointCloud<pcl::PointXYZ>);
+// unknown space: the voxel grid cells without foreground points, plus the sampled low weight points
+static void add_unknown_space(pcl::PointCloud<pcl::PointXYZ>::Ptr foreground_cloud, pcl::PointCloud<pcl::PointXYZ>::Ptr inverse_full, float voxel_size, pcl::PointCloud<pcl::PointXYZ>::Ptr inverse_cloud) {
+    PointCloudVoxelGrid vox_grid = PointCloudVoxelGrid(foreground_cloud, voxel_size);
+    vox_grid.get_inverse_cloud(inverse_cloud);
 
-    boost::mt19937 gen;
-    boost::random::uniform_int_distribution<> dist(1, prob);
+    std::cout << "number of points in inverse cloud: " << inverse_cloud->size() << std::endl;
 
+    pcl::PointCloud<pcl::PointXYZ>::iterator iter;
+    for (iter = inverse_full->begin(); iter != inverse_full->end(); iter++) {
+        inverse_cloud->push_back(*iter);
+    }
+
+    std::cout << "number of points in inverse cloud (after adding low weight points): " << inverse_cloud->size() << std::endl;
+}
 
-    int i = 0;
-    for (int z = 0; z < resolution; z = z + jump) {
-        for (int y = 0; y < resolution; y = y + jump) {
-            for (int x = 0; x < resolution; x = x + jump) {
-                float current_distance = tsdf_distances[resolution * resolution * z + resolution * y + x];
-                short current_weight = tsdf_weights[resolution * resolution * z + resolution * y + x];
-                pcl::PointXYZ current;
-                current.x = x * size / resolution;
-                current.y = y * size / resolution;
-                current.z = z * size / resolution;
+// stepped voxel indices whose coordinate lies within [min, max]
+static void voxels_in_range(float min, float max, int resolution, float voxel_size, int jump, std::vector<int>* indices) {
+    for (int x = 0; x < resolution; x = x + jump) {
+        float coordinate = x * voxel_size;
+        if (coordinate >= min && coordinate <= max) {
+            indices->push_back(x);
+        }
+    }
+}
 
-                if (current.x >= min_x && current.x <= max_x &&
-                    current.y >= min_y && current.y <= max_y &&
-                    current.z >= min_z && current.z <= max_z) {
+// keeps about one in prob voxels, decided by a hash of the voxel index so the result does not depend on the thread count
+static inline bool keep_sample(size_t index, int prob) {
+    uint32_t h = (uint32_t) index;
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h % prob == 0;
+}
 
-                    if (current_weight > 0 && current_distance > tsdf_min_distance && current_distance < tsdf_max_distance) {
-                        zero_crossing_cloud->push_back(current);
-                    }
+void convert_tsdf(const TsdfVolumeView& tsdf, pcl::PointCloud<pcl::PointXYZ>::Ptr zero_crossing_cloud, pcl::PointCloud<pcl::PointXYZ>::Ptr foreground_cloud, pcl::PointCloud<pcl::PointXYZ>::Ptr inverse_cloud) {
+    // loop the pointcloud, finding zero crossing points and "foreground" points
 
-                    if (current_weight > 0 && current_distance > 0.5) {
-                    //if (current_weight > 0.1 && current_distance > 0.5) {
-                        foreground_cloud->push_back(current);
-                    }
+    Eigen::Vector3f voxel_size = tsdf.voxel_size();
 
-                    if ((current_weight < 50 && current_weight > 0 && dist(gen) % prob == 0) /*|| (current_weight == 0 && dist(gen) % prob == 0)*/) {
-                        inverse_full->push_back(current);
-                        //inverse_cloud->push_back(current);
-                    }
+    ConversionParameters parameters = get_conversion_parameters();
+    int prob = parameters.prob;
+    float tsdf_min_distance = parameters.tsdf_min_distance;
+    float tsdf_max_distance = parameters.tsdf_max_distance;
+
+    pcl::PointCloud<pcl::PointXYZ>::Ptr inverse_full (new pcl::PointCloud<pcl::PointXYZ>);
+
+    // only visit voxels inside the bounds
+    std::vector<int> xs, ys, zs;
+    voxels_in_range(parameters.min_x, parameters.max_x, tsdf.resolution(0), voxel_size(0), parameters.jump, &xs);
+    voxels_in_range(parameters.min_y, parameters.max_y, tsdf.resolution(1), voxel_size(1), parameters.jump, &ys);
+    voxels_in_range(parameters.min_z, parameters.max_z, tsdf.resolution(2), voxel_size(2), parameters.jump, &zs);
+    int num_slabs = zs.size();
+
+    // count the points of each z slab first, so every slab knows where to write its points
+    std::vector<size_t> zero_crossing_counts(num_slabs + 1, 0);
+    std::vector<size_t> foreground_counts(num_slabs + 1, 0);
+    std::vector<size_t> inverse_counts(num_slabs + 1, 0);
+
+    #ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic, 4)
+    #endif
+    for (int k = 0; k < num_slabs; k++) {
+        size_t zero_crossing_count = 0, foreground_count = 0, inverse_count = 0;
+        for (size_t j = 0; j < ys.size(); j++) {
+            size_t row = tsdf.index(0, ys[j], zs[k]);
+            for (size_t i = 0; i < xs.size(); i++) {
+                size_t index = row + xs[i];
+                float current_distance = tsdf.distances[index];
+                short current_weight = tsdf.weights[index];
+                bool seen = current_weight > 0;
+                zero_crossing_count += seen && current_distance > tsdf_min_distance && current_distance < tsdf_max_distance;
+                foreground_count += seen && current_distance > 0.5;
+                inverse_count += seen && current_weight < 50 && keep_sample(index, prob);
+            }
+        }
+        zero_crossing_counts[k + 1] = zero_crossing_count;
+        foreground_counts[k + 1] = foreground_count;
+        inverse_counts[k + 1] = inverse_count;
+    }
+
+    for (int k = 0; k < num_slabs; k++) {
+        zero_crossing_counts[k + 1] += zero_crossing_counts[k];
+        foreground_counts[k + 1] += foreground_counts[k];
+        inverse_counts[k + 1] += inverse_counts[k];
+    }
+
+    size_t zero_crossing_start = zero_crossing_cloud->size();
+    size_t foreground_start = foreground_cloud->size();
+    zero_crossing_cloud->resize(zero_crossing_start + zero_crossing_counts[num_slabs]);
+    foreground_cloud->resize(foreground_start + foreground_counts[num_slabs]);
+    inverse_full->resize(inverse_counts[num_slabs]);
+
+    // fill in the points in the same z/y/x order as a serial pass
+    #ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic, 4)
+    #endif
+    for (int k = 0; k < num_slabs; k++) {
+        size_t zero_crossing_pos = zero_crossing_start + zero_crossing_counts[k];
+        size_t foreground_pos = foreground_start + foreground_counts[k];
+        size_t inverse_pos = inverse_counts[k];
+        pcl::PointXYZ current;
+        current.z = zs[k] * voxel_size(2);
+        for (size_t j = 0; j < ys.size(); j++) {
+            size_t row = tsdf.index(0, ys[j], zs[k]);
+            current.y = ys[j] * voxel_size(1);
+            for (size_t i = 0; i < xs.size(); i++) {
+                size_t index = row + xs[i];
+                float current_distance = tsdf.distances[index];
+                short current_weight = tsdf.weights[index];
+                if (current_weight <= 0) {
+                    continue;
                 }
+                current.x = xs[i] * voxel_size(0);
 
-                i++;
+                if (current_distance > tsdf_min_distance && current_distance < tsdf_max_distance) {
+                    zero_crossing_cloud->points[zero_crossing_pos++] = current;
+                }
+
+                if (current_distance > 0.5) {
+                    foreground_cloud->points[foreground_pos++] = current;
+                }
+
+                if (current_weight < 50 && keep_sample(index, prob)) {
+                    inverse_full->points[inverse_pos++] = current;
+                }
             }
         }
     }
@@ -103,35 +300,316 @@ void convert_tsdf(std::vector<float> tsdf_distances, std::vector<short> tsdf_wei
 ////    *inverse_cloud = *inverse_full;
 
 
-    PointCloudVoxelGrid vox_grid = PointCloudVoxelGrid(foreground_cloud, voxel_size);
-    vox_grid.get_inverse_cloud(inverse_cloud);
+    add_unknown_space(foreground_cloud, inverse_full, parameters.voxel_size, inverse_cloud);
+}
 
-    std::cout << "number of points in inverse cloud: " << inverse_cloud->size() << std::endl;
+IncrementalConverter::IncrementalConverter() : num_blocks(Eigen::Vector3i::Zero()), all_changed_(true) {
+}
 
-    pcl::PointCloud<pcl::PointXYZ>::iterator iter;
-    for (iter = inverse_full->begin(); iter != inverse_full->end(); iter++) {
-        inverse_cloud->push_back(*iter);
+void IncrementalConverter::clear() {
+    blocks.clear();
+    grid_counts.clear();
+    changed_regions_.clear();
+    all_changed_ = true;
+}
+
+// stepped indices of one block, as a range of the in-range indices
+static void block_range(const std::vector<int>& indices, int block, int block_size, int* begin, int* end) {
+    *begin = std::lower_bound(indices.begin(), indices.end(), block * block_size) - indices.begin();
+    *end = std::lower_bound(indices.begin(), indices.end(), (block + 1) * block_size) - indices.begin();
+}
+
+static inline uint64_t hash_voxel(uint64_t hash, float distance, short weight) {
+    uint32_t distance_bits;
+    memcpy(&distance_bits, &distance, sizeof(distance_bits));
+    hash ^= ((uint64_t) (uint16_t) weight << 32) | distance_bits;
+    hash *= 0x100000001b3ULL;
+    return hash ^ (hash >> 29);
+}
+
+// cell of the unknown space grid a point falls into, as PointCloudVoxelGrid places it
+Eigen::Vector3i IncrementalConverter::grid_cell(const pcl::PointXYZ& point) const {
+    Eigen::Vector3d cell = (Eigen::Vector3d(point.x, point.y, point.z) - grid_min) / parameters.voxel_size;
+    return Eigen::Vector3i(floor(cell(0)), floor(cell(1)), floor(cell(2)));
+}
+
+// corner of a cell of the unknown space grid, the point get_inverse_cloud gives for it
+pcl::PointXYZ IncrementalConverter::grid_point(const Eigen::Vector3i& cell) const {
+    Eigen::Vector3d point = cell.cast<double>() * (double) parameters.voxel_size + grid_min;
+    return pcl::PointXYZ(point(0), point(1), point(2));
+}
+
+// block of the volume a point lies in
+int IncrementalConverter::owner_block(const pcl::PointXYZ& point) const {
+    Eigen::Vector3f block = Eigen::Vector3f(point.x, point.y, point.z).cwiseQuotient(BLOCK_SIZE * geometry.voxel_size());
+    Eigen::Vector3i index;
+    for (int axis = 0; axis < 3; axis++) {
+        index(axis) = std::max(0, std::min(num_blocks(axis) - 1, (int) floor(block(axis))));
     }
+    return (index(2) * num_blocks(1) + index(1)) * num_blocks(0) + index(0);
+}
 
-    std::cout << "number of points in inverse cloud (after adding low weight points): " << inverse_cloud->size() << std::endl;
+// adds change to the count of the cell of each point, and flags the blocks owning the cells that became free or taken
+void IncrementalConverter::count_foreground(const pcl::PointCloud<pcl::PointXYZ>::VectorType& points, int change, std::vector<char>* unknown_changed) {
+    for (size_t i = 0; i < points.size(); i++) {
+        Eigen::Vector3i cell = grid_cell(points[i]);
+        // points on the maximum land past the last cell, as in PointCloudVoxelGrid
+        if ((cell.array() < 0).any() || (cell.array() >= grid_size.array()).any()) {
+            continue;
+        }
+        int& count = grid_counts[((size_t) cell(0) * grid_size(1) + cell(1)) * grid_size(2) + cell(2)];
+        bool was_free = count == 0;
+        count += change;
+        if (unknown_changed != NULL && was_free != (count == 0)) {
+            (*unknown_changed)[owner_block(grid_point(cell))] = 1;
+        }
+    }
+}
+
+// the free cells whose corner lies in block b, in the x/y/z order of get_inverse_cloud
+void IncrementalConverter::find_unknown(int b) {
+    Block& block = blocks[b];
+    block.unknown.clear();
+    if (grid_counts.empty()) {
+        return;
+    }
+
+    // the cells around the block, of which only the ones the block owns are taken
+    Eigen::Vector3f block_length = BLOCK_SIZE * geometry.voxel_size();
+    Eigen::Vector3f corner(b % num_blocks(0), b / num_blocks(0) % num_blocks(1), b / (num_blocks(0) * num_blocks(1)));
+    Eigen::Vector3d block_min = corner.cwiseProduct(block_length).cast<double>();
+    Eigen::Vector3d block_max = (corner + Eigen::Vector3f::Ones()).cwiseProduct(block_length).cast<double>();
+    Eigen::Vector3i cell_begin, cell_end;
+    for (int axis = 0; axis < 3; axis++) {
+        // the first and last blocks also own the cells past the volume
+        double lower = (corner(axis) == 0) ? grid_min(axis) : block_min(axis);
+        double upper = (corner(axis) == num_blocks(axis) - 1) ? grid_max(axis) + parameters.voxel_size : block_max(axis);
+        cell_begin(axis) = std::max(0, (int) floor((lower - grid_min(axis)) / parameters.voxel_size) - 1);
+        cell_end(axis) = std::min(grid_size(axis), (int) ceil((upper - grid_min(axis)) / parameters.voxel_size) + 1);
+    }
+
+    for (int x = cell_begin(0); x < cell_end(0); x++) {
+        for (int y = cell_begin(1); y < cell_end(1); y++) {
+            for (int z = cell_begin(2); z < cell_end(2); z++) {
+                if (grid_counts[((size_t) x * grid_size(1) + y) * grid_size(2) + z] != 0) {
+                    continue;
+                }
+                pcl::PointXYZ point = grid_point(Eigen::Vector3i(x, y, z));
+                if (owner_block(point) == b) {
+                    block.unknown.push_back(point);
+                }
+            }
+        }
+    }
+}
+
+void IncrementalConverter::convert(const TsdfVolumeView& tsdf, pcl::PointCloud<pcl::PointXYZ>::Ptr zero_crossing_cloud, pcl::PointCloud<pcl::PointXYZ>::Ptr foreground_cloud, pcl::PointCloud<pcl::PointXYZ>::Ptr inverse_cloud,
+                                   const std::vector<char>* changed_blocks) {
+    ConversionParameters current_parameters = get_conversion_parameters();
+    all_changed_ = blocks.empty() || tsdf.geometry() != geometry || !(current_parameters == parameters);
+    if (all_changed_) {
+        geometry = tsdf.geometry();
+        num_blocks = (geometry.resolution + Eigen::Vector3i::Constant(BLOCK_SIZE - 1)) / BLOCK_SIZE;
+        blocks.assign((size_t) num_blocks(0) * num_blocks(1) * num_blocks(2), Block());
+        parameters = current_parameters;
+    }
+    Eigen::Vector3f voxel_size = geometry.voxel_size();
+
+    std::vector<int> xs, ys, zs;
+    voxels_in_range(parameters.min_x, parameters.max_x, geometry.resolution(0), voxel_size(0), parameters.jump, &xs);
+    voxels_in_range(parameters.min_y, parameters.max_y, geometry.resolution(1), voxel_size(1), parameters.jump, &ys);
+    voxels_in_range(parameters.min_z, parameters.max_z, geometry.resolution(2), voxel_size(2), parameters.jump, &zs);
+
+    int total_blocks = blocks.size();
+    bool use_changed_blocks = !all_changed_ && changed_blocks != NULL && (int) changed_blocks->size() == total_blocks;
+    std::vector<char> dirty(total_blocks, 0);
+    // the foreground points the changed blocks had before, to take them off the unknown space grid
+    std::vector<pcl::PointCloud<pcl::PointXYZ>::VectorType> previous_foreground(total_blocks);
+
+    #ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic, 16)
+    #endif
+    for (int b = 0; b < total_blocks; b++) {
+        if (use_changed_blocks && !(*changed_blocks)[b]) {
+            continue;
+        }
+
+        int x_begin, x_end, y_begin, y_end, z_begin, z_end;
+        block_range(xs, b % num_blocks(0), BLOCK_SIZE, &x_begin, &x_end);
+        block_range(ys, b / num_blocks(0) % num_blocks(1), BLOCK_SIZE, &y_begin, &y_end);
+        block_range(zs, b / (num_blocks(0) * num_blocks(1)), BLOCK_SIZE, &z_begin, &z_end);
+
+        // compare the voxels the extraction reads with the last call
+        uint64_t checksum = 0xcbf29ce484222325ULL;
+        for (int k = z_begin; k < z_end; k++) {
+            for (int j = y_begin; j < y_end; j++) {
+                size_t row = tsdf.index(0, ys[j], zs[k]);
+                for (int i = x_begin; i < x_end; i++) {
+                    checksum = hash_voxel(checksum, tsdf.distances[row + xs[i]], tsdf.weights[row + xs[i]]);
+                }
+            }
+        }
+
+        Block& block = blocks[b];
+        if (block.valid && block.checksum == checksum) {
+            continue;
+        }
+        dirty[b] = block.valid;
+        block.valid = true;
+        block.checksum = checksum;
+        block.zero_crossing.clear();
+        block.foreground.swap(previous_foreground[b]);
+        block.foreground.clear();
+        block.inverse.clear();
+        block.foreground_min = Eigen::Vector3f::Constant(INFINITY);
+        block.foreground_max = Eigen::Vector3f::Constant(-INFINITY);
+
+        pcl::PointXYZ current;
+        for (int k = z_begin; k < z_end; k++) {
+            current.z = zs[k] * voxel_size(2);
+            for (int j = y_begin; j < y_end; j++) {
+                size_t row = tsdf.index(0, ys[j], zs[k]);
+                current.y = ys[j] * voxel_size(1);
+                for (int i = x_begin; i < x_end; i++) {
+                    size_t index = row + xs[i];
+                    float current_distance = tsdf.distances[index];
+                    short current_weight = tsdf.weights[index];
+                    if (current_weight <= 0) {
+                        continue;
+                    }
+                    current.x = xs[i] * voxel_size(0);
+
+                    if (current_distance > parameters.tsdf_min_distance && current_distance < parameters.tsdf_max_distance) {
+                        block.zero_crossing.push_back(current);
+                    }
+
+                    if (current_distance > 0.5) {
+                        block.foreground.push_back(current);
+                        block.foreground_min = block.foreground_min.cwiseMin(current.getVector3fMap());
+                        block.foreground_max = block.foreground_max.cwiseMax(current.getVector3fMap());
+                    }
+
+                    if (current_weight < 50 && keep_sample(index, parameters.prob)) {
+                        block.inverse.push_back(current);
+                    }
+                }
+            }
+        }
+    }
+
+    // grow the changed blocks by a cell of the unknown space grid, whose cells straddle blocks
+    Eigen::Vector3f block_length = BLOCK_SIZE * voxel_size;
+    Eigen::Vector3f margin = Eigen::Vector3f::Constant(parameters.voxel_size) + voxel_size;
+    changed_regions_.clear();
+    size_t num_zero_crossing = 0, num_foreground = 0, num_inverse = 0;
+    Eigen::Vector3f foreground_min = Eigen::Vector3f::Constant(INFINITY);
+    Eigen::Vector3f foreground_max = Eigen::Vector3f::Constant(-INFINITY);
+    for (int b = 0; b < total_blocks; b++) {
+        num_zero_crossing += blocks[b].zero_crossing.size();
+        num_foreground += blocks[b].foreground.size();
+        num_inverse += blocks[b].inverse.size();
+        if (!blocks[b].foreground.empty()) {
+            foreground_min = foreground_min.cwiseMin(blocks[b].foreground_min);
+            foreground_max = foreground_max.cwiseMax(blocks[b].foreground_max);
+        }
+        if (dirty[b]) {
+            Eigen::Vector3f corner(b % num_blocks(0), b / num_blocks(0) % num_blocks(1), b / (num_blocks(0) * num_blocks(1)));
+            Region region;
+            region.min = corner.cwiseProduct(block_length) - margin;
+            region.max = (corner + Eigen::Vector3f::Ones()).cwiseProduct(block_length) + margin;
+            changed_regions_.push_back(region);
+        }
+    }
+    std::cout << "incremental conversion: " << changed_regions_.size() << " of " << total_blocks << " blocks changed" << std::endl;
+
+    zero_crossing_cloud->reserve(zero_crossing_cloud->size() + num_zero_crossing);
+    foreground_cloud->reserve(foreground_cloud->size() + num_foreground);
+    for (int b = 0; b < total_blocks; b++) {
+        zero_crossing_cloud->points.insert(zero_crossing_cloud->points.end(), blocks[b].zero_crossing.begin(), blocks[b].zero_crossing.end());
+        foreground_cloud->points.insert(foreground_cloud->points.end(), blocks[b].foreground.begin(), blocks[b].foreground.end());
+    }
+    zero_crossing_cloud->width = zero_crossing_cloud->points.size();
+    zero_crossing_cloud->height = 1;
+    foreground_cloud->width = foreground_cloud->points.size();
+    foreground_cloud->height = 1;
+
+    // the unknown space grid spans the foreground cloud, so every grid cell moves when its bounds do
+    Eigen::Vector3d current_min = foreground_min.cast<double>();
+    Eigen::Vector3d current_max = foreground_max.cast<double>();
+    if (all_changed_ || current_min != grid_min || current_max != grid_max) {
+        all_changed_ = true;
+        grid_min = current_min;
+        grid_max = current_max;
+        if (num_foreground == 0) {
+            grid_size = Eigen::Vector3i::Zero();
+            grid_counts.clear();
+        } else {
+            for (int axis = 0; axis < 3; axis++) {
+                grid_size(axis) = ceil((grid_max(axis) - grid_min(axis)) / parameters.voxel_size);
+            }
+            grid_counts.assign((size_t) grid_size(0) * grid_size(1) * grid_size(2), 0);
+        }
+        for (int b = 0; b < total_blocks; b++) {
+            count_foreground(blocks[b].foreground, 1, NULL);
+        }
+
+        #ifdef _OPENMP
+        #pragma omp parallel for schedule(dynamic, 16)
+        #endif
+        for (int b = 0; b < total_blocks; b++) {
+            find_unknown(b);
+        }
+    } else {
+        // only the cells the points of the changed blocks fall into can become free or taken
+        std::vector<char> unknown_changed(total_blocks, 0);
+        for (int b = 0; b < total_blocks; b++) {
+            if (dirty[b]) {
+                count_foreground(previous_foreground[b], -1, &unknown_changed);
+                count_foreground(blocks[b].foreground, 1, &unknown_changed);
+            }
+        }
 
+        #ifdef _OPENMP
+        #pragma omp parallel for schedule(dynamic, 16)
+        #endif
+        for (int b = 0; b < total_blocks; b++) {
+            if (unknown_changed[b]) {
+                find_unknown(b);
+            }
+        }
+    }
 
+    size_t num_unknown = 0;
+    for (int b = 0; b < total_blocks; b++) {
+        num_unknown += blocks[b].unknown.size();
+    }
+    inverse_cloud->reserve(inverse_cloud->size() + num_unknown + num_inverse);
+    for (int b = 0; b < total_blocks; b++) {
+        inverse_cloud->points.insert(inverse_cloud->points.end(), blocks[b].unknown.begin(), blocks[b].unknown.end());
+    }
+    std::cout << "number of points in inverse cloud: " << inverse_cloud->size() << std::endl;
+    for (int b = 0; b < total_blocks; b++) {
+        inverse_cloud->points.insert(inverse_cloud->points.end(), blocks[b].inverse.begin(), blocks[b].inverse.end());
+    }
+    inverse_cloud->width = inverse_cloud->points.size();
+    inverse_cloud->height = 1;
+    std::cout << "number of points in inverse cloud (after adding low weight points): " << inverse_cloud->size() << std::endl;
 }
 
-void get_weight_cloud(std::vector<float> tsdf_distances, std::vector<short> tsdf_weights, pcl::PointCloud<pcl::PointXYZRGB>::Ptr weights_cloud, int jump) {
-    double resolution = 512;
-    double size = 2;
+void get_weight_cloud(const TsdfVolumeView& tsdf, pcl::PointCloud<pcl::PointXYZRGB>::Ptr weights_cloud, int jump) {
+    Eigen::Vector3f voxel_size = tsdf.voxel_size();
 
 
-    for (int z = 0; z < resolution; z = z + jump) {
-        for (int y = 0; y < resolution; y = y + jump) {
-            for (int x = 0; x < resolution; x = x + jump) {
-                float current_distance = tsdf_distances[resolution * resolution * z + resolution * y + x];
-                short current_weight = tsdf_weights[resolution * resolution * z + resolution * y + x];
+    for (int z = 0; z < tsdf.resolution(2); z = z + jump) {
+        for (int y = 0; y < tsdf.resolution(1); y = y + jump) {
+            for (int x = 0; x < tsdf.resolution(0); x = x + jump) {
+                size_t index = tsdf.index(x, y, z);
+                float current_distance = tsdf.distances[index];
+                short current_weight = tsdf.weights[index];
                 pcl::PointXYZRGB current;
-                current.x = x * size / resolution;
-                current.y = y * size / resolution;
-                current.z = z * size / resolution;
+                current.x = x * voxel_size(0);
+                current.y = y * voxel_size(1);
+                current.z = z * voxel_size(2);
 
 
                 if (current_weight > 0 && current_weight < 1000 && current_distance > 0.1 && current_distance < 0.9) {
@@ -0,0 +1,251 @@
+#include <pcl_utils/tsdf_raycaster.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <pcl/pcl_macros.h>
+
+namespace tsdf_raycaster {
+
+void RaycastImage::get_surface_cloud(pcl::PointCloud<pcl::PointXYZ>::Ptr cloud) const {
+    for (size_t i = 0; i < points.size(); i++) {
+        if (!pcl_isnan(points.points[i].z)) {
+            cloud->push_back(points.points[i]);
+        }
+    }
+}
+
+Raycaster::Raycaster(const tsdf_converter::TsdfVolumeView& tsdf, float trunc_dist)
+    : tsdf(tsdf), voxel_size(tsdf.voxel_size()), trunc_dist(trunc_dist) {
+    build_pyramid();
+}
+
+void Raycaster::build_pyramid() {
+    const Eigen::Vector3i& resolution = tsdf.resolution;
+
+    // finest level: minimum distance over each block and the voxels bordering it, as interpolation reaches one voxel
+    // further; unobserved voxels count as free space
+    Level base;
+    base.block_size = BASE_BLOCK_SIZE;
+    base.dims = (resolution + Eigen::Vector3i::Constant(BASE_BLOCK_SIZE - 1)) / BASE_BLOCK_SIZE;
+    base.min_distance.resize(base.dims.prod());
+
+    #ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic, 1)
+    #endif
+    for (int cz = 0; cz < base.dims(2); cz++) {
+        for (int cy = 0; cy < base.dims(1); cy++) {
+            for (int cx = 0; cx < base.dims(0); cx++) {
+                float min_distance = 1;
+                int z_end = std::min(resolution(2), (cz + 1) * BASE_BLOCK_SIZE + 1);
+                int y_end = std::min(resolution(1), (cy + 1) * BASE_BLOCK_SIZE + 1);
+                int x_end = std::min(resolution(0), (cx + 1) * BASE_BLOCK_SIZE + 1);
+                for (int z = std::max(0, cz * BASE_BLOCK_SIZE - 1); z < z_end; z++) {
+                    for (int y = std::max(0, cy * BASE_BLOCK_SIZE - 1); y < y_end; y++) {
+                        size_t row = tsdf.index(0, y, z);
+                        for (int x = std::max(0, cx * BASE_BLOCK_SIZE - 1); x < x_end; x++) {
+                            if (tsdf.weights[row + x] > 0) {
+                                min_distance = std::min(min_distance, tsdf.distances[row + x]);
+                            }
+                        }
+                    }
+                }
+                base.min_distance[((size_t) cz * base.dims(1) + cy) * base.dims(0) + cx] = min_distance;
+            }
+        }
+    }
+    levels.push_back(base);
+
+    // coarser levels take the minimum over 2x2x2 cells of the level below
+    while ((int) levels.size() < MAX_LEVELS && levels.back().dims.maxCoeff() > 1) {
+        const Level& fine = levels.back();
+        Level coarse;
+        coarse.block_size = fine.block_size * 2;
+        coarse.dims = (fine.dims + Eigen::Vector3i::Ones()) / 2;
+        coarse.min_distance.resize(coarse.dims.prod());
+        for (int cz = 0; cz < coarse.dims(2); cz++) {
+            for (int cy = 0; cy < coarse.dims(1); cy++) {
+                for (int cx = 0; cx < coarse.dims(0); cx++) {
+                    float min_distance = 1;
+                    for (int z = 2 * cz; z < std::min(2 * cz + 2, fine.dims(2)); z++) {
+                        for (int y = 2 * cy; y < std::min(2 * cy + 2, fine.dims(1)); y++) {
+                            for (int x = 2 * cx; x < std::min(2 * cx + 2, fine.dims(0)); x++) {
+                                min_distance = std::min(min_distance, fine.get(x, y, z));
+                            }
+                        }
+                    }
+                    coarse.min_distance[((size_t) cz * coarse.dims(1) + cy) * coarse.dims(0) + cx] = min_distance;
+                }
+            }
+        }
+        levels.push_back(coarse);
+    }
+}
+
+bool Raycaster::interpolate(const Eigen::Vector3f& g, float* value) const {
+    int x = floor(g(0)), y = floor(g(1)), z = floor(g(2));
+    if (x < 0 || y < 0 || z < 0 || x >= tsdf.resolution(0) - 1 || y >= tsdf.resolution(1) - 1 || z >= tsdf.resolution(2) - 1) {
+        return false;
+    }
+
+    float a = g(0) - x, b = g(1) - y, c = g(2) - z;
+    size_t i = tsdf.index(x, y, z);
+    size_t dy = tsdf.resolution(0);
+    size_t dz = (size_t) tsdf.resolution(0) * tsdf.resolution(1);
+    size_t corners[8] = {i, i + 1, i + dy, i + dy + 1, i + dz, i + dz + 1, i + dz + dy, i + dz + dy + 1};
+    for (int k = 0; k < 8; k++) {
+        if (tsdf.weights[corners[k]] <= 0) {
+            return false;
+        }
+    }
+
+    const float* d = tsdf.distances;
+    *value = (1 - c) * ((1 - b) * ((1 - a) * d[corners[0]] + a * d[corners[1]]) + b * ((1 - a) * d[corners[2]] + a * d[corners[3]]))
+             + c * ((1 - b) * ((1 - a) * d[corners[4]] + a * d[corners[5]]) + b * ((1 - a) * d[corners[6]] + a * d[corners[7]]));
+    return true;
+}
+
+Eigen::Vector3f Raycaster::gradient(const Eigen::Vector3f& g) const {
+    Eigen::Vector3f result;
+    for (int axis = 0; axis < 3; axis++) {
+        Eigen::Vector3f offset = Eigen::Vector3f::Zero();
+        offset(axis) = 1;
+        float forward, backward;
+        if (!interpolate(g + offset, &forward) || !interpolate(g - offset, &backward)) {
+            return Eigen::Vector3f::Constant(std::numeric_limits<float>::quiet_NaN());
+        }
+        result(axis) = (forward - backward) / voxel_size(axis);
+    }
+    return result.normalized();
+}
+
+void Raycaster::raycast(const Eigen::Matrix4d& cam_pose, const CameraIntrinsics& camera, RaycastImage* image) const {
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    image->width = camera.width;
+    image->height = camera.height;
+    image->depth.assign(camera.width * camera.height, nan);
+    pcl::PointXYZ nan_point;
+    nan_point.x = nan_point.y = nan_point.z = nan;
+    pcl::Normal nan_normal;
+    nan_normal.normal_x = nan_normal.normal_y = nan_normal.normal_z = nan;
+    image->points.points.assign(camera.width * camera.height, nan_point);
+    image->points.width = camera.width;
+    image->points.height = camera.height;
+    image->points.is_dense = false;
+    image->normals.points.assign(camera.width * camera.height, nan_normal);
+    image->normals.width = camera.width;
+    image->normals.height = camera.height;
+    image->normals.is_dense = false;
+
+    Eigen::Matrix3f rotation = cam_pose.block<3, 3>(0, 0).cast<float>();
+    Eigen::Vector3f origin = cam_pose.block<3, 1>(0, 3).cast<float>();
+
+    // keep the samples where interpolation has all eight voxels
+    Eigen::Vector3f box_min = 0.5f * voxel_size;
+    Eigen::Vector3f box_max = (tsdf.resolution.cast<float>() - Eigen::Vector3f::Constant(0.5f + 1e-4f)).cwiseProduct(voxel_size);
+    float min_step = 0.5f * voxel_size.minCoeff();
+    float epsilon = 1e-3f * voxel_size.minCoeff();
+
+    #ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic, 4)
+    #endif
+    for (int v = 0; v < camera.height; v++) {
+        for (int u = 0; u < camera.width; u++) {
+            Eigen::Vector3f ray_camera((u - camera.cx) / camera.fx, (v - camera.cy) / camera.fy, 1);
+            float ray_scale = ray_camera.norm();
+            Eigen::Vector3f direction = rotation * ray_camera / ray_scale;
+
+            // clip the ray against the volume and the range of the camera
+            float t_start = camera.min_range, t_end = camera.max_range;
+            for (int axis = 0; axis < 3; axis++) {
+                if (std::fabs(direction(axis)) < 1e-9f) {
+                    if (origin(axis) < box_min(axis) || origin(axis) > box_max(axis)) {
+                        t_end = -1;
+                    }
+                    continue;
+                }
+                float t0 = (box_min(axis) - origin(axis)) / direction(axis);
+                float t1 = (box_max(axis) - origin(axis)) / direction(axis);
+                t_start = std::max(t_start, std::min(t0, t1));
+                t_end = std::min(t_end, std::max(t0, t1));
+            }
+
+            bool have_previous = false, skipped = false;
+            float previous_value = 0, previous_t = 0;
+            float t = t_start;
+            while (t < t_end) {
+                Eigen::Vector3f g = (origin + t * direction).cwiseQuotient(voxel_size) - Eigen::Vector3f::Constant(0.5f);
+
+                // jump to the end of the coarsest block that has no surface
+                bool empty = false;
+                for (int level = levels.size() - 1; level >= 0 && !empty; level--) {
+                    const Level& current = levels[level];
+                    Eigen::Vector3i cell;
+                    for (int axis = 0; axis < 3; axis++) {
+                        cell(axis) = std::max(0, std::min(current.dims(axis) - 1, (int) floor(g(axis) / current.block_size)));
+                    }
+                    if (current.get(cell(0), cell(1), cell(2)) > 0) {
+                        float t_exit = INFINITY;
+                        for (int axis = 0; axis < 3; axis++) {
+                            if (std::fabs(direction(axis)) < 1e-9f) {
+                                continue;
+                            }
+                            int bound = (direction(axis) > 0) ? (cell(axis) + 1) * current.block_size : cell(axis) * current.block_size;
+                            float t_bound = ((bound + 0.5f) * voxel_size(axis) - origin(axis)) / direction(axis);
+                            t_exit = std::min(t_exit, t_bound);
+                        }
+                        t = std::max(t_exit, t) + epsilon;
+                        empty = true;
+                    }
+                }
+                if (empty) {
+                    have_previous = false;
+                    skipped = true;
+                    continue;
+                }
+
+                float value;
+                if (!interpolate(g, &value)) {
+                    have_previous = false;
+                    skipped = false;
+                    t += min_step;
+                    continue;
+                }
+
+                if (value < 0) {
+                    float t_hit;
+                    if (have_previous && previous_value > 0) {
+                        t_hit = previous_t + (t - previous_t) * previous_value / (previous_value - value);
+                    } else if (skipped) {
+                        // the surface starts right after a skipped block
+                        t_hit = t;
+                    } else {
+                        // started behind a surface
+                        break;
+                    }
+
+                    Eigen::Vector3f hit = origin + t_hit * direction;
+                    int pixel = v * camera.width + u;
+                    image->depth[pixel] = t_hit / ray_scale;
+                    image->points.points[pixel].x = hit(0);
+                    image->points.points[pixel].y = hit(1);
+                    image->points.points[pixel].z = hit(2);
+                    Eigen::Vector3f normal = gradient(hit.cwiseQuotient(voxel_size) - Eigen::Vector3f::Constant(0.5f));
+                    image->normals.points[pixel].normal_x = normal(0);
+                    image->normals.points[pixel].normal_y = normal(1);
+                    image->normals.points[pixel].normal_z = normal(2);
+                    break;
+                }
+
+                have_previous = true;
+                skipped = false;
+                previous_value = value;
+                previous_t = t;
+                // the distance is truncated, so it is a safe step size
+                t += std::max(min_step, 0.8f * value * trunc_dist);
+            }
+        }
+    }
+}
+
+}
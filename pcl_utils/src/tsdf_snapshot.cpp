@@ -0,0 +1,280 @@
+#include <pcl_utils/tsdf_snapshot.h>
+
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace tsdf_snapshot {
+
+namespace {
+    const char MAGIC[8] = {'T', 'S', 'D', 'F', 'S', 'N', 'A', 'P'};
+    const uint32_t VERSION = 2;
+    const float DISTANCE_SCALE = 32767;
+
+    struct BlockRange {
+        int x_begin, x_end, y_begin, y_end, z_begin, z_end;
+
+        BlockRange(const Eigen::Vector3i& resolution, const Eigen::Vector3i& num_blocks, size_t block) {
+            int bx = block % num_blocks(0), by = block / num_blocks(0) % num_blocks(1), bz = block / ((size_t) num_blocks(0) * num_blocks(1));
+            x_begin = bx * BLOCK_SIZE;
+            x_end = std::min(resolution(0), (bx + 1) * BLOCK_SIZE);
+            y_begin = by * BLOCK_SIZE;
+            y_end = std::min(resolution(1), (by + 1) * BLOCK_SIZE);
+            z_begin = bz * BLOCK_SIZE;
+            z_end = std::min(resolution(2), (bz + 1) * BLOCK_SIZE);
+        }
+
+        size_t num_voxels() const { return (size_t) (x_end - x_begin) * (y_end - y_begin) * (z_end - z_begin); }
+    };
+
+    template <typename T>
+    void write_value(std::ofstream& out, const T& value) {
+        out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    template <typename T>
+    bool read_value(std::ifstream& in, T* value) {
+        in.read(reinterpret_cast<char*>(value), sizeof(T));
+        return in.good();
+    }
+}
+
+bool write_snapshot(const std::string& file, const tsdf_converter::TsdfVolumeView& tsdf, const Eigen::Matrix4d& transformation_matrix) {
+    Eigen::Vector3i blocks_per_axis = (tsdf.resolution + Eigen::Vector3i::Constant(BLOCK_SIZE - 1)) / BLOCK_SIZE;
+    int num_blocks = blocks_per_axis.prod();
+
+    // find the blocks to store, and whether all of their weights fit in a byte
+    std::vector<char> stored(num_blocks, 0);
+    std::vector<short> block_max_weight(num_blocks, 0);
+
+    #ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic, 1)
+    #endif
+    for (int block = 0; block < num_blocks; block++) {
+        BlockRange range(tsdf.resolution, blocks_per_axis, block);
+        for (int z = range.z_begin; z < range.z_end; z++) {
+            for (int y = range.y_begin; y < range.y_end; y++) {
+                size_t row = tsdf.index(0, y, z);
+                for (int x = range.x_begin; x < range.x_end; x++) {
+                    if (tsdf.weights[row + x] != 0 || tsdf.distances[row + x] != 0) {
+                        stored[block] = 1;
+                    }
+                    block_max_weight[block] = std::max(block_max_weight[block], tsdf.weights[row + x]);
+                }
+            }
+        }
+    }
+
+    uint64_t num_stored_blocks = 0;
+    short max_weight = 0;
+    std::vector<unsigned char> occupancy((num_blocks + 7) / 8, 0);
+    for (int block = 0; block < num_blocks; block++) {
+        max_weight = std::max(max_weight, block_max_weight[block]);
+        if (stored[block]) {
+            occupancy[block / 8] |= 1 << (block % 8);
+            num_stored_blocks++;
+        }
+    }
+
+    std::ofstream out(file.c_str(), std::ios::out | std::ios::binary);
+    if (!out) {
+        std::cerr << "could not open " << file << " for writing" << std::endl;
+        return false;
+    }
+
+    uint32_t weight_bytes = max_weight <= 255 ? 1 : 2;
+    out.write(MAGIC, sizeof(MAGIC));
+    write_value(out, VERSION);
+    for (int axis = 0; axis < 3; axis++) {
+        write_value(out, (int32_t) tsdf.resolution(axis));
+    }
+    for (int axis = 0; axis < 3; axis++) {
+        write_value(out, tsdf.size(axis));
+    }
+    write_value(out, (int32_t) BLOCK_SIZE);
+    write_value(out, weight_bytes);
+    for (int x = 0; x < 4; x++) {
+        for (int y = 0; y < 4; y++) {
+            write_value(out, transformation_matrix(x, y));
+        }
+    }
+    write_value(out, num_stored_blocks);
+    out.write(reinterpret_cast<const char*>(&occupancy[0]), occupancy.size());
+
+    std::vector<short> block_distances;
+    std::vector<char> block_weights;
+    for (int block = 0; block < num_blocks; block++) {
+        if (!stored[block]) {
+            continue;
+        }
+        BlockRange range(tsdf.resolution, blocks_per_axis, block);
+        block_distances.resize(range.num_voxels());
+        block_weights.resize(range.num_voxels() * weight_bytes);
+        size_t i = 0;
+        for (int z = range.z_begin; z < range.z_end; z++) {
+            for (int y = range.y_begin; y < range.y_end; y++) {
+                size_t row = tsdf.index(0, y, z);
+                for (int x = range.x_begin; x < range.x_end; x++, i++) {
+                    float distance = std::max(-1.0f, std::min(1.0f, tsdf.distances[row + x]));
+                    block_distances[i] = (short) floor(distance * DISTANCE_SCALE + 0.5f);
+                    if (weight_bytes == 1) {
+                        block_weights[i] = (char) (unsigned char) tsdf.weights[row + x];
+                    } else {
+                        std::memcpy(&block_weights[2 * i], &tsdf.weights[row + x], sizeof(short));
+                    }
+                }
+            }
+        }
+        out.write(reinterpret_cast<const char*>(&block_distances[0]), block_distances.size() * sizeof(short));
+        out.write(&block_weights[0], block_weights.size());
+    }
+
+    out.close();
+    if (!out) {
+        std::cerr << "could not write " << file << std::endl;
+        return false;
+    }
+    return true;
+}
+
+Snapshot::Snapshot()
+    : transformation_matrix_(Eigen::Matrix4d::Identity()), num_blocks_(0), num_stored_blocks_(0) {}
+
+bool Snapshot::read(const std::string& file) {
+    std::ifstream in(file.c_str(), std::ios::in | std::ios::binary);
+    if (!in) {
+        std::cerr << "could not open " << file << std::endl;
+        return false;
+    }
+    in.seekg(0, std::ios::end);
+    uint64_t file_bytes = in.tellg();
+    in.seekg(0, std::ios::beg);
+
+    char magic[sizeof(MAGIC)];
+    uint32_t version, weight_bytes;
+    int32_t file_resolution[3], block_size;
+    float file_size[3];
+    uint64_t file_stored_blocks;
+    in.read(magic, sizeof(magic));
+    if (!in || std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0) {
+        std::cerr << file << " is not a tsdf snapshot" << std::endl;
+        return false;
+    }
+    if (!read_value(in, &version) || version != VERSION) {
+        std::cerr << file << " has an unsupported snapshot version" << std::endl;
+        return false;
+    }
+    bool header_read = true;
+    for (int axis = 0; axis < 3; axis++) {
+        header_read = header_read && read_value(in, &file_resolution[axis]);
+    }
+    for (int axis = 0; axis < 3; axis++) {
+        header_read = header_read && read_value(in, &file_size[axis]);
+    }
+    header_read = header_read && read_value(in, &block_size) && read_value(in, &weight_bytes);
+    for (int x = 0; x < 4; x++) {
+        for (int y = 0; y < 4; y++) {
+            header_read = header_read && read_value(in, &transformation_matrix_(x, y));
+        }
+    }
+    header_read = header_read && read_value(in, &file_stored_blocks);
+    if (!header_read) {
+        std::cerr << file << " is truncated" << std::endl;
+        return false;
+    }
+    bool header_valid = block_size == BLOCK_SIZE && (weight_bytes == 1 || weight_bytes == 2);
+    for (int axis = 0; axis < 3; axis++) {
+        header_valid = header_valid && file_resolution[axis] > 0 && file_size[axis] > 0 && pcl_isfinite(file_size[axis]);
+    }
+    if (!header_valid) {
+        std::cerr << file << " has an invalid header" << std::endl;
+        return false;
+    }
+
+    // the occupancy needs a bit per block and each stored block at least one voxel, so a resolution or a block count
+    // the rest of the file cannot hold is rejected before anything is allocated
+    uint64_t remaining_bytes = file_bytes - (uint64_t) in.tellg();
+    Eigen::Vector3i blocks_per_axis;
+    uint64_t total_blocks = 1;
+    for (int axis = 0; axis < 3; axis++) {
+        blocks_per_axis(axis) = file_resolution[axis] / BLOCK_SIZE + (file_resolution[axis] % BLOCK_SIZE != 0);
+        if ((uint64_t) blocks_per_axis(axis) > remaining_bytes * 8 / total_blocks) {
+            std::cerr << file << " is too small for a resolution of " << file_resolution[0] << "x" << file_resolution[1] << "x" << file_resolution[2] << std::endl;
+            return false;
+        }
+        total_blocks *= blocks_per_axis(axis);
+    }
+    uint64_t occupancy_bytes = (total_blocks + 7) / 8;
+    if (occupancy_bytes > remaining_bytes || file_stored_blocks > total_blocks
+            || file_stored_blocks > (remaining_bytes - occupancy_bytes) / (sizeof(short) + weight_bytes)) {
+        std::cerr << file << " is too small for " << file_stored_blocks << " stored blocks" << std::endl;
+        return false;
+    }
+
+    geometry = tsdf_converter::VolumeGeometry(Eigen::Vector3i(file_resolution[0], file_resolution[1], file_resolution[2]),
+                                              Eigen::Vector3f(file_size[0], file_size[1], file_size[2]));
+    num_blocks_ = total_blocks;
+    num_stored_blocks_ = 0;
+
+    std::vector<unsigned char> occupancy(occupancy_bytes);
+    in.read(reinterpret_cast<char*>(&occupancy[0]), occupancy.size());
+    if (!in) {
+        std::cerr << file << " is truncated" << std::endl;
+        return false;
+    }
+
+    tsdf_converter::TsdfVolumeView layout(NULL, NULL, geometry);
+    distances.assign(layout.num_voxels(), 0.0f);
+    weights.assign(layout.num_voxels(), 0);
+
+    std::vector<short> block_distances;
+    std::vector<char> block_weights;
+    for (size_t block = 0; block < num_blocks_; block++) {
+        if (!(occupancy[block / 8] & (1 << (block % 8)))) {
+            continue;
+        }
+        BlockRange range(geometry.resolution, blocks_per_axis, block);
+        block_distances.resize(range.num_voxels());
+        block_weights.resize(range.num_voxels() * weight_bytes);
+        in.read(reinterpret_cast<char*>(&block_distances[0]), block_distances.size() * sizeof(short));
+        in.read(&block_weights[0], block_weights.size());
+        if (!in) {
+            std::cerr << file << " is truncated" << std::endl;
+            return false;
+        }
+
+        size_t i = 0;
+        for (int z = range.z_begin; z < range.z_end; z++) {
+            for (int y = range.y_begin; y < range.y_end; y++) {
+                size_t row = layout.index(0, y, z);
+                for (int x = range.x_begin; x < range.x_end; x++, i++) {
+                    distances[row + x] = block_distances[i] / DISTANCE_SCALE;
+                    if (weight_bytes == 1) {
+                        weights[row + x] = (unsigned char) block_weights[i];
+                    } else {
+                        std::memcpy(&weights[row + x], &block_weights[2 * i], sizeof(short));
+                    }
+                }
+            }
+        }
+        num_stored_blocks_++;
+    }
+
+    if (num_stored_blocks_ != file_stored_blocks) {
+        std::cerr << file << " has " << num_stored_blocks_ << " blocks, the header says " << file_stored_blocks << std::endl;
+        return false;
+    }
+    return true;
+}
+
+tsdf_converter::TsdfVolumeView Snapshot::view() const {
+    if (distances.empty()) {
+        return tsdf_converter::TsdfVolumeView();
+    }
+    return tsdf_converter::TsdfVolumeView(&distances[0], &weights[0], geometry);
+}
+
+}
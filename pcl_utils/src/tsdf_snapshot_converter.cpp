@@ -0,0 +1,89 @@
+#include <pcl_utils/tsdf_converter.h>
+#include <pcl_utils/tsdf_snapshot.h>
+
+#include <cstring>
+#include <fstream>
+
+// converts the dense kinfu dumps (distances, weights and matrix file) to a snapshot, or back with -d
+int main(int argc, char** argv) {
+    bool to_dense = argc > 1 && std::strcmp(argv[1], "-d") == 0;
+    if ((to_dense && argc < 6) || (!to_dense && argc < 5)) {
+        std::cerr << "usage: tsdf_snapshot_converter dist_file weight_file matrix_file snapshot_file [res_x res_y res_z size_x size_y size_z]" << std::endl;
+        std::cerr << "       tsdf_snapshot_converter -d snapshot_file dist_file weight_file matrix_file" << std::endl;
+        return 1;
+    }
+
+    if (to_dense) {
+        std::string snapshot_file = argv[2];
+        std::string dist_file = argv[3];
+        std::string weight_file = argv[4];
+        std::string matrix_file = argv[5];
+
+        tsdf_snapshot::Snapshot snapshot;
+        if (!snapshot.read(snapshot_file)) {
+            return 1;
+        }
+        tsdf_converter::TsdfVolumeView tsdf = snapshot.view();
+
+        std::ofstream dist_out(dist_file.c_str(), std::ios::out | std::ios::binary);
+        dist_out.write(reinterpret_cast<const char*>(tsdf.distances), tsdf.num_voxels() * sizeof(float));
+        dist_out.close();
+
+        std::ofstream weight_out(weight_file.c_str(), std::ios::out | std::ios::binary);
+        weight_out.write(reinterpret_cast<const char*>(tsdf.weights), tsdf.num_voxels() * sizeof(short));
+        weight_out.close();
+
+        std::ofstream matrix_outstream(matrix_file.c_str());
+        for (int x = 0; x < 4; x++)
+        {
+            for (int y = 0; y < 4; y++)
+            {
+                matrix_outstream << snapshot.transformation_matrix()(x, y) << std::endl;
+            }
+        }
+        matrix_outstream.close();
+
+        if (!dist_out || !weight_out || !matrix_outstream) {
+            std::cerr << "could not write the dense files!" << std::endl;
+            return 1;
+        }
+        std::cout << "done" << std::endl;
+        return 0;
+    }
+
+    std::string dist_file = argv[1];
+    std::string weight_file = argv[2];
+    std::string matrix_file = argv[3];
+    std::string snapshot_file = argv[4];
+
+    tsdf_converter::VolumeGeometry geometry;
+    if (!tsdf_converter::parse_volume_geometry(argc, argv, 5, &geometry)) {
+        return 1;
+    }
+
+    tsdf_converter::MappedTsdfVolume tsdf;
+    if (!tsdf.open(dist_file, weight_file, geometry)) {
+        std::cerr << "could not map the tsdf files!" << std::endl;
+        return 1;
+    }
+
+    Eigen::Matrix4d transformation_matrix = Eigen::Matrix4d::Zero();
+    std::ifstream matrix_instream;
+    matrix_instream.open(matrix_file.c_str());
+    std::string current_input;
+    for (int x = 0; x < transformation_matrix.rows(); x++)
+    {
+        for (int y = 0; y < transformation_matrix.cols(); y++)
+        {
+            getline(matrix_instream, current_input);
+            transformation_matrix(x, y) = std::atof(current_input.c_str());
+        }
+    }
+    matrix_instream.close();
+
+    if (!tsdf_snapshot::write_snapshot(snapshot_file, tsdf.view(), transformation_matrix)) {
+        return 1;
+    }
+    std::cout << "done" << std::endl;
+    return 0;
+}
@@ -0,0 +1,131 @@
+#include <pcl_utils/tsdf_statistics.h>
+
+#include <algorithm>
+
+namespace tsdf_statistics {
+
+void WeightStatistics::clear() {
+    num_voxels = 0;
+    num_observed = 0;
+    weight_sum = 0;
+    std::fill(weight_histogram, weight_histogram + NUM_WEIGHT_BINS, 0);
+    std::fill(distance_histogram, distance_histogram + NUM_DISTANCE_BINS, 0);
+}
+
+void WeightStatistics::add(const WeightStatistics& other) {
+    num_voxels += other.num_voxels;
+    num_observed += other.num_observed;
+    weight_sum += other.weight_sum;
+    for (int i = 0; i < NUM_WEIGHT_BINS; i++) {
+        weight_histogram[i] += other.weight_histogram[i];
+    }
+    for (int i = 0; i < NUM_DISTANCE_BINS; i++) {
+        distance_histogram[i] += other.distance_histogram[i];
+    }
+}
+
+// counts one row of voxels
+static void add_row(const float* distances, const short* weights, int length, WeightStatistics* statistics) {
+    statistics->num_voxels += length;
+    for (int i = 0; i < length; i++) {
+        short weight = weights[i];
+        if (weight <= 0) {
+            statistics->weight_histogram[0]++;
+            continue;
+        }
+
+        int weight_bin = 1;
+        for (int w = weight >> 1; w > 0; w >>= 1) {
+            weight_bin++;
+        }
+        statistics->num_observed++;
+        statistics->weight_sum += weight;
+        statistics->weight_histogram[weight_bin]++;
+
+        float distance = distances[i];
+        if (!pcl_isfinite(distance)) {
+            continue;
+        }
+        int distance_bin = (int) ((distance + 1) * (0.5f * WeightStatistics::NUM_DISTANCE_BINS));
+        distance_bin = std::max(0, std::min(WeightStatistics::NUM_DISTANCE_BINS - 1, distance_bin));
+        statistics->distance_histogram[distance_bin]++;
+    }
+}
+
+WeightStatistics compute_statistics(const tsdf_converter::TsdfVolumeView& tsdf) {
+    // one set of counts per z slice, added up in order afterwards
+    std::vector<WeightStatistics> slices(tsdf.resolution(2));
+
+    #ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic, 4)
+    #endif
+    for (int z = 0; z < tsdf.resolution(2); z++) {
+        for (int y = 0; y < tsdf.resolution(1); y++) {
+            size_t row = tsdf.index(0, y, z);
+            add_row(tsdf.distances + row, tsdf.weights + row, tsdf.resolution(0), &slices[z]);
+        }
+    }
+
+    WeightStatistics statistics;
+    for (size_t z = 0; z < slices.size(); z++) {
+        statistics.add(slices[z]);
+    }
+    return statistics;
+}
+
+IncrementalStatistics::IncrementalStatistics() : num_blocks(Eigen::Vector3i::Zero()), num_blocks_updated_(0) {
+}
+
+void IncrementalStatistics::clear() {
+    blocks.clear();
+    total.clear();
+    num_blocks_updated_ = 0;
+}
+
+const WeightStatistics& IncrementalStatistics::update(const tsdf_converter::TsdfVolumeView& tsdf, const std::vector<char>* changed_blocks) {
+    bool all_changed = blocks.empty() || tsdf.geometry() != geometry;
+    if (all_changed) {
+        geometry = tsdf.geometry();
+        num_blocks = (geometry.resolution + Eigen::Vector3i::Constant(BLOCK_SIZE - 1)) / BLOCK_SIZE;
+        blocks.assign((size_t) num_blocks(0) * num_blocks(1) * num_blocks(2), WeightStatistics());
+    }
+    int total_blocks = blocks.size();
+    if (changed_blocks == NULL || (int) changed_blocks->size() != total_blocks) {
+        all_changed = true;
+    }
+
+    int blocks_updated = 0;
+
+    #ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic, 16) reduction(+:blocks_updated)
+    #endif
+    for (int b = 0; b < total_blocks; b++) {
+        if (!all_changed && !(*changed_blocks)[b]) {
+            continue;
+        }
+        blocks_updated++;
+
+        Eigen::Vector3i start(b % num_blocks(0) * BLOCK_SIZE, b / num_blocks(0) % num_blocks(1) * BLOCK_SIZE,
+                              b / (num_blocks(0) * num_blocks(1)) * BLOCK_SIZE);
+        Eigen::Vector3i end = (start + Eigen::Vector3i::Constant(BLOCK_SIZE)).cwiseMin(geometry.resolution);
+
+        WeightStatistics& block = blocks[b];
+        block.clear();
+        for (int z = start(2); z < end(2); z++) {
+            for (int y = start(1); y < end(1); y++) {
+                size_t row = tsdf.index(start(0), y, z);
+                add_row(tsdf.distances + row, tsdf.weights + row, end(0) - start(0), &block);
+            }
+        }
+    }
+    num_blocks_updated_ = blocks_updated;
+
+    // adding up all blocks is cheap next to counting the changed ones
+    total.clear();
+    for (int b = 0; b < total_blocks; b++) {
+        total.add(blocks[b]);
+    }
+    return total;
+}
+
+}